@@ -0,0 +1,232 @@
+/*
+ * clone.c - boot once, then fork copies of the machine
+ *
+ * For running many tests from the same booted state, the machine boots
+ * once until a marker: text on its console, or a number of cycles. Then
+ * it forks one process per test. The clones share the memory of the
+ * booted machine copy on write, so starting one costs a fork, and each
+ * only pays for the pages it changes.
+ *
+ * Clone n has its console in files: it reads clone<n>.in, if there is
+ * one, and writes clone<n>.out. Its disk images are behind overlays, so
+ * what it writes stays its own (see machine_clone() in the boards), and
+ * so are those it gets later by a media swap. The parent waits for all
+ * clones and reports how they exited, so every clone needs an end.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../hostio/hostio.h"
+#include "clone.h"
+
+#define MAXMARKER 128
+
+struct clone_marker {
+	char text[MAXMARKER];	/* empty for a cycle count */
+	int len;
+	uint64_t cycles;
+	char seen[MAXMARKER];	/* the last len characters of output */
+	int hit;
+};
+
+static int count = 0;
+static int self = -1;		/* the number of this clone, -1 in the parent */
+static struct clone_marker start_marker, end_marker;
+static uint64_t cycles = 0;	/* since boot, in a clone since the fork */
+static FILE *out = NULL, *in = NULL;
+static int pending = EOF;	/* next input character, read ahead */
+
+static void clone_marker_set(struct clone_marker *m, const char *spec)
+{
+	memset(m, 0, sizeof(*m));
+	if (spec[0] == '#') {
+		m->cycles = strtoull(spec + 1, NULL, 0);
+		return;
+	}
+	strncpy(m->text, spec, MAXMARKER - 1);
+	m->len = strlen(m->text);
+}
+
+static void clone_marker_feed(struct clone_marker *m, uint8_t c)
+{
+	if (!m->len || m->hit)
+		return;
+	memmove(m->seen, m->seen + 1, m->len - 1);
+	m->seen[m->len - 1] = c;
+	if (!memcmp(m->seen, m->text, m->len))
+		m->hit = 1;
+}
+
+int clone_init(int n, const char *start, const char *end)
+{
+	/* the parent waits for every clone, so each one has to end */
+	if (!end)
+		return -1;
+	count = n;
+	if (start)
+		clone_marker_set(&start_marker, start);
+	else
+		start_marker.hit = 1;
+	clone_marker_set(&end_marker, end);
+	return 0;
+}
+
+int clone_active()
+{
+	return count > 0;
+}
+
+int clone_self()
+{
+	return self;
+}
+
+const char *clone_file(const char *suffix)
+{
+	static char name[64];
+
+	snprintf(name, sizeof(name), "clone%d.%s", self, suffix);
+	return name;
+}
+
+void clone_console_tx(uint8_t c)
+{
+	if (self == -1) {
+		clone_marker_feed(&start_marker, c);
+		fputc(c, stdout);
+		return;
+	}
+	clone_marker_feed(&end_marker, c);
+	if (out)
+		fputc(c, out);
+}
+
+int clone_console_available()
+{
+	if (pending == EOF && in)
+		pending = getc(in);
+	return pending != EOF;
+}
+
+int clone_console_rx()
+{
+	int c;
+
+	if (!clone_console_available())
+		return -1;
+	c = pending;
+	pending = EOF;
+	return c;
+}
+
+static void clone_child(int n)
+{
+	self = n;
+	cycles = 0;
+	if (!(out = fopen(clone_file("out"), "w"))) {
+		perror(clone_file("out"));
+		exit(2);
+	}
+	in = fopen(clone_file("in"), "r");
+	machine_clone(n);
+}
+
+/* fork the clones, at most one per host CPU at a time; returns in the
+   clones only */
+static void clone_run()
+{
+	pid_t *pids = calloc(count, sizeof(pid_t));
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int total = count, next = 0, running = 0, failed = 0, status, n;
+	pid_t pid;
+
+	if (jobs < 1)
+		jobs = 1;
+	printf("\r\nclone: start marker after %llu cycles, running %d clones\r\n",
+	    (unsigned long long)cycles, count);
+	fflush(stdout);
+	/* worker threads do not survive fork, the clones do their I/O inline */
+	hostio_shutdown();
+
+	while (next < count || running) {
+		while (next < count && running < jobs) {
+			pid = fork();
+			if (pid == 0) {
+				free(pids);
+				clone_child(next);
+				return;
+			}
+			if (pid == -1) {
+				perror("clone");
+				failed += count - next;
+				count = next;
+				break;
+			}
+			pids[next++] = pid;
+			running++;
+		}
+		if (!running)
+			break;
+		if ((pid = wait(&status)) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (n = 0; n < next && pids[n] != pid; n++)
+			;
+		if (n == next)
+			continue;
+		running--;
+		if (WIFEXITED(status)) {
+			printf("clone %d: exit %d\r\n", n, WEXITSTATUS(status));
+			if (WEXITSTATUS(status))
+				failed++;
+		} else {
+			printf("clone %d: signal %d\r\n", n, WTERMSIG(status));
+			failed++;
+		}
+		fflush(stdout);
+	}
+	printf("clone: %d of %d failed\r\n", failed, total);
+	exit(failed ? 1 : 0);
+}
+
+void clone_tick(long n)
+{
+	if (!count)
+		return;
+	cycles += n;
+	if (self == -1) {
+		if (start_marker.cycles && cycles >= start_marker.cycles)
+			start_marker.hit = 1;
+		if (start_marker.hit)
+			clone_run();
+		return;
+	}
+	if (end_marker.cycles && cycles >= end_marker.cycles)
+		end_marker.hit = 1;
+	if (end_marker.hit)
+		exit(0);
+}
@@ -0,0 +1,47 @@
+/*
+ * clone.h - boot once, then fork copies of the machine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef CLONE_H
+#define CLONE_H
+
+#include <stdint.h>
+
+/* A marker is text the guest prints on the console, or #n for n cycles.
+ * Boot until the start marker, then run count clones. A clone exits
+ * with 0 when it reaches the end marker, which is needed, -1 without. */
+extern int clone_init(int count, const char *start, const char *end);
+extern int clone_active();
+/* the number of this clone, -1 in the parent */
+extern int clone_self();
+/* the console of the machine while clone mode is on */
+extern void clone_console_tx(uint8_t c);
+extern int clone_console_available();
+extern int clone_console_rx();
+/* call at slice boundaries with the cycles run; forks at the start
+ * marker and returns only in the clones */
+extern void clone_tick(long cycles);
+/* "clone<n>.suffix", for the files a clone keeps for itself */
+extern const char *clone_file(const char *suffix);
+
+/* Provided by the board: called in each new clone, to give it disk
+ * overlays and whatever else it must not share with the others. */
+extern void machine_clone(int n);
+
+#endif /* CLONE_H */
@@ -29,12 +29,26 @@
 #include "rawtty.h"
 
 #include "z180/z180.h"
+#include "media/media.h"
+#include "hostio/hostio.h"
+#include "snapshot/snapshot.h"
+#include "record/record.h"
+#include "trace/trace.h"
+#include "profile/profile.h"
+#include "profile/callgraph.h"
+#include "profile/cpm.h"
+#include "profile/coverage.h"
+#include "profile/memstats.h"
 
-#define MAXBREAKPTS 32
-#define CMDBUFLEN 60
+#define MAXCHECKPOINTS 32
+#define CMDBUFLEN 256
 
 /* reference into main program */
 extern void do_timers();
+extern int machine_save(const char *file);
+extern int machine_load(const char *file);
+extern snapshot_t *machine_snapshot();
+extern int machine_restore(snapshot_t *s);
 extern int VERBOSE;
 
 static UINT8 *mem_ram = 0;
@@ -46,6 +60,8 @@ static int dbg_stepping = 0;
 static int dbg_nstart = -1;
 static int dbg_nend = -1;
 
+static device_t *dbg_cpu = NULL;
+
 void disableCTRLC() {
 #ifdef _WIN32
 	HANDLE consoleHandle = GetStdHandle(STD_INPUT_HANDLE);
@@ -72,7 +88,14 @@ int dbg_init(int stepping, UINT8 *ram, UINT8 *rom) {
 	return -1;
 }
 
+static void dbg_checkpoint();
+static void dbg_ioLogDrop(uint64_t from);
+static uint64_t checkpoint_every = 0;
+static int rewind_restore = 0;
+
 int dbg_running() {
+	if (dbg_cpu && (checkpoint_every || rewind_restore))
+		dbg_checkpoint();
 	return !dbg_quit;
 }
 
@@ -175,73 +198,109 @@ static int dbg_ensureEoln(const char *buf, int len, int *ptr) {
 	return eoln;
 }
 
+/* Breakpoints are on physical addresses, so one in banked code only
+ * fires in its own bank. The instruction hook tests a bit per address of
+ * the 1MB physical space; the sorted list is only for what goes with it,
+ * and for listing. */
+static UINT8 breakmap[0x100000 >> 3];
 static struct breakpoint {
-	offs_t pc;
+	offs_t addr;	// physical
+	offs_t pc;	// logical, as it was set
 	int temp;
-} breakpoints[MAXBREAKPTS];
-static offs_t numbreakpts = 0;
+} *breakpoints = NULL;
+static int numbreakpts = 0, maxbreakpts = 0;
 
-static int dbg_break(offs_t pc, int temporary) {
-	if (numbreakpts == MAXBREAKPTS) {
-		tty_print("error: maximum number of breakpoints reached.\r\n");
-		return 0;
+static offs_t dbg_physical(device_t *device, offs_t pc) {
+	offs_t addr = pc & 0xffff;
+	cpu_translate_z180(device, AS_PROGRAM, 0, &addr);
+	return addr & 0xfffff;
+}
+
+// index of the breakpoint at or after physical address addr
+static int dbg_breakSearch(offs_t addr) {
+	int min = 0, max = numbreakpts;
+	while (min < max) {
+		int med = min + ((max - min) >> 1);
+		if (breakpoints[med].addr < addr)
+			min = med + 1;
+		else
+			max = med;
 	}
-	int newpt = 0;
-	while (newpt < numbreakpts && breakpoints[newpt].pc < pc) newpt += 1;
+	return min;
+}
+
+static int dbg_breakFind(offs_t addr) {
+	if (!(breakmap[addr >> 3] & (1 << (addr & 7)))) return -1;
+	return dbg_breakSearch(addr);
+}
+
+static int dbg_break(device_t *device, offs_t pc, int temporary) {
+	offs_t addr = dbg_physical(device, pc);
+	int n = dbg_breakFind(addr);
 	// breakpoint already exists, even if as temporary?
-	if (breakpoints[newpt].pc == pc && temporary == 0) {
-		breakpoints[newpt].temp = 0;
+	if (n >= 0) {
+		if (temporary == 0) {
+			breakpoints[n].temp = 0;
+			tty_printf("breakpoint set at $%04x ($%05x)\r\n", pc, addr);
+		}
 		return 1;
 	}
+	if (numbreakpts == maxbreakpts) {
+		int max = maxbreakpts ? maxbreakpts * 2 : 32;
+		struct breakpoint *b = realloc(breakpoints, max * sizeof(*b));
+		if (b == NULL) {
+			tty_print("error: out of memory for breakpoints.\r\n");
+			return 0;
+		}
+		breakpoints = b;
+		maxbreakpts = max;
+	}
 	// insert new breakpoint
-	int n = numbreakpts;
-	while (n > newpt)
-		breakpoints[n] = breakpoints[n - 1];
-	breakpoints[newpt].pc = pc;
-	breakpoints[newpt].temp = temporary;
+	n = dbg_breakSearch(addr);
+	memmove(&breakpoints[n + 1], &breakpoints[n], (numbreakpts - n) * sizeof(*breakpoints));
+	breakpoints[n].addr = addr;
+	breakpoints[n].pc = pc;
+	breakpoints[n].temp = temporary;
 	numbreakpts += 1;
-	if (temporary == 0) tty_printf("breakpoint set at $%04x\r\n", pc);
+	breakmap[addr >> 3] |= 1 << (addr & 7);
+	if (temporary == 0) tty_printf("breakpoint set at $%04x ($%05x)\r\n", pc, addr);
 	return 1;
 }
 
-static int dbg_breakDel(offs_t pc) {
-	int n = 0;
-	while (n < numbreakpts && breakpoints[n].pc < pc) n += 1;
-	if (n < numbreakpts && breakpoints[n].pc == pc) {
-		int temporary = breakpoints[n].temp;
-		for (; n < numbreakpts - 1; n += 1)
-			breakpoints[n] = breakpoints[n + 1];
-		numbreakpts -= 1;
-		if (temporary == 0) tty_print("breakpoint deleted.\r\n");
-		return 1;
-	}
-	return 0;
+static int dbg_breakRemove(offs_t addr) {
+	int n = dbg_breakFind(addr);
+	if (n < 0) return 0;
+	int temporary = breakpoints[n].temp;
+	memmove(&breakpoints[n], &breakpoints[n + 1], (numbreakpts - n - 1) * sizeof(*breakpoints));
+	numbreakpts -= 1;
+	breakmap[addr >> 3] &= ~(1 << (addr & 7));
+	if (temporary == 0) tty_print("breakpoint deleted.\r\n");
+	return 1;
 }
 
-static int dbg_isBreak(offs_t pc) {
-	if (numbreakpts == 0) return 0;
-	if (pc < breakpoints[0].pc) return 0;
-	if (breakpoints[numbreakpts - 1].pc < pc) return 0;
-	int min = 0, max = numbreakpts - 1;
-	while (1) {
-		int med = min + ((max - min) >> 1);
-		if (pc < breakpoints[med].pc && min < med)
-			max = med;
-		else if (breakpoints[med].pc < pc && med < max)
-			min = med;
-		else if (breakpoints[med].pc == pc) {
-			if (breakpoints[med].temp) dbg_breakDel(pc);
-			return 1;
-		} else
-			return 0;
-	}
+static int dbg_breakDel(device_t *device, offs_t pc) {
+	return dbg_breakRemove(dbg_physical(device, pc));
+}
+
+static void dbg_breakClear() {
+	memset(breakmap, 0, sizeof(breakmap));
+	numbreakpts = 0;
+}
+
+// only called with breakpoints set, see dbg_instruction_hook()
+static int dbg_isBreak(device_t *device, offs_t pc) {
+	offs_t addr = dbg_physical(device, pc);
+	int n = dbg_breakFind(addr);
+	if (n < 0) return 0;
+	if (breakpoints[n].temp) dbg_breakRemove(addr);
+	return 1;
 }
 
 static int dbg_breakEnum() {
 	int n = 0;
 	tty_print("breakpoints:\r\n");
 	while (n < numbreakpts) {
-		tty_printf("$%04x %c\r\n", breakpoints[n].pc, breakpoints[n].temp ? '*' : ' ');
+		tty_printf("$%04x ($%05x) %c\r\n", breakpoints[n].pc, breakpoints[n].addr, breakpoints[n].temp ? '*' : ' ');
 		n += 1;
 	}
 	return 1;
@@ -256,12 +315,447 @@ static int dbg_next(device_t *device, offs_t pc) {
 		UINT8 *mem = dbg_getmemArray(device, pc);
 		if (mem == NULL) return 0;
 		dres = cpu_disassemble_z180(device,ibuf,pc,&mem[pc],&mem[pc],0) & DASMFLAG_LENGTHMASK;
-		dbg_break(pc + dres, 1);
+		dbg_break(device, pc + dres, 1);
 		dbg_stepping = 0;
 	} else
 		dbg_stepping = 1;
 }
 
+/* Going back: checkpoints of the machine are taken every so many cycles
+ * at slice boundaries, with the journal of inputs (see record/record.c).
+ * To go back, the checkpoint before is restored and run forward again,
+ * first to find the instruction to stop at, then to stop there. If it is
+ * not in the stretch after the checkpoint, the one before is searched.
+ * Console output is not repeated while this runs. */
+static struct checkpoint {
+	uint64_t cycle;
+	snapshot_t *s;
+} checkpoints[MAXCHECKPOINTS];
+static int numcheckpoints = 0;
+
+enum { REWIND_OFF, REWIND_SEARCH, REWIND_GOTO };
+enum { REWIND_STEP, REWIND_NEXT, REWIND_LEVEL, REWIND_BREAK };
+
+static int rewind_state = REWIND_OFF;
+static int rewind_what;
+static int rewind_ckpt;			/* the checkpoint run from */
+static uint64_t rewind_now;		/* where going back was asked for */
+static uint64_t rewind_limit;		/* end of the stretch searched */
+static uint64_t rewind_found, rewind_level, rewind_target;
+static int rewind_fromcall;		/* the last op was a return from below */
+static UINT16 rewind_sp;
+
+int dbg_rewinding() {
+	return rewind_state != REWIND_OFF;
+}
+
+static void dbg_checkpointsDrop(uint64_t after) {
+	while (numcheckpoints && checkpoints[numcheckpoints - 1].cycle > after)
+		snapshot_close(checkpoints[--numcheckpoints].s);
+}
+
+static void dbg_checkpoint() {
+	uint64_t now = z180_get_cycles(dbg_cpu);
+	snapshot_t *s;
+
+	if (rewind_restore) {
+		rewind_restore = 0;
+		s = checkpoints[rewind_ckpt].s;
+		if (machine_restore(s) == -1 || record_snapshot_load(s) == -1) {
+			tty_print("error: could not restore the checkpoint\r\n");
+			rewind_state = REWIND_OFF;
+			dbg_stepping = 1;
+		} else {
+			dbg_ioLogDrop(checkpoints[rewind_ckpt].cycle);
+			z180_history_drop(dbg_cpu, checkpoints[rewind_ckpt].cycle);
+		}
+		return;
+	}
+	if (rewind_state != REWIND_OFF)
+		return;
+	if (numcheckpoints && now < checkpoints[numcheckpoints - 1].cycle + checkpoint_every)
+		return;
+	// inputs must come in at the same cycles when run again
+	hostio_shutdown();
+	if (record_journal(dbg_cpu) == -1) {
+		tty_print("error: could not start the journal, no checkpoints\r\n");
+		checkpoint_every = 0;
+		return;
+	}
+	// none while the FDC is busy, try again after the next slice
+	if (!(s = machine_snapshot())) return;
+	record_snapshot_save(s);
+	if (numcheckpoints == MAXCHECKPOINTS) {
+		snapshot_close(checkpoints[0].s);
+		memmove(checkpoints, checkpoints + 1, --numcheckpoints * sizeof(*checkpoints));
+	}
+	checkpoints[numcheckpoints].cycle = now;
+	checkpoints[numcheckpoints].s = snapshot_keep(s, numcheckpoints ? checkpoints[numcheckpoints - 1].s : NULL);
+	numcheckpoints += 1;
+}
+
+static void dbg_checkpointsEnum() {
+	if (!checkpoint_every) {
+		tty_print("no checkpoints.\r\n");
+		return;
+	}
+	if (numcheckpoints)
+		tty_printf("a checkpoint every %llu cycles, %d kept, from cycle %llu to %llu\r\n",
+			(unsigned long long)checkpoint_every, numcheckpoints,
+			(unsigned long long)checkpoints[0].cycle, (unsigned long long)checkpoints[numcheckpoints - 1].cycle);
+	else
+		tty_printf("a checkpoint every %llu cycles, none kept yet\r\n", (unsigned long long)checkpoint_every);
+}
+
+// the run goes another way from here, what comes after is no more
+static void dbg_changed(device_t *device) {
+	if (!checkpoint_every) return;
+	dbg_checkpointsDrop(z180_get_cycles(device));
+	record_cut();
+}
+
+// restore the checkpoint at the next slice boundary
+static void dbg_rewindRestore(device_t *device) {
+	rewind_restore = 1;
+	z180_end_slice(device);
+}
+
+static int dbg_rewind(device_t *device, int what) {
+	uint64_t now = z180_get_cycles(device);
+	int n = numcheckpoints - 1;
+	while (n >= 0 && checkpoints[n].cycle >= now) n -= 1;
+	if (n < 0) {
+		tty_print("error: no checkpoint to go back to, see k\r\n");
+		return 0;
+	}
+	rewind_what = what;
+	rewind_ckpt = n;
+	rewind_now = rewind_limit = now;
+	rewind_found = rewind_level = 0;
+	rewind_fromcall = 0;
+	rewind_sp = cpu_get_state_z180(device, Z180_SP);
+	rewind_state = REWIND_SEARCH;
+	dbg_stepping = 0;
+	dbg_rewindRestore(device);
+	return 1;
+}
+
+static int dbg_isReturn(device_t *device, offs_t pc) {
+	UINT8 op = dbg_getmem(device, pc);
+	if (op == 0xc9 || (op & 0xc7) == 0xc0) return 1;
+	return op == 0xed && (dbg_getmem(device, pc + 1) & 0xf7) == 0x45;
+}
+
+// while going back: 1 if the op at pc is to run without stopping
+static int dbg_rewindHook(device_t *device, offs_t pc) {
+	uint64_t now = z180_get_cycles(device);
+	UINT16 sp;
+	int n;
+
+	if (rewind_restore) return 1;
+	if (rewind_state == REWIND_GOTO) {
+		if (now < rewind_target) return 1;
+		rewind_state = REWIND_OFF;
+		dbg_stepping = 1;
+		return 0;
+	}
+	if (now < rewind_limit) {
+		sp = cpu_get_state_z180(device, Z180_SP);
+		switch (rewind_what) {
+			case REWIND_STEP:
+				rewind_found = now;
+				break;
+			case REWIND_NEXT:
+				rewind_found = now;
+				rewind_fromcall = sp < rewind_sp && dbg_isReturn(device, pc);
+				// fall through
+			case REWIND_LEVEL:
+				if (sp >= rewind_sp) rewind_level = now;
+				break;
+			case REWIND_BREAK:
+				n = dbg_breakFind(dbg_physical(device, pc));
+				if (n >= 0 && !breakpoints[n].temp) rewind_found = now;
+				break;
+		}
+		return 1;
+	}
+	// through the stretch after the checkpoint
+	if (rewind_what == REWIND_NEXT && rewind_found && rewind_fromcall) {
+		// back from a call: to the call, which may be further back
+		if (rewind_level) rewind_found = rewind_level;
+		else {
+			rewind_what = REWIND_LEVEL;
+			rewind_found = 0;
+		}
+	} else if (rewind_what == REWIND_LEVEL)
+		rewind_found = rewind_level;
+	if (rewind_found) {
+		rewind_target = rewind_found;
+		rewind_state = REWIND_GOTO;
+	} else if (rewind_ckpt > 0) {
+		rewind_limit = checkpoints[rewind_ckpt].cycle;
+		rewind_ckpt -= 1;
+	} else {
+		tty_print("*not found in the checkpoints*\r\n");
+		rewind_ckpt = numcheckpoints - 1;
+		while (rewind_ckpt > 0 && checkpoints[rewind_ckpt].cycle >= rewind_now) rewind_ckpt -= 1;
+		rewind_target = rewind_now;
+		rewind_state = REWIND_GOTO;
+	}
+	dbg_rewindRestore(device);
+	return 1;
+}
+
+/* Watchpoints are on ranges of physical addresses. The cpu is told which
+ * 4K pages have one, and only accesses to those come to dbg_watchHit();
+ * without watchpoints it does not check memory accesses at all. */
+#define WATCH_READ	1
+#define WATCH_WRITE	2
+#define WATCH_CHANGE	4
+
+static UINT8 watchpages[0x100000 >> 12];
+static struct watchpoint {
+	offs_t start, end;	// physical
+	int access;
+} *watchpoints = NULL;
+static int numwatchpts = 0, maxwatchpts = 0;
+static offs_t watch_pc;		// of the op running
+static int watch_hit;		// reported for this op already
+
+static void dbg_watchHit(device_t *device, int access, offs_t addr, UINT8 old, UINT8 value, int dma) {
+	char by[24];
+	int n;
+	if (watch_hit || dbg_rewinding()) return;
+	for (n = 0; n < numwatchpts; n += 1) {
+		struct watchpoint *w = &watchpoints[n];
+		if (addr < w->start || w->end < addr) continue;
+		if (access == Z180_WATCH_READ ? !(w->access & WATCH_READ)
+		    : !(w->access & WATCH_WRITE) && !((w->access & WATCH_CHANGE) && old != value))
+			continue;
+		if (dma)
+			snprintf(by, sizeof(by), "by DMA%d", dma - 1);
+		else
+			snprintf(by, sizeof(by), "at $%04x", watch_pc);
+		if (access == Z180_WATCH_READ)
+			tty_printf("*watchpoint %d* $%05x read $%02x %s\r\n", n + 1, addr, value, by);
+		else
+			tty_printf("*watchpoint %d* $%05x written $%02x (was $%02x) %s\r\n", n + 1, addr, value, old, by);
+		watch_hit = 1;
+		dbg_stepping = 1;
+		return;
+	}
+}
+
+static void dbg_watchPages(device_t *device) {
+	int n;
+	offs_t page;
+	memset(watchpages, 0, sizeof(watchpages));
+	for (n = 0; n < numwatchpts; n += 1)
+		for (page = watchpoints[n].start >> 12; page <= watchpoints[n].end >> 12; page += 1)
+			watchpages[page] = 1;
+	z180_set_watch(device, numwatchpts ? watchpages : NULL, dbg_watchHit);
+}
+
+static int dbg_watch(device_t *device, offs_t start, offs_t end, int access) {
+	offs_t addr = dbg_physical(device, start);
+	if (end < start || addr + (end - start) > 0xfffff) {
+		tty_print("error: invalid range\r\n");
+		return 0;
+	}
+	if (numwatchpts == maxwatchpts) {
+		int max = maxwatchpts ? maxwatchpts * 2 : 8;
+		struct watchpoint *w = realloc(watchpoints, max * sizeof(*w));
+		if (w == NULL) {
+			tty_print("error: out of memory for watchpoints.\r\n");
+			return 0;
+		}
+		watchpoints = w;
+		maxwatchpts = max;
+	}
+	watchpoints[numwatchpts].start = addr;
+	watchpoints[numwatchpts].end = addr + (end - start);
+	watchpoints[numwatchpts].access = access;
+	numwatchpts += 1;
+	dbg_watchPages(device);
+	tty_printf("watchpoint %d set at $%05x-$%05x\r\n", numwatchpts, addr, addr + (end - start));
+	return 1;
+}
+
+static int dbg_watchDel(device_t *device, int n) {
+	if (n < 1 || n > numwatchpts) {
+		tty_print("error: no such watchpoint\r\n");
+		return 0;
+	}
+	memmove(&watchpoints[n - 1], &watchpoints[n], (numwatchpts - n) * sizeof(*watchpoints));
+	numwatchpts -= 1;
+	dbg_watchPages(device);
+	tty_print("watchpoint deleted.\r\n");
+	return 1;
+}
+
+static int dbg_watchEnum() {
+	int n;
+	tty_print("watchpoints:\r\n");
+	for (n = 0; n < numwatchpts; n += 1)
+		tty_printf("%d $%05x-$%05x %c%c%c\r\n", n + 1, watchpoints[n].start, watchpoints[n].end,
+		    watchpoints[n].access & WATCH_READ ? 'r' : ' ',
+		    watchpoints[n].access & WATCH_WRITE ? 'w' : ' ',
+		    watchpoints[n].access & WATCH_CHANGE ? 'c' : ' ');
+	return 1;
+}
+
+/* Watching I/O: port watchpoints stop after an IN or OUT on a range of
+ * ports, and a ring keeps the last accesses. Ranges below $100 match
+ * whatever is on the upper address lines. While neither is in use the cpu
+ * does not call out on I/O. */
+#define PORT_IN		1
+#define PORT_OUT	2
+
+static struct portwatch {
+	offs_t start, end;
+	int dir;
+} *portwatches = NULL;
+static int numportwatches = 0, maxportwatches = 0;
+
+static struct iolog {
+	uint64_t cycle;
+	UINT16 pc;
+	UINT16 port;
+	UINT8 value;
+	UINT8 out;
+} *iolog = NULL;
+static int iolog_size = 0, iolog_next = 0, iolog_count = 0;
+
+static void dbg_ioHit(device_t *device, int out, offs_t port, UINT8 value) {
+	int n;
+	if (iolog_size) {
+		struct iolog *l = &iolog[iolog_next];
+		l->cycle = z180_get_cycles(device);
+		l->pc = watch_pc;
+		l->port = port;
+		l->value = value;
+		l->out = out;
+		iolog_next = (iolog_next + 1) % iolog_size;
+		if (iolog_count < iolog_size) iolog_count += 1;
+	}
+	if (watch_hit || dbg_rewinding()) return;
+	for (n = 0; n < numportwatches; n += 1) {
+		struct portwatch *p = &portwatches[n];
+		offs_t match = p->end < 0x100 ? port & 0xff : port;
+		if (match < p->start || p->end < match || !(p->dir & (out ? PORT_OUT : PORT_IN))) continue;
+		tty_printf("*port watch %d* %s $%04x $%02x at $%04x\r\n", n + 1, out ? "OUT" : "IN", port, value, watch_pc);
+		watch_hit = 1;
+		dbg_stepping = 1;
+		return;
+	}
+}
+
+static void dbg_ioWatch(device_t *device) {
+	z180_set_io_watch(device, numportwatches || iolog_size ? dbg_ioHit : NULL);
+}
+
+// going back: what was logged from the checkpoint on is logged again
+static void dbg_ioLogDrop(uint64_t from) {
+	while (iolog_count && iolog[(iolog_next + iolog_size - 1) % iolog_size].cycle >= from) {
+		iolog_next = (iolog_next + iolog_size - 1) % iolog_size;
+		iolog_count -= 1;
+	}
+}
+
+static int dbg_ioLogSize(device_t *device, int size) {
+	struct iolog *l = NULL;
+	if (size && (l = calloc(size, sizeof(*l))) == NULL) {
+		tty_print("error: out of memory for the I/O log.\r\n");
+		return 0;
+	}
+	free(iolog);
+	iolog = l;
+	iolog_size = size;
+	iolog_next = iolog_count = 0;
+	dbg_ioWatch(device);
+	return 1;
+}
+
+static void dbg_ioLogEnum(int count) {
+	int n;
+	if (!iolog_size) {
+		tty_print("no I/O log, see I\r\n");
+		return;
+	}
+	if (count > iolog_count) count = iolog_count;
+	for (n = iolog_next + iolog_size - count; count; n += 1, count -= 1) {
+		struct iolog *l = &iolog[n % iolog_size];
+		tty_printf("%12llu $%04x %-3s $%04x $%02x\r\n", (unsigned long long)l->cycle, l->pc,
+		    l->out ? "OUT" : "IN", l->port, l->value);
+	}
+}
+
+static int dbg_portWatch(device_t *device, offs_t start, offs_t end, int dir) {
+	if (end < start) {
+		tty_print("error: invalid range\r\n");
+		return 0;
+	}
+	if (numportwatches == maxportwatches) {
+		int max = maxportwatches ? maxportwatches * 2 : 8;
+		struct portwatch *p = realloc(portwatches, max * sizeof(*p));
+		if (p == NULL) {
+			tty_print("error: out of memory for port watches.\r\n");
+			return 0;
+		}
+		portwatches = p;
+		maxportwatches = max;
+	}
+	portwatches[numportwatches].start = start;
+	portwatches[numportwatches].end = end;
+	portwatches[numportwatches].dir = dir;
+	numportwatches += 1;
+	dbg_ioWatch(device);
+	tty_printf("port watch %d set at $%04x-$%04x\r\n", numportwatches, start, end);
+	return 1;
+}
+
+static int dbg_portWatchDel(device_t *device, int n) {
+	if (n < 1 || n > numportwatches) {
+		tty_print("error: no such port watch\r\n");
+		return 0;
+	}
+	memmove(&portwatches[n - 1], &portwatches[n], (numportwatches - n) * sizeof(*portwatches));
+	numportwatches -= 1;
+	dbg_ioWatch(device);
+	tty_print("port watch deleted.\r\n");
+	return 1;
+}
+
+static int dbg_portWatchEnum() {
+	int n;
+	tty_print("port watches:\r\n");
+	for (n = 0; n < numportwatches; n += 1)
+		tty_printf("%d $%04x-$%04x %c%c\r\n", n + 1, portwatches[n].start, portwatches[n].end,
+		    portwatches[n].dir & PORT_IN ? 'i' : ' ',
+		    portwatches[n].dir & PORT_OUT ? 'o' : ' ');
+	return 1;
+}
+
+// the last count instructions from the history of the cpu, oldest first
+static void dbg_history(device_t *device, int count) {
+	struct z180_history h;
+	char ibuf[20], obuf[9];
+	offs_t i, len;
+	if (z180_history_get(device, 0, &h) == -1) {
+		tty_print("no history, see the -x option\r\n");
+		return;
+	}
+	while (count > 1 && z180_history_get(device, count - 1, &h) == -1) count -= 1;
+	while (count > 0) {
+		z180_history_get(device, --count, &h);
+		len = cpu_disassemble_z180(device, ibuf, h.pc, h.op, h.op, 0) & DASMFLAG_LENGTHMASK;
+		obuf[0] = 0;
+		for (i = 0; i < len && i < 4; i++) sprintf(obuf + 2 * i, "%02X", h.op[i]);
+		tty_printf("%12llu $%05x %04x: %-8s %-18s AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X\r\n",
+		    (unsigned long long)h.cycle, h.addr, h.pc, obuf, ibuf, h.af, h.bc, h.de, h.hl, h.sp);
+	}
+}
+
 static void dbg_list(device_t *device, offs_t start, offs_t end) {
 	if (end < start) return;
 	char ibuf[20];
@@ -318,6 +812,33 @@ static void dbg_help() {
 	tty_print("d [addr]        delete breakpoint at addr, defaults to current pc\r\n");
 	tty_print("D               delete all breakpoints\r\n");
 	tty_print("B               list breakpoints\r\n");
+	tty_print("                breakpoints are on the physical address addr is mapped to\r\n");
+	tty_print("w[rwc] start [end] watch memory from start to end (physical, as mapped now)\r\n");
+	tty_print("                for reads, writes or changes, defaults to writes\r\n");
+	tty_print("W [n]           list watchpoints, or delete watchpoint n\r\n");
+	tty_print("p[io] start [end] stop on IN or OUT on ports start to end, defaults to both.\r\n");
+	tty_print("                ports below $100 match any upper address byte\r\n");
+	tty_print("P [n]           list port watches, or delete port watch n\r\n");
+	tty_print("I n             keep a log of the last n I/O accesses, 0 drops it\r\n");
+	tty_print("i [n]           show the last n (default 16) logged I/O accesses\r\n");
+	tty_print("H [n]           show the last n (default 16) instructions run, with the\r\n");
+	tty_print("                registers before them\r\n");
+	tty_print("T [file[,from[,to]]] write the instructions run to file from now, or from\r\n");
+	tty_print("                cycle from to to (1000i: instruction 1000). Without file stop.\r\n");
+	tty_print("F [0]           profile the code run from now on, 0 stops the profile\r\n");
+	tty_print("f [n]           show the n (default 16) hottest addresses and loops so far\r\n");
+	tty_print("G [0]           follow the calls from now on, 0 stops following them\r\n");
+	tty_print("g [n]           show the n (default 16) functions with the most cycles in them\r\n");
+	tty_print("                and their callees\r\n");
+	tty_print("C [0]           time the BDOS and BIOS calls from now on, 0 stops it\r\n");
+	tty_print("c               show the BDOS and BIOS calls timed so far\r\n");
+	tty_print("O [0|file]      note the code run and its branches from now on, 0 stops it,\r\n");
+	tty_print("                file writes what was noted so far there (see covlist)\r\n");
+	tty_print("o               show how much code and how many branches were covered\r\n");
+	tty_print("A [0|file]      count the memory accesses per 4K page, the remaps and the DMA\r\n");
+	tty_print("                from now on, 0 stops it, file writes the counts there as CSV\r\n");
+	tty_print("a [n]           show the accesses per page, the n (default 16) hottest pages\r\n");
+	tty_print("                and the n pcs remapping most\r\n");
 	tty_print("l [start [end]] list (disassemble) memory. Start defaults to end+1 of the\r\n");
 	tty_print("                last list call, or to pc if that is unset. End defaults to\r\n");
 	tty_print("                start + (end-start) of the last list call, or to start + 16\r\n");
@@ -326,7 +847,18 @@ static void dbg_help() {
 	tty_print("                examine call, or to pc if that is unset.End defaults to\r\n");
 	tty_print("                start + (end-start) of the last examine call, or to start + 16\r\n");
 	tty_print("                if that is unset.\r\n");
-	tty_print("ENTER           repeast last r, s, n, l or x command. For r, l and x all\r\n");
+	tty_print("m [unit [file]] eject the medium in unit and insert file if given. Without\r\n");
+	tty_print("                arguments list the units and what is in them.\r\n");
+	tty_print("S file          save the state of the machine to file\r\n");
+	tty_print("L file          restore the state of the machine from file\r\n");
+	tty_print("k [n]           keep a checkpoint every n million cycles, for going back\r\n");
+	tty_print("                with u, N and U. 0 drops them, without n show them.\r\n");
+	tty_print("                Disk I/O is not done in the background while checkpoints\r\n");
+	tty_print("                are kept.\r\n");
+	tty_print("u               go back one op\r\n");
+	tty_print("N               go back one op, stepping back over call or rst\r\n");
+	tty_print("U               go back to the last breakpoint passed\r\n");
+	tty_print("ENTER           repeast last r, s, n, u, N, U, l or x command. For r, l and x all\r\n");
 	tty_print("                arguments are removed, so that they use their defaults.\r\n");
 	//tty_print("\r\n");
 	//tty_print("\r\n");
@@ -384,7 +916,7 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 		if (!line || line[0] == 'q') {
 			// quit debugger/emulator
 			if (line && !dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
-			numbreakpts = 0;
+			dbg_breakClear();
 			dbg_quit = 1;
 			dbg_stepping = 0;
 			*pbuf = 0;
@@ -408,6 +940,7 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
 			if (pc >= 0) {
 				cpu_set_pc_z180(device, pc);
+				dbg_changed(device);
 			}
 			dbg_stepping = 0;
 			memcpy(pbuf, lbuf, CMDBUFLEN);
@@ -416,6 +949,7 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 			// reset
 			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
 			cpu_reset_z180(device);
+			dbg_changed(device);
 			curpc = 0;
 			dbg_print_status(device, curpc);
 			*pbuf = 0;
@@ -432,24 +966,43 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 			dbg_next(device, curpc);
 			memcpy(pbuf, lbuf, CMDBUFLEN);
 			return;
+		} else if (line[0] == 'u' || line[0] == 'N' || line[0] == 'U') {
+			// u, N, U go back one op, over call or rst, to the last breakpoint
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!dbg_rewind(device, line[0] == 'u' ? REWIND_STEP : line[0] == 'N' ? REWIND_NEXT : REWIND_BREAK)) continue;
+			memcpy(pbuf, lbuf, CMDBUFLEN);
+			return;
+		} else if (line[0] == 'k') {
+			// k [n] keep checkpoints every n million cycles
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n == 0) {
+				while (numcheckpoints) snapshot_close(checkpoints[--numcheckpoints].s);
+				// nothing is run again now, disk I/O may go in the background again
+				hostio_restart();
+			}
+			if (n >= 0) checkpoint_every = n * 1000000ULL;
+			dbg_checkpointsEnum();
+			*pbuf = 0;
+			continue;
 		} else if (line[0] == 'b') {
 			// b [a] set breakpoint
 			int pc = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
 			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
-			dbg_break(pc < 0 ? curpc : pc, 0);
+			dbg_break(device, pc < 0 ? curpc : pc, 0);
 			*pbuf = 0;
 			continue;
 		} else if (line[0] == 'd') {
 			// d [a] delete breakpoint or all breakpoints
 			int pc = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
 			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
-			dbg_breakDel(pc < 0 ? curpc : pc);
+			dbg_breakDel(device, pc < 0 ? curpc : pc);
 			*pbuf = 0;
 			continue;
 		} else if (line[0] == 'D') {
 			// D delete all breakpoints
 			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
-			numbreakpts = 0;
+			dbg_breakClear();
 			*pbuf = 0;
 			continue;
 		} else if (line[0] == 'B') {
@@ -458,6 +1011,208 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 			dbg_breakEnum();
 			*pbuf = 0;
 			continue;
+		} else if (line[0] == 'w') {
+			// w[rwc] a [a] set watchpoint
+			int access = 0;
+			for (; strchr("rwc", lbuf[ptr]) && lbuf[ptr]; ptr += 1)
+				access |= lbuf[ptr] == 'r' ? WATCH_READ : lbuf[ptr] == 'w' ? WATCH_WRITE : WATCH_CHANGE;
+			dbg_skipSpace(lbuf, CMDBUFLEN, &ptr);
+			int start = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 0);
+			dbg_skipSpace(lbuf, CMDBUFLEN, &ptr);
+			int end = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (start < 0 || !dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			dbg_watch(device, start, end < 0 ? start : end, access ? access : WATCH_WRITE);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'W') {
+			// W [n] list watchpoints or delete watchpoint
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n < 0)
+				dbg_watchEnum();
+			else
+				dbg_watchDel(device, n);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'p') {
+			// p[io] a [a] set port watch
+			int dir = 0;
+			for (; strchr("io", lbuf[ptr]) && lbuf[ptr]; ptr += 1)
+				dir |= lbuf[ptr] == 'i' ? PORT_IN : PORT_OUT;
+			dbg_skipSpace(lbuf, CMDBUFLEN, &ptr);
+			int start = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 0);
+			dbg_skipSpace(lbuf, CMDBUFLEN, &ptr);
+			int end = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (start < 0 || !dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			dbg_portWatch(device, start, end < 0 ? start : end, dir ? dir : PORT_IN | PORT_OUT);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'P') {
+			// P [n] list port watches or delete port watch
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n < 0)
+				dbg_portWatchEnum();
+			else
+				dbg_portWatchDel(device, n);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'I') {
+			// I n size of the I/O log
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 0);
+			if (n < 0 || !dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			dbg_ioLogSize(device, n);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'i') {
+			// i [n] show the I/O log
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			dbg_ioLogEnum(n < 0 ? 16 : n);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'H') {
+			// H [n] show the execution history
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			dbg_history(device, n < 0 ? 16 : n);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'F') {
+			// F [0] start or stop the profile
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n == 0)
+				profile_close();
+			else if (profile_active())
+				profile_clear();
+			else if (profile_open(device, NULL) == -1)
+				tty_print("error: could not profile\r\n");
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'f') {
+			// f [n] show the profile
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!profile_active())
+				tty_print("no profile, start one with F\r\n");
+			else {
+				profile_report(stdout, n < 0 ? 16 : n, "\r\n");
+				fflush(stdout);
+			}
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'G') {
+			// G [0] start or stop following the calls
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n == 0)
+				callgraph_close();
+			else if (callgraph_active())
+				callgraph_clear();
+			else if (callgraph_open(device, NULL) == -1)
+				tty_print("error: could not follow the calls\r\n");
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'g') {
+			// g [n] show the functions by cycles
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!callgraph_active())
+				tty_print("no calls followed, start with G\r\n");
+			else {
+				callgraph_report(stdout, n < 0 ? 16 : n, "\r\n");
+				fflush(stdout);
+			}
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'C') {
+			// C [0] start or stop timing the CP/M calls
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (n == 0)
+				cpm_close();
+			else if (cpm_active())
+				cpm_clear();
+			else if (cpm_open(device, NULL) == -1)
+				tty_print("error: could not time the CP/M calls\r\n");
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'c') {
+			// c show the CP/M calls
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!cpm_active())
+				tty_print("no CP/M calls timed, start with C\r\n");
+			else {
+				cpm_report(stdout, "\r\n");
+				fflush(stdout);
+			}
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'O') {
+			// O [0|file] start, stop or write the coverage
+			char file[CMDBUFLEN];
+			if (sscanf(line + 1, " %255s", file) != 1) {
+				if (coverage_active())
+					coverage_clear();
+				else if (coverage_open(device, "", NULL) == -1)
+					tty_print("error: could not note the coverage\r\n");
+			} else if (!strcmp(file, "0"))
+				coverage_close();
+			else if (!coverage_active())
+				tty_print("no coverage, start with O\r\n");
+			else if (coverage_write(file) == -1)
+				tty_printf("error: could not write the coverage to %s\r\n", file);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'o') {
+			// o show the coverage
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!coverage_active())
+				tty_print("no coverage, start with O\r\n");
+			else {
+				coverage_report(stdout, "\r\n");
+				fflush(stdout);
+			}
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'A') {
+			// A [0|file] start, stop or write the memory statistics
+			char file[CMDBUFLEN];
+			if (sscanf(line + 1, " %255s", file) != 1) {
+				if (memstats_active())
+					memstats_clear();
+				else if (memstats_open(device, NULL) == -1)
+					tty_print("error: could not count the memory accesses\r\n");
+			} else if (!strcmp(file, "0"))
+				memstats_close();
+			else if (!memstats_active())
+				tty_print("no memory accesses counted, start with A\r\n");
+			else if (memstats_write(file) == -1)
+				tty_printf("error: could not write the memory accesses to %s\r\n", file);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'a') {
+			// a [n] show the memory statistics
+			int n = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
+			if (!dbg_ensureEoln(lbuf, CMDBUFLEN, &ptr)) continue;
+			if (!memstats_active())
+				tty_print("no memory accesses counted, start with A\r\n");
+			else {
+				memstats_report(stdout, n < 0 ? 16 : n, "\r\n");
+				fflush(stdout);
+			}
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'T') {
+			// T [file[,from[,to]]] start or stop a trace
+			char spec[CMDBUFLEN];
+			if (sscanf(line + 1, " %255s", spec) != 1)
+				trace_close();
+			else if (trace_option(spec, "", device) == -1)
+				tty_printf("error: could not trace to %s\r\n", spec);
+			*pbuf = 0;
+			continue;
 		} else if (line[0] == 'l') {
 			// l [a [a]] list (disassemble)
 			int start = dbg_parseNum(lbuf, CMDBUFLEN, &ptr, 1);
@@ -486,6 +1241,27 @@ static void dbg_cli(device_t *device, offs_t curpc) {
 			dbg_examine(device, start, end);
 			memcpy(pbuf, lbuf, CMDBUFLEN);
 			continue;
+		} else if (line[0] == 'm') {
+			// m [unit [file]] change media
+			if (media_command(line + 1) != 0)
+				dbg_changed(device);
+			*pbuf = 0;
+			continue;
+		} else if (line[0] == 'S' || line[0] == 'L') {
+			// S file, L file save or restore the machine state
+			char file[CMDBUFLEN];
+			if (sscanf(line + 1, " %255s", file) != 1) {
+				tty_print("error: file name expected\r\n");
+				continue;
+			}
+			if (line[0] == 'S' && machine_save(file) == -1)
+				tty_printf("error: could not save to %s\r\n", file);
+			else if (line[0] == 'L' && machine_load(file) == -1)
+				tty_printf("error: could not restore %s\r\n", file);
+			else if (line[0] == 'L')
+				dbg_changed(device);
+			*pbuf = 0;
+			continue;
 		} else if (line[0] == 0) {
 			// ENTER key repeat command
 			if (*pbuf == 0) continue;
@@ -503,12 +1279,19 @@ static int first_entry = 1;
 
 void dbg_instruction_hook(device_t *device, offs_t curpc) {
 	do_timers();
+	// a swap replayed where the debugger had stopped to make it
+	if (z180_get_cycles(device) >= record_media_due) record_media_poll();
+
+	dbg_cpu = device;
+	watch_pc = curpc;
+	watch_hit = 0;
+	if (rewind_state != REWIND_OFF && dbg_rewindHook(device, curpc)) return;
 
 	int key = tty_checkKey();
 	if (key == K_ESCAPE) {
 		tty_print("*escape*\r\n");
 		dbg_stepping = 1;
-	} else if (dbg_isBreak(curpc)) {
+	} else if (numbreakpts && dbg_isBreak(device, curpc)) {
 		tty_print("*breakpoint*\r\n");
 		dbg_stepping = 1;
 	} else if (key == K_CTRLC) {
@@ -25,6 +25,8 @@
 extern int dbg_init(int stepping, UINT8 *ram, UINT8 *rom);
 extern int dbg_running();
 extern void dbg_log(const char *fmt, ...);
+/* 1 while the debugger runs the machine again to go back */
+extern int dbg_rewinding();
 
 #ifdef DBG_MAIN
 extern void dbg_instruction_hook(device_t *device, offs_t curpc);
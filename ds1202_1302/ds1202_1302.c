@@ -32,12 +32,17 @@
 //#include "lib.h"
 //#include "monitor.h"
 #include "rtc.h"
-//#include "snapshot.h"
+#include "../snapshot/snapshot.h"
 
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #define lib_malloc malloc
 #define lib_calloc calloc
 #define lib_free free
@@ -136,6 +141,18 @@ char *lib_stralloc(const char *str)
 #define DS1202_1302_RAM_SIZE   32
 #define DS1202_1302_REG_SIZE   8
 
+/* Layout of the NVRAM file. It is mapped, and ram and clock_regs of the
+   context point into it, so what the guest writes is in the page cache
+   at once and survives the emulator being killed. */
+#define DS1202_1302_NVRAM_MAGIC "DS1302NV"
+
+typedef struct ds1202_1302_nvram_s {
+    char magic[8];
+    int64_t offset;
+    uint8_t clock_regs[DS1202_1302_REG_SIZE];
+    uint8_t ram[DS1202_1302_RAM_SIZE];
+} ds1202_1302_nvram_t;
+
 struct rtc_ds1202_1302_s {
     int rtc_type;
     int clock_halt;
@@ -158,6 +175,8 @@ struct rtc_ds1202_1302_s {
     uint8_t sclk_line;
     uint8_t clock_register;
     char *device;
+    ds1202_1302_nvram_t *nvram;
+    int nvram_dirty;
 };
 
 #define DS1202_1302_REG_SECONDS_CH       0
@@ -212,8 +231,121 @@ rtc_ds1202_1302_t *ds1202_1302_init(char *device, int rtc_type)
     return retval;
 }
 
+/* Map the NVRAM from file. If template is given the instance starts from
+   that file instead, mapped copy on write, and its changes are dropped at
+   exit; a template that cannot be mapped is an error, NULL. A missing file is created from the old text NVRAM file if that
+   has the device, so a machine keeps its settings. */
+rtc_ds1202_1302_t *ds1202_1302_init_mapped(char *device, int rtc_type, const char *file, const char *template)
+{
+    rtc_ds1202_1302_t *retval;
+    ds1202_1302_nvram_t *nvram;
+    struct stat st;
+    int fd, fresh = 0;
+
+    if (template) {
+        if ((fd = open(template, O_RDONLY)) == -1) {
+            return NULL;
+        }
+        if (fstat(fd, &st) == -1 || st.st_size != sizeof(*nvram)) {
+            close(fd);
+            errno = EINVAL;
+            return NULL;
+        }
+        nvram = mmap(NULL, sizeof(*nvram), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    } else {
+        if ((fd = open(file, O_RDWR | O_CREAT, 0644)) == -1) {
+            return ds1202_1302_init(device, rtc_type);
+        }
+        if (fstat(fd, &st) == -1 || st.st_size != sizeof(*nvram)) {
+            fresh = 1;
+            if (ftruncate(fd, sizeof(*nvram)) == -1) {
+                close(fd);
+                return ds1202_1302_init(device, rtc_type);
+            }
+        }
+        nvram = mmap(NULL, sizeof(*nvram), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (nvram == MAP_FAILED) {
+        return template ? NULL : ds1202_1302_init(device, rtc_type);
+    }
+
+    if (fresh || memcmp(nvram->magic, DS1202_1302_NVRAM_MAGIC, sizeof(nvram->magic))) {
+        if (rtc_load_context(device, DS1202_1302_RAM_SIZE, DS1202_1302_REG_SIZE)) {
+            memcpy(nvram->ram, rtc_get_loaded_ram(), DS1202_1302_RAM_SIZE);
+            memcpy(nvram->clock_regs, rtc_get_loaded_clockregs(), DS1202_1302_REG_SIZE);
+            nvram->offset = rtc_get_loaded_offset();
+            lib_free(rtc_get_loaded_ram());
+            lib_free(rtc_get_loaded_clockregs());
+        } else {
+            memset(nvram->ram, 0x55, DS1202_1302_RAM_SIZE);	// "random" bits
+            memset(nvram->clock_regs, 0, DS1202_1302_REG_SIZE);
+            nvram->offset = 0;
+        }
+        memcpy(nvram->magic, DS1202_1302_NVRAM_MAGIC, sizeof(nvram->magic));
+        if (!template) {
+            msync(nvram, sizeof(*nvram), MS_ASYNC);
+        }
+    }
+
+    retval = lib_calloc(1, sizeof(rtc_ds1202_1302_t));
+    retval->nvram = nvram;
+    retval->ram = nvram->ram;
+    retval->clock_regs = nvram->clock_regs;
+    retval->offset = (time_t)nvram->offset;
+    retval->old_offset = retval->offset;
+    retval->rtc_type = rtc_type;
+    retval->device = lib_stralloc(device);
+
+    return retval;
+}
+
+/* after a write: note a new offset, the rest is written in place */
+static void ds1202_1302_nvram_changed(rtc_ds1202_1302_t *context)
+{
+    if (context->nvram) {
+        context->nvram->offset = context->offset;
+        context->nvram_dirty = 1;
+    }
+}
+
+/* write behind at the end of a transfer */
+static void ds1202_1302_nvram_flush(rtc_ds1202_1302_t *context)
+{
+    if (context->nvram_dirty) {
+        msync(context->nvram, sizeof(*context->nvram), MS_ASYNC);
+        context->nvram_dirty = 0;
+    }
+}
+
+/* From now on keep the NVRAM to this process, for a forked copy of the
+   machine. It stays where it is, as ram and clock_regs point into it. */
+void ds1202_1302_private(rtc_ds1202_1302_t *context)
+{
+    ds1202_1302_nvram_t copy;
+
+    if (!context->nvram) {
+        return;
+    }
+    copy = *context->nvram;
+    if (mmap(context->nvram, sizeof(copy), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        return;
+    }
+    *context->nvram = copy;
+    context->nvram_dirty = 0;
+}
+
 void ds1202_1302_destroy(rtc_ds1202_1302_t *context, int save)
 {
+    if (context->nvram) {
+        /* in the file already, unless it is a template copy */
+        msync(context->nvram, sizeof(*context->nvram), MS_SYNC);
+        munmap(context->nvram, sizeof(*context->nvram));
+        lib_free(context->device);
+        lib_free(context);
+        return;
+    }
     if (save) {
         if (memcmp(context->ram, context->old_ram, DS1202_1302_RAM_SIZE) ||
             memcmp(context->clock_regs, context->old_clock_regs, DS1202_1302_REG_SIZE) ||
@@ -492,6 +624,7 @@ static void ds1202_1302_write_burst_data_bit(rtc_ds1202_1302_t *context, unsigne
         }
         context->io_byte = 0;
         context->bit = 0;
+        ds1202_1302_nvram_changed(context);
     }
 }
 
@@ -601,6 +734,7 @@ static void ds1202_1302_write_single_data_bit(rtc_ds1202_1302_t *context, unsign
         context->state = DS1202_1302_INPUT_COMMAND_BITS;
         context->bit = 0;
         context->io_byte = 0;
+        ds1202_1302_nvram_changed(context);
     }
 }
 
@@ -612,6 +746,7 @@ void ds1202_1302_set_lines(rtc_ds1202_1302_t *context, unsigned int ce_line, uns
 
     /* is the Chip Enable line low ? */
     if (!ce_line) {
+        ds1202_1302_nvram_flush(context);
         ds1202_1302_reset(context);
         context->sclk_line = sclk_line;
         return;
@@ -705,183 +840,38 @@ int ds1202_1302_dump(rtc_ds1202_1302_t *context)
 /* ---------------------------------------------------------------------*/
 /*    snapshot support functions                                             */
 
-/* RTC_DS1202_1302 snapshot module format:
-
-   type   | name                | description
-   ------------------------------------------
-   BYTE   | rtc type            | RTC type
-   BYTE   | clock halt          | clock halt flag
-   DWORD  | clock halt latch hi | high DWORD of clock halt offset
-   DWORD  | clock halt latch lo | low DWORD of clock halt offset
-   BYTE   | am pm               | AM/PM flag
-   BYTE   | write protect       | write protect flag
-   DWORD  | latch hi            | high DWORD of latch offset
-   DWORD  | latch lo            | low DWORD of latch offset
-   DWORD  | offset hi           | high DWORD of RTC offset
-   DWORD  | offset lo           | low DWORD of RTC offset
-   DWORD  | old offset hi       | high DWORD of old RTC offset
-   DWORD  | old offset lo       | low DWORD of old RTC offset
-   ARRAY  | clock regs          | 8 BYTES of register data
-   ARRAY  | old clock regs      | 8 BYTES of old register data
-   BYTE   | trickle charge      | trickle charge
-   ARRAY  | RAM                 | 32 BYTES of RAM data
-   ARRAY  | old RAM             | 32 BYTES of old RAM data
-   BYTE   | state               | current RTC read/write state
-   BYTE   | reg                 | current register
-   BYTE   | bit                 | current bit
-   BYTE   | output bit          | current output bit
-   BYTE   | io byte             | current I/O BYTE
-   BYTE   | sclk                | SCLK line state
-   BYTE   | clock register      | clock register flag
-   STRING | device              | device name STRING
- */
+/* The context is saved as it is in memory, its RAM and clock registers
+   as parts of their own since the context only points to them. */
 
-//static char snap_module_name[] = "RTC_DS1202_1302";
-#define SNAP_MAJOR 0
-#define SNAP_MINOR 0
-
-/*int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
+int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
 {
-    uint32_t clock_halt_latch_hi = 0;
-    uint32_t clock_halt_latch_lo = 0;
-    uint32_t latch_lo = 0;
-    uint32_t latch_hi = 0;
-    uint32_t offset_lo = 0;
-    uint32_t offset_hi = 0;
-    uint32_t old_offset_lo = 0;
-    uint32_t old_offset_hi = 0;
-    snapshot_module_t *m;
-
-    / time_t can be either 32bit or 64bit, so we save as 64bit /
-#if (SIZE_OF_TIME_T == 8)
-    clock_halt_latch_hi = (uint32_t)(context->clock_halt_latch >> 32);
-    clock_halt_latch_lo = (uint32_t)(context->clock_halt_latch & 0xffffffff);
-    latch_hi = (uint32_t)(context->latch >> 32);
-    latch_lo = (uint32_t)(context->latch & 0xffffffff);
-    offset_hi = (uint32_t)(context->offset >> 32);
-    offset_lo = (uint32_t)(context->offset & 0xffffffff);
-    old_offset_hi = (uint32_t)(context->old_offset >> 32);
-    old_offset_lo = (uint32_t)(context->old_offset & 0xffffffff);
-#else
-    clock_halt_latch_lo = (uint32_t)context->clock_halt_latch;
-    latch_lo = (uint32_t)context->latch;
-    offset_lo = (uint32_t)context->offset;
-    old_offset_lo = (uint32_t)context->old_offset;
-#endif
-
-    m = snapshot_module_create(s, snap_module_name, SNAP_MAJOR, SNAP_MINOR);
-
-    if (m == NULL) {
-        return -1;
-    }
-
-    if (0
-        || SMW_B(m, (uint8_t)context->rtc_type) < 0
-        || SMW_B(m, (uint8_t)context->clock_halt) < 0
-        || SMW_DW(m, clock_halt_latch_hi) < 0
-        || SMW_DW(m, clock_halt_latch_lo) < 0
-        || SMW_B(m, (uint8_t)context->am_pm) < 0
-        || SMW_B(m, (uint8_t)context->write_protect) < 0
-        || SMW_DW(m, latch_hi) < 0
-        || SMW_DW(m, latch_lo) < 0
-        || SMW_DW(m, offset_hi) < 0
-        || SMW_DW(m, offset_lo) < 0
-        || SMW_DW(m, old_offset_hi) < 0
-        || SMW_DW(m, old_offset_lo) < 0
-        || SMW_BA(m, context->clock_regs, DS1202_1302_REG_SIZE) < 0
-        || SMW_BA(m, context->old_clock_regs, DS1202_1302_REG_SIZE) < 0
-        || SMW_B(m, context->trickle_charge) < 0
-        || SMW_BA(m, context->ram, DS1202_1302_RAM_SIZE) < 0
-        || SMW_BA(m, context->old_ram, DS1202_1302_RAM_SIZE) < 0
-        || SMW_B(m, context->state) < 0
-        || SMW_B(m, context->reg) < 0
-        || SMW_B(m, context->bit) < 0
-        || SMW_B(m, context->output_bit) < 0
-        || SMW_B(m, context->io_byte) < 0
-        || SMW_B(m, context->sclk_line) < 0
-        || SMW_B(m, context->clock_register) < 0
-        || SMW_STR(m, context->device) < 0) {
-        snapshot_module_close(m);
-        return -1;
-    }
-    return snapshot_module_close(m);
+    snapshot_put(s, "ds1302", context, sizeof(*context));
+    snapshot_put(s, "ds1302ram", context->ram, DS1202_1302_RAM_SIZE);
+    snapshot_put(s, "ds1302regs", context->clock_regs, DS1202_1302_REG_SIZE);
+    rtc_time_snapshot_save(s);
+    return 0;
 }
 
 int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
 {
-    uint32_t clock_halt_latch_hi = 0;
-    uint32_t clock_halt_latch_lo = 0;
-    uint32_t latch_lo = 0;
-    uint32_t latch_hi = 0;
-    uint32_t offset_lo = 0;
-    uint32_t offset_hi = 0;
-    uint32_t old_offset_lo = 0;
-    uint32_t old_offset_hi = 0;
-    uint8_t vmajor, vminor;
-    snapshot_module_t *m;
-
-    m = snapshot_module_open(s, snap_module_name, &vmajor, &vminor);
-
-    if (m == NULL) {
+    rtc_ds1202_1302_t live = *context;
+
+    if (snapshot_get(s, "ds1302", context, sizeof(*context)) < 0) {
         return -1;
     }
-
-    / Do not accept versions higher than current /
-    if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
-        snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
-        goto fail;
-    }
-
-    if (0
-        || SMR_B_INT(m, &context->rtc_type) < 0
-        || SMR_B_INT(m, &context->clock_halt) < 0
-        || SMR_DW(m, &clock_halt_latch_hi) < 0
-        || SMR_DW(m, &clock_halt_latch_lo) < 0
-        || SMR_B_INT(m, &context->am_pm) < 0
-        || SMR_B_INT(m, &context->write_protect) < 0
-        || SMR_DW(m, &latch_hi) < 0
-        || SMR_DW(m, &latch_lo) < 0
-        || SMR_DW(m, &offset_hi) < 0
-        || SMR_DW(m, &offset_lo) < 0
-        || SMR_DW(m, &old_offset_hi) < 0
-        || SMR_DW(m, &old_offset_lo) < 0
-        || SMR_BA(m, context->clock_regs, DS1202_1302_REG_SIZE) < 0
-        || SMR_BA(m, context->old_clock_regs, DS1202_1302_REG_SIZE) < 0
-        || SMR_B(m, &context->trickle_charge) < 0
-        || SMR_BA(m, context->ram, DS1202_1302_RAM_SIZE) < 0
-        || SMR_BA(m, context->old_ram, DS1202_1302_RAM_SIZE) < 0
-        || SMR_B(m, &context->state) < 0
-        || SMR_B(m, &context->reg) < 0
-        || SMR_B(m, &context->bit) < 0
-        || SMR_B(m, &context->output_bit) < 0
-        || SMR_B(m, &context->io_byte) < 0
-        || SMR_B(m, &context->sclk_line) < 0
-        || SMR_B(m, &context->clock_register) < 0
-        || SMR_STR(m, &context->device) < 0) {
-        goto fail;
-    }
-
-    snapshot_module_close(m);
-
-#if (SIZE_OF_TIME_T == 8)
-    context->clock_halt_latch = (time_t)(clock_halt_latch_hi) << 32;
-    context->clock_halt_latch |= clock_halt_latch_lo;
-    context->latch = (time_t)(latch_hi) << 32;
-    context->latch |= latch_lo;
-    context->offset = (time_t)(offset_hi) << 32;
-    context->offset |= offset_lo;
-    context->old_offset = (time_t)(old_offset_hi) << 32;
-    context->old_offset |= old_offset_lo;
-#else
-    context->clock_halt_latch = clock_halt_latch_lo;
-    context->latch = latch_lo;
-    context->offset = offset_lo;
-    context->old_offset = old_offset_lo;
-#endif
-
+    context->clock_regs = live.clock_regs;
+    context->ram = live.ram;
+    context->device = live.device;
+    context->nvram = live.nvram;
+    context->nvram_dirty = live.nvram_dirty;
+
+    if (snapshot_get(s, "ds1302ram", context->ram, DS1202_1302_RAM_SIZE) < 0
+        || snapshot_get(s, "ds1302regs", context->clock_regs, DS1202_1302_REG_SIZE) < 0
+        || rtc_time_snapshot_load(s) < 0) {
+        return -1;
+    }
+    /* the NVRAM now holds what the snapshot had */
+    ds1202_1302_nvram_changed(context);
+    ds1202_1302_nvram_flush(context);
     return 0;
-
-fail:
-    snapshot_module_close(m);
-    return -1;
-}*/
+}
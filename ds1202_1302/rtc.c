@@ -48,6 +48,7 @@
 //#include "lib.h"
 //#include "machine.h"
 #include "rtc.h"
+#include "../record/record.h"
 //#include "util.h"
 
 inline static int int_to_bcd(int dec)
@@ -62,9 +63,100 @@ inline static int bcd_to_int(int bcd)
 
 /* ---------------------------------------------------------------------- */
 
+/* The guest reads the clock bit by bit, so the DS1302 asks for the time
+   several times per clock read. Rather than asking the host each time,
+   the time can come from a copy refreshed once per emulation slice, or
+   from the emulated cycles, which makes runs repeatable. */
+
+static int time_source = RTC_TIME_HOST;
+static time_t time_now = 0;
+static time_t time_epoch = 0;
+static long time_clock = 1;
+static uint64_t time_cycles = 0;
+
+void rtc_set_time_source(int source, time_t epoch, long clock)
+{
+    time_source = source;
+    time_epoch = epoch;
+    time_clock = clock > 0 ? clock : 1;
+    time_cycles = 0;
+    time_now = (source == RTC_TIME_VIRTUAL) ? epoch : time(NULL);
+}
+
+/* called by the board after every slice with the cycles it ran */
+void rtc_time_tick(long cycles)
+{
+    switch (time_source) {
+        case RTC_TIME_CACHED:
+            time_now = time(NULL);
+            break;
+        case RTC_TIME_VIRTUAL:
+            time_cycles += cycles;
+            time_now = time_epoch + (time_t)(time_cycles / time_clock);
+            break;
+    }
+}
+
+/* what the guest gets goes through the recorder, see record/record.c */
+time_t rtc_time(void)
+{
+    return record_time((time_source == RTC_TIME_HOST) ? time(NULL) : time_now);
+}
+
+struct rtc_time_snapshot {
+    int64_t epoch;
+    uint64_t cycles;
+};
+
+void rtc_time_snapshot_save(snapshot_t *s)
+{
+    struct rtc_time_snapshot snap;
+
+    memset(&snap, 0, sizeof(snap));
+    snap.epoch = time_epoch;
+    snap.cycles = time_cycles;
+    snapshot_put(s, "rtctime", &snap, sizeof(snap));
+}
+
+int rtc_time_snapshot_load(snapshot_t *s)
+{
+    struct rtc_time_snapshot snap;
+
+    if (snapshot_get(s, "rtctime", &snap, sizeof(snap)) < 0) {
+        return -1;
+    }
+    if (time_source == RTC_TIME_VIRTUAL) {
+        time_epoch = (time_t)snap.epoch;
+        time_cycles = snap.cycles;
+        rtc_time_tick(0);
+    }
+    return 0;
+}
+
+/* localtime() of the last time asked for, the getters below all want the
+   same second while a clock burst is read */
+static const struct tm *rtc_localtime(time_t time_val)
+{
+    static time_t last = -1;
+    static struct tm local;
+
+    if (time_val != last) {
+        local = *localtime(&time_val);
+        last = time_val;
+    }
+    return &local;
+}
+
+/* ---------------------------------------------------------------------- */
+
 /* get 1/100 seconds from clock */
 uint8_t rtc_get_centisecond(int bcd)
 {
+    if (time_source == RTC_TIME_VIRTUAL) {
+        int centi = (int)((time_cycles % time_clock) * 100 / time_clock);
+
+        return (uint8_t)((bcd) ? int_to_bcd(centi) : centi);
+    }
 #ifdef HAVE_GETTIMEOFDAY
     struct timeval t;
 
@@ -79,8 +171,7 @@ uint8_t rtc_get_centisecond(int bcd)
    0 - 61 (leap seconds would be 60 and 61) */
 uint8_t rtc_get_second(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_sec) : local->tm_sec);
 }
@@ -89,8 +180,7 @@ uint8_t rtc_get_second(time_t time_val, int bcd)
    0 - 59 */
 uint8_t rtc_get_minute(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_min) : local->tm_min);
 }
@@ -99,8 +189,7 @@ uint8_t rtc_get_minute(time_t time_val, int bcd)
    0 - 23 */
 uint8_t rtc_get_hour(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_hour) : local->tm_hour);
 }
@@ -111,8 +200,7 @@ uint8_t rtc_get_hour_am_pm(time_t time_val, int bcd)
 {
     uint8_t hour;
     int pm = 0;
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     hour = local->tm_hour;
 
@@ -133,8 +221,7 @@ uint8_t rtc_get_hour_am_pm(time_t time_val, int bcd)
    1 - 31 */
 uint8_t rtc_get_day_of_month(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_mday) : local->tm_mday);
 }
@@ -143,8 +230,7 @@ uint8_t rtc_get_day_of_month(time_t time_val, int bcd)
    1 - 12 */
 uint8_t rtc_get_month(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_mon + 1) : (local->tm_mon + 1));
 }
@@ -153,8 +239,7 @@ uint8_t rtc_get_month(time_t time_val, int bcd)
    0 - 99 */
 uint8_t rtc_get_year(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd(local->tm_year % 100) : local->tm_year % 100);
 }
@@ -163,8 +248,7 @@ uint8_t rtc_get_year(time_t time_val, int bcd)
    19 - 20 */
 uint8_t rtc_get_century(time_t time_val, int bcd)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)((bcd) ? int_to_bcd((int)(local->tm_year / 100) + 19) : (int)(local->tm_year / 100) + 19);
 }
@@ -173,8 +257,7 @@ uint8_t rtc_get_century(time_t time_val, int bcd)
    0 - 6 (sunday 0, monday 1 ...etc) */
 uint8_t rtc_get_weekday(time_t time_val)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint8_t)local->tm_wday;
 }
@@ -183,8 +266,7 @@ uint8_t rtc_get_weekday(time_t time_val)
    0 - 365 */
 uint16_t rtc_get_day_of_year(time_t time_val)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return (uint16_t)local->tm_yday;
 }
@@ -193,8 +275,7 @@ uint16_t rtc_get_day_of_year(time_t time_val)
    0 - >0 (0 no dst, >0 dst) */
 int rtc_get_dst(time_t time_val)
 {
-    time_t now = time_val;
-    struct tm *local = localtime(&now);
+    const struct tm *local = rtc_localtime(time_val);
 
     return local->tm_isdst;
 }
@@ -202,7 +283,7 @@ int rtc_get_dst(time_t time_val)
 /* get the current clock based on time + offset so the value can be latched */
 time_t rtc_get_latch(time_t offset)
 {
-    return time(NULL) + offset;
+    return rtc_time() + offset;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -211,7 +292,7 @@ time_t rtc_get_latch(time_t offset)
    0 - 59 */
 time_t rtc_set_second(int seconds, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_seconds = (bcd) ? bcd_to_int(seconds) : seconds;
@@ -230,7 +311,7 @@ time_t rtc_set_second(int seconds, time_t offset, int bcd)
    0 - 59 */
 time_t rtc_set_minute(int minutes, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_minutes = (bcd) ? bcd_to_int(minutes) : minutes;
@@ -249,7 +330,7 @@ time_t rtc_set_minute(int minutes, time_t offset, int bcd)
    0 - 23 */
 time_t rtc_set_hour(int hours, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_hours = (bcd) ? bcd_to_int(hours) : hours;
@@ -268,7 +349,7 @@ time_t rtc_set_hour(int hours, time_t offset, int bcd)
    1 - 12 and AM/PM indicator */
 time_t rtc_set_hour_am_pm(int hours, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_hours = (bcd) ? bcd_to_int(hours & 0x1f) : hours & 0x1f;
@@ -295,7 +376,7 @@ time_t rtc_set_hour_am_pm(int hours, time_t offset, int bcd)
    1 - 31 */
 time_t rtc_set_day_of_month(int day, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int is_leap_year = 0;
@@ -345,7 +426,7 @@ time_t rtc_set_day_of_month(int day, time_t offset, int bcd)
    1 - 12 */
 time_t rtc_set_month(int month, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_month = (bcd) ? bcd_to_int(month) : month;
@@ -364,7 +445,7 @@ time_t rtc_set_month(int month, time_t offset, int bcd)
    0 - 99 */
 time_t rtc_set_year(int year, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_year = (bcd) ? bcd_to_int(year) : year;
@@ -384,7 +465,7 @@ time_t rtc_set_year(int year, time_t offset, int bcd)
    19 - 20 */
 time_t rtc_set_century(int century, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_century = (bcd) ? bcd_to_int(century) : century;
@@ -404,7 +485,7 @@ time_t rtc_set_century(int century, time_t offset, int bcd)
    0 - 6 */
 time_t rtc_set_weekday(int day, time_t offset)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
 
     /* sanity check */
@@ -418,7 +499,7 @@ time_t rtc_set_weekday(int day, time_t offset)
    0 - 365 */
 time_t rtc_set_day_of_year(int day, time_t offset)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time() + offset;
     struct tm *local = localtime(&now);
     int is_leap_year = 0;
     int year = local->tm_year + 1900;
@@ -39,6 +39,8 @@
 #include <sys/types.h>
 #endif
 
+#include "../snapshot/snapshot.h"
+
 #define RTC_MONTH_JAN   0
 #define RTC_MONTH_FEB   1
 #define RTC_MONTH_MAR   2
@@ -55,6 +57,18 @@
 /* max amount of RTC's in use at the same time */
 #define RTC_MAX 20
 
+/* where the time of day comes from */
+#define RTC_TIME_HOST      0   /* ask the host on every access */
+#define RTC_TIME_CACHED    1   /* host time, refreshed by rtc_time_tick() */
+#define RTC_TIME_VIRTUAL   2   /* epoch + emulated cycles / clock */
+
+extern void rtc_set_time_source(int source, time_t epoch, long clock);
+extern void rtc_time_tick(long cycles);
+extern time_t rtc_time(void);
+/* the emulated time, restored only if it is in use */
+extern void rtc_time_snapshot_save(snapshot_t *s);
+extern int rtc_time_snapshot_load(snapshot_t *s);
+
 extern uint8_t rtc_get_centisecond(int bcd);
 
 extern uint8_t rtc_get_second(time_t time_val, int bcd);         /* 0 - 61 (leap seconds would be 60 and 61) */
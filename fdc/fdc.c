@@ -113,6 +113,8 @@ int lastbyte=0;
 int floppymodified[4];
 int floppyrate[4];
 
+void (*fdc_command_hook)(uint8_t command) = NULL;
+
 /*#ifdef ENABLE_FDC_LOG
 int fdc_do_log = ENABLE_FDC_LOG;
 #endif
@@ -842,6 +844,8 @@ fdc_write(uint16_t addr, uint8_t val, void *priv)
 			fdc->command = val;
 			fdc->stat |= 0x10;
 			fdc_log("Starting FDC command %02X\n",fdc->command);
+			if (fdc_command_hook)
+				fdc_command_hook(fdc->command);
 
 			switch (fdc->command & 0x1f) {
 				case 0x01: /*Mode*/
@@ -1854,6 +1858,7 @@ fdc_data(fdc_t *fdc, uint8_t data)
 	/* coroutine start */
 	fdc_log("data coroutine start\n");
 	state = 1;
+	fdc->dma_pending = 1;
 	fdc->dma_buf = data;
 	fdc->dma_req_cb(fdc, 1);
 	return -0xff;
@@ -1862,6 +1867,7 @@ fdc_data(fdc_t *fdc, uint8_t data)
 	c1_fdc_data:
 	fdc_log("data coroutine resume\n");
 	state = 0;
+	fdc->dma_pending = 0;
 
 	if (fdc->tc)
 		return -1;
@@ -2032,6 +2038,7 @@ int fdc_getdata(fdc_t *fdc, int last)
 	/* coroutine start */
 	fdc_log("getdata coroutine start\n");
 	state = 1;
+	fdc->dma_pending = 1;
 	fdc->dma_req_cb(fdc, 1);
 	return -0xff;
 	
@@ -2039,6 +2046,7 @@ int fdc_getdata(fdc_t *fdc, int last)
 	c1_fdc_getdata:
 	fdc_log("getdata coroutine resume\n");
 	state = 0;
+	fdc->dma_pending = 0;
 
 	data = fdc->dma_buf;
 
@@ -2066,6 +2074,76 @@ int fdc_getdata(fdc_t *fdc, int last)
 }
 
 
+/* Turbo mode DMA: the drive hands over the rest of a sector at once instead
+   of going through fdc_data()/fdc_getdata() and a DREQ per byte. */
+int
+fdc_can_dma_block(fdc_t *fdc)
+{
+    return fdc->dma_block_cb && fdc->dma && !(fdc->flags & FDC_FLAG_PCJR) &&
+	   !fdc->dma_pending && !fdc->tc && !(fdc->deleted & 2);
+}
+
+
+static void
+fdc_fifo_buf_skip(fdc_t *fdc, int len)
+{
+    if (fdc->fifo && (fdc->tfifo >= 1))
+	fdc->fifobufpos = (fdc->fifobufpos + len) % (fdc->tfifo + 1);
+}
+
+
+/* Returns the number of bytes taken, 0 to go on byte by byte. */
+int
+fdc_data_block(fdc_t *fdc, uint8_t *buf, int len)
+{
+    int n;
+
+    if (!fdc_can_dma_block(fdc))
+	return 0;
+
+    n = fdc->dma_block_cb(fdc, buf, len, 0);
+    if (n <= 0)
+	return 0;
+    fdc_log("data block %d\n", n);
+
+    fdc->dma_buf = buf[n - 1];
+    fdc_fifo_buf_skip(fdc, n);
+    fdc->data_ready = 1;
+    fdc->stat = 0xd0;
+    return n;
+}
+
+
+/* Returns the number of bytes put in buf, 0 to go on byte by byte. last
+   is set if the final byte of the data field is among them. */
+int
+fdc_getdata_block(fdc_t *fdc, uint8_t *buf, int len, int last)
+{
+    int n;
+
+    if (!fdc_can_dma_block(fdc))
+	return 0;
+
+    n = fdc->dma_block_cb(fdc, buf, len, 1);
+    if (n <= 0)
+	return 0;
+    fdc_log("getdata block %d\n", n);
+
+    fdc->dma_buf = buf[n - 1];
+    fdc_fifo_buf_skip(fdc, n);
+    fdc->stat = (last && (n == len)) ? 0xd0 : 0x90;
+    fdc->written = 0;
+    return n;
+}
+
+
+void
+fdc_set_dma_block_cb(fdc_t *fdc, devcb_dma_block dma_block_cb)
+{
+    fdc->dma_block_cb = dma_block_cb;
+}
+
+
 void
 fdc_sectorid(fdc_t *fdc, uint8_t track, uint8_t side, uint8_t sector, uint8_t size, uint8_t crc1, uint8_t crc2)
 {
@@ -2285,6 +2363,36 @@ fdc_3f1_enable(fdc_t *fdc, int enable)
 }
 
 
+/* fdc_data() and fdc_getdata() keep state of their own during a transfer,
+   so a snapshot can only be taken while there is none. */
+int
+fdc_busy(fdc_t *fdc)
+{
+    return (fdc->stat & 0x10) || fdc->dma_pending;
+}
+
+
+void
+fdc_snapshot_save(fdc_t *fdc, snapshot_t *s)
+{
+    snapshot_put(s, "fdc", fdc, sizeof(*fdc));
+}
+
+
+int
+fdc_snapshot_load(fdc_t *fdc, snapshot_t *s)
+{
+    fdc_t live = *fdc;
+
+    if (snapshot_get(s, "fdc", fdc, sizeof(*fdc)) == -1)
+	return -1;
+    fdc->int_state_cb = live.int_state_cb;
+    fdc->dma_req_cb = live.dma_req_cb;
+    fdc->dma_block_cb = live.dma_block_cb;
+    return 0;
+}
+
+
 /*const fdc_type_t fdc_xt_device = {
     "PC/XT Floppy Drive Controller",
     0,
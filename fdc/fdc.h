@@ -43,6 +43,8 @@
 #ifndef EMU_FDC_H
 # define EMU_FDC_H
 
+#include "../snapshot/snapshot.h"
+
 #define DMA_OVER	0x10000 
 
 #define FDC_FLAG_PCJR		0x01	/* PCjr */
@@ -57,6 +59,8 @@
 
 
 typedef void (*devcb_write_line)(void *device, int state);
+/* moves len bytes between buf and memory by DMA in one go, returns the count */
+typedef int (*devcb_dma_block)(void *device, uint8_t *buf, int len, int to_fdc);
 
 typedef struct {
     uint8_t	dor, stat, command, dat, st0, swap;
@@ -110,10 +114,15 @@ typedef struct {
 
 	devcb_write_line int_state_cb;
 	devcb_write_line dma_req_cb;
+	devcb_dma_block dma_block_cb;
 
 	uint8_t dma_buf;
+	int dma_pending;	/* a byte is waiting for the DMA acknowledge */
 } fdc_t;
 
+/* called with every command written to the FDC, for the profiler */
+extern void	(*fdc_command_hook)(uint8_t command);
+
 extern void	fdc_remove(fdc_t *fdc);
 extern void	fdc_poll(fdc_t *fdc);
 extern void	fdc_abort(fdc_t *fdc);
@@ -183,6 +192,15 @@ extern void	fdc_set_base(fdc_t *fdc, int base);
 extern void fdc_dma_ack(fdc_t *fdc);
 extern int	fdc_getdata(fdc_t *fdc, int last);
 extern int	fdc_data(fdc_t *fdc, uint8_t data);
+extern int	fdc_can_dma_block(fdc_t *fdc);
+extern int	fdc_data_block(fdc_t *fdc, uint8_t *buf, int len);
+extern int	fdc_getdata_block(fdc_t *fdc, uint8_t *buf, int len, int last);
+extern void	fdc_set_dma_block_cb(fdc_t *fdc, devcb_dma_block dma_block_cb);
+
+/* a snapshot is only taken between commands, when this is 0 */
+extern int	fdc_busy(fdc_t *fdc);
+extern void	fdc_snapshot_save(fdc_t *fdc, snapshot_t *s);
+extern int	fdc_snapshot_load(fdc_t *fdc, snapshot_t *s);
 
 extern void	fdc_sectorid(fdc_t *fdc, uint8_t track, uint8_t side,
 			     uint8_t sector, uint8_t size, uint8_t crc1,
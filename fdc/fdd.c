@@ -43,6 +43,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <wchar.h>
 #define HAVE_STDARG_H
 #include "86box.h"
@@ -79,6 +80,7 @@ int fdc_ready;
 
 int drive_empty[FDD_NUM] = {1, 1, 1, 1};
 int fdd_changed[FDD_NUM];
+int fdd_busy[FDD_NUM];	/* image format is still fetching the track */
 
 int motorspin;
 int64_t motoron[FDD_NUM];
@@ -111,7 +113,7 @@ static const struct
         {"144", img_load,       img_close, -1},
         {"360", img_load,       img_close, -1},
         {"720", img_load,       img_close, -1},
-//        {"86F", d86f_load,     d86f_close, -1},
+        {"86F", d86f_load,     d86f_close, -1},
         {"BIN", img_load,       img_close, -1},
         {"CQ",  img_load,       img_close, -1},
         {"CQM", img_load,       img_close, -1},
@@ -516,7 +518,7 @@ void fdd_load(int drive, char *fn)
                 if (!wcscasecmp(p, loaders[c].ext) && (size == loaders[c].size || loaders[c].size == -1))
                 {
                         driveloaders[drive] = c;
-                        memcpy(floppyfns[drive], fn, (wcslen(fn) << 1) + 2);
+                        memcpy(floppyfns[drive], fn, wcslen(fn) + 1);
 			d86f_setup(drive);
                         loaders[c].load(drive, floppyfns[drive]);
                         drive_empty[drive] = 0;
@@ -556,6 +558,18 @@ void fdd_close(int drive)
 	//ui_sb_update_icon_state(drive, 1);
 }
 
+/* Writes to the drive from now on must not reach the image: a mapped
+   raw image keeps them in memory, other formats become write protected. */
+void fdd_private(int drive)
+{
+	if (drive_empty[drive])
+		return;
+	if (loaders[driveloaders[drive]].load == img_load && img_private(drive) == 0)
+		return;
+	fdd_log("FDD: drive %d write protected\n", drive);
+	writeprot[drive] = fwriteprot[drive] = 1;
+}
+
 int fdd_notfound = 0;
 static int fdd_period = 32;
 
@@ -601,6 +615,11 @@ double fdd_real_period(int drive)
 	return (ddbp * dusec);
 }*/
 
+void fdd_set_busy(int drive, int busy)
+{
+	fdd_busy[drive] = busy;
+}
+
 void fdd_poll(int drive)
 {
 	if (drive >= FDD_NUM)
@@ -608,6 +627,8 @@ void fdd_poll(int drive)
 		fatal("Attempting to poll floppy drive %i that is not supposed to be there\n", drive);
 	}
 	fdd_log("fdd_poll D%d %ld\n",drive,fdd_poll_time[drive]);
+	if (fdd_busy[drive])
+		return;
 	if (motoron[drive]&&!--fdd_poll_time[drive]) {
 
         fdd_poll_time[drive] = 16; //+= (int64_t) fdd_real_period(drive);
@@ -776,3 +797,71 @@ void fdd_init(void)
     fdd_load(2, floppyfns[2]);
     fdd_load(3, floppyfns[3]);
 }
+
+/* The drives and the names of their images. The images themselves are
+   not saved, they are loaded again if the snapshot had other ones. */
+struct fdd_snapshot {
+	fdd_t fdd[FDD_NUM];
+	char fns[FDD_NUM][512];
+	int drive_empty[FDD_NUM];
+	int fdd_changed[FDD_NUM];
+	int fdd_cur_track[FDD_NUM];
+	int64_t motoron[FDD_NUM];
+	int64_t fdd_poll_time[FDD_NUM];
+	int curdrive;
+	int fdd_period;
+};
+
+void fdd_snapshot_save(snapshot_t *s)
+{
+	struct fdd_snapshot snap;
+
+	memset(&snap, 0, sizeof(snap));
+	memcpy(snap.fdd, fdd, sizeof(fdd));
+	memcpy(snap.fns, floppyfns, sizeof(floppyfns));
+	memcpy(snap.drive_empty, drive_empty, sizeof(drive_empty));
+	memcpy(snap.fdd_changed, fdd_changed, sizeof(fdd_changed));
+	memcpy(snap.fdd_cur_track, fdd_cur_track, sizeof(fdd_cur_track));
+	memcpy(snap.motoron, motoron, sizeof(motoron));
+	memcpy(snap.fdd_poll_time, fdd_poll_time, sizeof(fdd_poll_time));
+	snap.curdrive = curdrive;
+	snap.fdd_period = fdd_period;
+	snapshot_put(s, "fdd", &snap, sizeof(snap));
+}
+
+int fdd_snapshot_load(snapshot_t *s)
+{
+	struct fdd_snapshot snap;
+	int drive;
+
+	if (snapshot_get(s, "fdd", &snap, sizeof(snap)) == -1)
+		return -1;
+	/* the images must be there before any drive is emptied */
+	for (drive = 0; drive < FDD_NUM; drive++)
+		if (snap.fns[drive][0] && strcmp(floppyfns[drive], snap.fns[drive]) &&
+		    access(snap.fns[drive], R_OK) == -1)
+			return -1;
+	for (drive = 0; drive < FDD_NUM; drive++) {
+		if (!strcmp(floppyfns[drive], snap.fns[drive]))
+			continue;
+		if (floppyfns[drive][0])
+			fdd_close(drive);
+		if (snap.fns[drive][0]) {
+			fdd_load(drive, snap.fns[drive]);
+			if (!floppyfns[drive][0])
+				return -1;
+		}
+	}
+	memcpy(fdd, snap.fdd, sizeof(fdd));
+	memcpy(drive_empty, snap.drive_empty, sizeof(drive_empty));
+	memcpy(fdd_changed, snap.fdd_changed, sizeof(fdd_changed));
+	memcpy(fdd_cur_track, snap.fdd_cur_track, sizeof(fdd_cur_track));
+	memcpy(motoron, snap.motoron, sizeof(motoron));
+	memcpy(fdd_poll_time, snap.fdd_poll_time, sizeof(fdd_poll_time));
+	curdrive = snap.curdrive;
+	fdd_period = snap.fdd_period;
+	for (drive = 0; drive < FDD_NUM; drive++)
+		if (!drive_empty[drive])
+			fdd_do_seek(drive, fdd[drive].track);
+	return 0;
+}
@@ -42,6 +42,8 @@
 #ifndef EMU_FDD_H
 # define EMU_FDD_H
 
+#include "../snapshot/snapshot.h"
+
 
 #define FDD_NUM			4
 #define SEEK_RECALIBRATE	-999
@@ -85,6 +87,7 @@ extern char	*fdd_get_internal_name(int type);
 extern int	fdd_get_from_internal_name(char *s);
 
 extern int	fdd_current_track(int drive);
+extern void	fdd_set_busy(int drive, int busy);
 
 
 typedef struct {
@@ -119,6 +122,9 @@ extern int64_t	floppytime;
 extern void	fdd_load(int drive, char *fn);
 extern void	fdd_new(int drive, char *fn);
 extern void	fdd_close(int drive);
+extern void	fdd_snapshot_save(snapshot_t *s);
+extern int	fdd_snapshot_load(snapshot_t *s);
+extern void	fdd_private(int drive);
 extern void	fdd_init(void);
 extern void	fdd_reset(void);
 extern void	fdd_poll(int drive);
@@ -151,6 +157,7 @@ extern int	defaultwriteprot;
 extern int	writeprot[FDD_NUM], fwriteprot[FDD_NUM];
 extern int	fdd_cur_track[FDD_NUM];
 extern int	fdd_changed[FDD_NUM];
+extern int	fdd_busy[FDD_NUM];
 extern int	drive_empty[FDD_NUM];
 extern int	drive_type[FDD_NUM];
 
@@ -164,6 +171,7 @@ typedef union {
 } crc_t;
 
 void fdd_calccrc(uint8_t byte, crc_t *crc_var);
+void fdd_calccrc_block(const uint8_t *buf, int len, crc_t *crc_var);
 
 typedef struct {
     uint16_t	(*disk_flags)(int drive);
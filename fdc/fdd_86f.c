@@ -179,6 +179,27 @@ typedef struct {
     void	*prev;
 } sector_t;
 
+/*
+ * A track as the sector builder left it, so going back to it does not
+ * mean encoding every byte again. Entries are per drive, keyed by the
+ * cylinder, and the oldest one is reused when all are taken.
+ */
+#define D86F_CACHE_TRACKS	16
+
+typedef struct {
+    int		track;
+    int		turbo;		/* the sector lists only exist in turbo mode */
+    uint32_t	used;
+    uint32_t	words[2];
+    uint16_t	*data[2];	/* NULL if the entry is free */
+    uint32_t	index_hole_pos[2];
+    uint16_t	last_word[2];
+    uint16_t	preceding_bit[2];
+    int		sectors[2];
+    uint8_t	*ids[2];	/* c, h, r, n of each sector, oldest first */
+    sector_id_t	last_sector;
+} track_cache_t;
+
 /* Disk flags:
  *  Bit 0	Has surface data (1 = yes, 0 = no)
  *  Bits 2, 1	Hole (3 = ED + 2000 kbps, 2 = ED, 1 = HD, 0 = DD)
@@ -217,10 +238,15 @@ typedef struct {
     uint32_t	datac;
     uint32_t	id_pos;
     uint16_t	last_word[2];
+    uint32_t	word_pos[2];		/* track word held below, -1 if none */
+    uint16_t	word_data[2];		/* that word, byte swapped as needed */
+    uint16_t	word_surface[2];
+    int		word_has_surface[2];
     find_t	id_find;
     find_t	data_find;
     crc_t	calc_crc;
     crc_t	track_crc;
+    uint8_t	sector_data[16384];	/* data field read so far, for its CRC */
     uint8_t	sector_count;
     uint8_t	format_state;
     uint16_t	satisfying_bytes;
@@ -238,6 +264,8 @@ typedef struct {
     uint8_t	*outbuf;
     uint32_t	dma_over;
     int		turbo_pos;
+    track_cache_t cache[D86F_CACHE_TRACKS];
+    uint32_t	cache_clock;
     sector_t	*last_side_sector[2];
 } d86f_t;
 
@@ -269,13 +297,17 @@ static const uint8_t encoded_mfm[64] = {
 };
 
 static d86f_t	*d86f[FDD_NUM];
-static uint16_t	CRCTable[256];
+static uint16_t	CRCTable[8][256];
+static uint8_t	decode_table[256];
+static uint16_t	encode_data_table[256];
+static uint16_t	encode_clock_table[256];
 static fdc_t	*d86f_fdc;
 uint64_t	poly = 0x42F0E1EBA9EA3693ll;		/* ECMA normal */
 uint64_t	table[256];
 
 
 uint16_t d86f_side_flags(int drive);
+static void d86f_writeback_track(int drive);
 int d86f_is_mfm(int drive);
 void d86f_writeback(int drive);
 uint8_t d86f_poll_read_data(int drive, int side, uint16_t pos);
@@ -315,8 +347,41 @@ setup_crc(uint16_t poly)
 		  else
 			temp <<= 1;
 
-		CRCTable[c] = temp;
+		CRCTable[0][c] = temp;
+	}
+    }
+
+    /* Slices for fdd_calccrc_block(), which does 8 bytes per step. */
+    for (c = 0; c < 256; c++) {
+	for (bc = 1; bc < 8; bc++)
+		CRCTable[bc][c] = (CRCTable[bc - 1][c] << 8) ^ CRCTable[0][CRCTable[bc - 1][c] >> 8];
+    }
+}
+
+
+/* The sliced tables must give what the CRC register gives bit by bit,
+   for every length the tail loop can be left with. */
+static void
+check_crc(uint16_t poly)
+{
+    uint8_t buf[520];
+    uint16_t bits;
+    crc_t crc;
+    int len, i, bc;
+
+    for (i = 0; i < sizeof(buf); i++)
+	buf[i] = (i * 73 + 41) & 0xff;
+
+    for (len = 0; len < sizeof(buf); len += (len < 24) ? 1 : 61) {
+	bits = 0xffff;
+	for (i = 0; i < len; i++) {
+		bits ^= buf[i] << 8;
+		for (bc = 0; bc < 8; bc++)
+			bits = (bits & 0x8000) ? (bits << 1) ^ poly : bits << 1;
 	}
+	crc.word = 0xffff;
+	fdd_calccrc_block(buf, len, &crc);
+	assert(crc.word == bits);
     }
 }
 
@@ -845,7 +910,7 @@ d86f_header_size(int drive)
 
 
 static uint16_t
-d86f_encode_get_data(uint8_t dat)
+d86f_encode_get_data_bits(uint8_t dat)
 {
     uint16_t temp;
     temp = 0;
@@ -864,7 +929,7 @@ d86f_encode_get_data(uint8_t dat)
 
 
 static uint16_t
-d86f_encode_get_clock(uint8_t dat)
+d86f_encode_get_clock_bits(uint8_t dat)
 {
     uint16_t temp;
     temp = 0;
@@ -882,6 +947,11 @@ d86f_encode_get_clock(uint8_t dat)
 }
 
 
+/* The bit at a time versions above fill these once, see d86f_init(). */
+#define d86f_encode_get_data(dat)	encode_data_table[(uint8_t) (dat)]
+#define d86f_encode_get_clock(dat)	encode_clock_table[(uint8_t) (dat)]
+
+
 int
 d86f_format_conditions(int drive)
 {
@@ -1062,55 +1132,74 @@ d86f_can_read_address(int drive)
 }
 
 
+/*
+ * The poll loop moves one bit cell at a time, but the track only needs
+ * to be looked at once per word. Keep the word under the head, already
+ * in host order, so the flag lookups and the byte swap are done 16 times
+ * less often. Anything that rewrites the track arrays behind our back
+ * has to call d86f_word_flush().
+ */
+static void
+d86f_word_flush(d86f_t *dev)
+{
+    dev->word_pos[0] = dev->word_pos[1] = 0xffffffff;
+}
+
+
+static void
+d86f_word_fetch(int drive, int side, uint32_t track_word)
+{
+    d86f_t *dev = d86f[drive];
+    uint16_t *data = d86f_handler[drive].encoded_data(drive, side);
+    int reverse = d86f_reverse_bytes(drive);
+
+    if (reverse) {
+	/* Image is in reverse endianness, read the data as is. */
+	dev->word_data[side] = data[track_word];
+    } else {
+	/* We store the words as big endian, so we need to convert them to little endian when reading. */
+	dev->word_data[side] = (data[track_word] << 8) | (data[track_word] >> 8);
+    }
+
+    /* In some cases, misindentification occurs so we need to make sure the surface data array is not
+       not NULL. */
+    dev->word_has_surface[side] = d86f_has_surface_desc(drive) && dev->track_surface_data[side];
+    dev->word_surface[side] = 0;
+    if (dev->word_has_surface[side]) {
+	if (reverse)
+		dev->word_surface[side] = dev->track_surface_data[side][track_word] & 0xFF;
+	else
+		dev->word_surface[side] = (dev->track_surface_data[side][track_word] << 8) |
+					  (dev->track_surface_data[side][track_word] >> 8);
+    }
+
+    dev->word_pos[side] = track_word;
+}
+
+
 void
 d86f_get_bit(int drive, int side)
 {
     d86f_t *dev = d86f[drive];
     uint32_t track_word;
     uint32_t track_bit;
-    uint16_t encoded_data;
-    uint16_t surface_data = 0;
     uint16_t current_bit;
-    uint16_t surface_bit;
 
     track_word = dev->track_pos >> 4;
 
     /* We need to make sure we read the bits from MSB to LSB. */
     track_bit = 15 - (dev->track_pos & 15);
 
-    if (d86f_reverse_bytes(drive)) {
-	/* Image is in reverse endianness, read the data as is. */
-	encoded_data = d86f_handler[drive].encoded_data(drive, side)[track_word];
-    } else {
-	/* We store the words as big endian, so we need to convert them to little endian when reading. */
-	encoded_data = (d86f_handler[drive].encoded_data(drive, side)[track_word] & 0xFF) << 8;
-	encoded_data |= (d86f_handler[drive].encoded_data(drive, side)[track_word] >> 8);
-    }
+    if (dev->word_pos[side] != track_word)
+	d86f_word_fetch(drive, side, track_word);
 
-    /* In some cases, misindentification occurs so we need to make sure the surface data array is not
-       not NULL. */
-    if (d86f_has_surface_desc(drive) && dev->track_surface_data && dev->track_surface_data[side]) {
-	if (d86f_reverse_bytes(drive)) {
-		surface_data = dev->track_surface_data[side][track_word] & 0xFF;
-	} else {
-		surface_data = (dev->track_surface_data[side][track_word] & 0xFF) << 8;
-		surface_data |= (dev->track_surface_data[side][track_word] >> 8);
-	}
-    }
-
-    current_bit = (encoded_data >> track_bit) & 1;
+    current_bit = (dev->word_data[side] >> track_bit) & 1;
     dev->last_word[side] <<= 1;
 
-    if (d86f_has_surface_desc(drive) && dev->track_surface_data && dev->track_surface_data[side]) {
-	surface_bit = (surface_data >> track_bit) & 1;
-	if (! surface_bit) {
-		if (! current_bit) {
-			/* Bit is 0 and is not set to fuzzy, we add it as read. */
-			dev->last_word[side] |= 1;
-		} else {
-			/* Bit is 1 and is not set to fuzzy, we add it as read. */
-			dev->last_word[side] |= 1;
-		}
+    if (dev->word_has_surface[side]) {
+	if (! ((dev->word_surface[side] >> track_bit) & 1)) {
+		/* Bit is not set to fuzzy, we add it as read. */
+		dev->last_word[side] |= 1;
 	} else {
 		if (current_bit) {
 			/* Bit is 1 and is set to fuzzy, we randomly generate it. */
@@ -1130,7 +1219,7 @@ d86f_put_bit(int drive, int side, int bit)
     uint32_t track_word;
     uint32_t track_bit;
     uint16_t encoded_data;
-    uint16_t surface_data = 0;
+    uint16_t surface_data;
     uint16_t current_bit;
     uint16_t surface_bit;
 
@@ -1142,23 +1231,10 @@ d86f_put_bit(int drive, int side, int bit)
     /* We need to make sure we read the bits from MSB to LSB. */
     track_bit = 15 - (dev->track_pos & 15);
 
-    if (d86f_reverse_bytes(drive)) {
-	/* Image is in reverse endianness, read the data as is. */
-	encoded_data = d86f_handler[drive].encoded_data(drive, side)[track_word];
-    } else {
-	/* We store the words as big endian, so we need to convert them to little endian when reading. */
-	encoded_data = (d86f_handler[drive].encoded_data(drive, side)[track_word] & 0xFF) << 8;
-	encoded_data |= (d86f_handler[drive].encoded_data(drive, side)[track_word] >> 8);
-    }
-
-    if (d86f_has_surface_desc(drive)) {
-	if (d86f_reverse_bytes(drive)) {
-		surface_data = dev->track_surface_data[side][track_word] & 0xFF;
-	} else {
-		surface_data = (dev->track_surface_data[side][track_word] & 0xFF) << 8;
-		surface_data |= (dev->track_surface_data[side][track_word] >> 8);
-	}
-    }
+    if (dev->word_pos[side] != track_word)
+	d86f_word_fetch(drive, side, track_word);
+    encoded_data = dev->word_data[side];
+    surface_data = dev->word_surface[side];
 
     current_bit = (encoded_data >> track_bit) & 1;
     dev->last_word[side] <<= 1;
@@ -1166,15 +1242,9 @@ d86f_put_bit(int drive, int side, int bit)
     if (d86f_has_surface_desc(drive)) {
 	surface_bit = (surface_data >> track_bit) & 1;
 	if (! surface_bit) {
-		if (! current_bit) {
-			/* Bit is 0 and is not set to fuzzy, we overwrite it as is. */
-			dev->last_word[side] |= bit;
-			current_bit = bit;
-		} else {
-			/* Bit is 1 and is not set to fuzzy, we overwrite it as is. */
-			dev->last_word[side] |= bit;
-			current_bit = bit;
-		}
+		/* Bit is not set to fuzzy, we overwrite it as is. */
+		dev->last_word[side] |= bit;
+		current_bit = bit;
 	} else {
 		if (current_bit) {
 			/* Bit is 1 and is set to fuzzy, we overwrite it with a non-fuzzy bit. */
@@ -1186,6 +1256,7 @@ d86f_put_bit(int drive, int side, int bit)
 
 	surface_data &= ~(1 << track_bit);
 	surface_data |= (surface_bit << track_bit);
+	dev->word_surface[side] = surface_data;
 	if (d86f_reverse_bytes(drive)) {
 		dev->track_surface_data[side][track_word] = surface_data;
 	} else {
@@ -1199,6 +1270,7 @@ d86f_put_bit(int drive, int side, int bit)
 
     encoded_data &= ~(1 << track_bit);
     encoded_data |= (current_bit << track_bit);
+    dev->word_data[side] = encoded_data;
 
     if (d86f_reverse_bytes(drive)) {
 	d86f_handler[drive].encoded_data(drive, side)[track_word] = encoded_data;
@@ -1209,33 +1281,56 @@ d86f_put_bit(int drive, int side, int bit)
 }
 
 
-static uint8_t
-decodefm(int drive, uint16_t dat)
+static void
+setup_codec_tables(void)
 {
-    uint8_t temp = 0;
+    int c, bit;
 
-    /*
-     * We write the encoded bytes in big endian, so we
-     * process the two 8-bit halves swapped here.
-     */
-    if (dat & 0x0001) temp |= 1;
-    if (dat & 0x0004) temp |= 2;
-    if (dat & 0x0010) temp |= 4;
-    if (dat & 0x0040) temp |= 8;
-    if (dat & 0x0100) temp |= 16;
-    if (dat & 0x0400) temp |= 32;
-    if (dat & 0x1000) temp |= 64;
-    if (dat & 0x4000) temp |= 128;
-
-    return temp;
+    for (c = 0; c < 256; c++) {
+	decode_table[c] = 0;
+	for (bit = 0; bit < 4; bit++) {
+		if (c & (1 << (bit << 1)))
+			decode_table[c] |= (1 << bit);
+	}
+	encode_data_table[c] = d86f_encode_get_data_bits(c);
+	encode_clock_table[c] = d86f_encode_get_clock_bits(c);
+    }
 }
 
 
+/*
+ * We write the encoded bytes in big endian, so we
+ * process the two 8-bit halves swapped here.
+ */
+#define decodefm(drive, dat) \
+	(decode_table[(dat) & 0xff] | (decode_table[((dat) >> 8) & 0xff] << 4))
+
+
 void
 fdd_calccrc(uint8_t byte, crc_t *crc_var)
 {
     crc_var->word = (crc_var->word << 8) ^
-			CRCTable[(crc_var->word >> 8)^byte];
+			CRCTable[0][(crc_var->word >> 8)^byte];
+}
+
+
+void
+fdd_calccrc_block(const uint8_t *buf, int len, crc_t *crc_var)
+{
+    uint16_t crc = crc_var->word;
+
+    while (len >= 8) {
+	crc = CRCTable[7][(crc >> 8) ^ buf[0]] ^ CRCTable[6][(crc & 0xff) ^ buf[1]] ^
+	      CRCTable[5][buf[2]] ^ CRCTable[4][buf[3]] ^
+	      CRCTable[3][buf[4]] ^ CRCTable[2][buf[5]] ^
+	      CRCTable[1][buf[6]] ^ CRCTable[0][buf[7]];
+	buf += 8;
+	len -= 8;
+    }
+    while (len--)
+	crc = (crc << 8) ^ CRCTable[0][(crc >> 8) ^ *buf++];
+
+    crc_var->word = crc;
 }
 
 
@@ -1582,11 +1677,18 @@ d86f_read_sector_data(int drive, int side)
 					}
 				}
 			}
-			fdd_calccrc(data, &(dev->calc_crc));
+			/* The CRC is done over the whole field once it is in. */
+			if (sector_len <= sizeof(dev->sector_data))
+				dev->sector_data[dev->data_find.bytes_obtained] = data;
+			else
+				fdd_calccrc(data, &(dev->calc_crc));
 		} else if (dev->data_find.bytes_obtained < crc_pos)
 			dev->track_crc.bytes[(dev->data_find.bytes_obtained - sector_len) ^ 1] = decodefm(drive, dev->last_word[side]);
 		dev->data_find.bytes_obtained++;
 
+		if ((dev->data_find.bytes_obtained == sector_len) && (sector_len <= sizeof(dev->sector_data)))
+			fdd_calccrc_block(dev->sector_data, sector_len, &(dev->calc_crc));
+
 		if (dev->data_find.bytes_obtained == (crc_pos + fdc_get_gap(d86f_fdc))) {
 			/* We've got the data. */
 			if ((dev->calc_crc.word != dev->track_crc.word) && (dev->state != STATE_02_READ_DATA)) {
@@ -1714,7 +1816,7 @@ d86f_write_sector_data(int drive, int side, int mfm, uint16_t am)
 			dev->data_find.sync_marks = dev->data_find.bits_obtained = dev->data_find.bytes_obtained = 0;
 			dev->error_condition = 0;
 			dev->state = STATE_IDLE;
-			d86f_handler[drive].writeback(drive);
+			d86f_writeback_track(drive);
 			fdc_sector_finishread(d86f_fdc);
 			return;
 		}
@@ -1824,6 +1926,8 @@ d86f_write_direct_common(int drive, int side, uint16_t byte, uint8_t type, uint3
 
     dev->track_encoded_data[side][pos] = encoded_byte;
     dev->last_word[side] = encoded_byte;
+    if (dev->word_pos[side] == pos)
+	dev->word_pos[side] = 0xffffffff;
 }
 
 
@@ -1863,7 +1967,7 @@ d86f_format_finish(int drive, int side, int mfm, uint16_t sc, uint16_t gap_fill,
     dev->state = STATE_IDLE;
 
     if (do_write)
-	d86f_handler[drive].writeback(drive);
+	d86f_writeback_track(drive);
 
     dev->error_condition = 0;
     dev->datac = 0;
@@ -1879,7 +1983,7 @@ d86f_format_turbo_finish(int drive, int side, int do_write)
     dev->state = STATE_IDLE;
 
     if (do_write)
-	d86f_handler[drive].writeback(drive);
+	d86f_writeback_track(drive);
 
     dev->error_condition = 0;
     dev->datac = 0;
@@ -2117,6 +2221,31 @@ d86f_initialize_last_sector_id(int drive, int c, int h, int r, int n)
 }
 
 
+/*
+ * With DMA the FDC can take the sector in one go. This is only tried at
+ * the start of the data field, if the host takes less (end of the DMA
+ * count) the rest goes byte by byte. Returns 1 if all of it was taken.
+ */
+static int
+d86f_turbo_read_block(int drive, int side)
+{
+    d86f_t *dev = d86f[drive];
+    uint8_t buf[32768];
+    int len = (128 << dev->last_sector.id.n) - dev->turbo_pos;
+    int i, n;
+
+    if (dev->turbo_pos || (len > sizeof(buf)) || !fdc_can_dma_block(d86f_fdc))
+	return 0;
+
+    for (i = 0; i < len; i++)
+	buf[i] = d86f_handler[drive].read_data(drive, side, dev->turbo_pos + i);
+    n = fdc_data_block(d86f_fdc, buf, len);
+    d86f_log("read turbo block: %d+%d\n", dev->turbo_pos, n);
+    dev->turbo_pos += n;
+    return (n == len);
+}
+
+
 void
 d86f_turbo_read(int drive, int side)
 {
@@ -2125,6 +2254,10 @@ d86f_turbo_read(int drive, int side)
     int recv_data = 0;
     int read_status = 0;
 
+    if ((dev->state != STATE_11_SCAN_DATA) && (dev->state != STATE_16_VERIFY_DATA) &&
+	d86f_turbo_read_block(drive, side))
+	goto read_done;
+
     dat = d86f_handler[drive].read_data(drive, side, dev->turbo_pos);
 
     if (dev->state == STATE_11_SCAN_DATA) {
@@ -2149,6 +2282,7 @@ d86f_turbo_read(int drive, int side)
     }
 
     dev->turbo_pos++;
+read_done:
     if (dev->turbo_pos >= (128 << dev->last_sector.id.n)) {
 	/* CRC is valid. */
 	dev->data_find.sync_marks = dev->data_find.bits_obtained = dev->data_find.bytes_obtained = 0;
@@ -2164,12 +2298,43 @@ d86f_turbo_read(int drive, int side)
 }
 
 
+/* The write counterpart, for the part of the sector the host supplies. */
+static int
+d86f_turbo_write_block(int drive, int side)
+{
+    d86f_t *dev = d86f[drive];
+    uint8_t buf[32768];
+    int data_len = d86f_get_data_len(drive);
+    int len = (128 << dev->last_sector.id.n) - dev->turbo_pos;
+    int i, n;
+
+    if (len > data_len)
+	len = data_len;
+    if ((len <= 0) || dev->turbo_pos || (len > sizeof(buf)) || !fdc_can_dma_block(d86f_fdc))
+	return 0;
+
+    n = fdc_getdata_block(d86f_fdc, buf, len, len == data_len);
+    d86f_log("write turbo block: %d+%d\n", dev->turbo_pos, n);
+    for (i = 0; i < n; i++)
+	d86f_handler[drive].write_data(drive, side, dev->turbo_pos + i, buf[i]);
+    dev->data_find.bytes_obtained += n;
+    dev->turbo_pos += n;
+    return n;
+}
+
+
 void
 d86f_turbo_write(int drive, int side)
 {
     d86f_t *dev = d86f[drive];
     int dat = 0;
 
+    if (d86f_turbo_write_block(drive, side)) {
+	if (dev->turbo_pos < (128 << dev->last_sector.id.n))
+		return;
+	goto write_done;
+    }
+
     dat = d86f_get_data(drive, 0);
 	d86f_log("write turbo_pos: %d %02x\n",dev->turbo_pos,dat);
 	if (dat == -0xff)
@@ -2179,12 +2344,13 @@ d86f_turbo_write(int drive, int side)
 	dev->data_find.bytes_obtained++;
     dev->turbo_pos++;
 
+write_done:
     if (dev->turbo_pos >= (128 << dev->last_sector.id.n)) {
 	/* We've written the data. */
 	dev->data_find.sync_marks = dev->data_find.bits_obtained = dev->data_find.bytes_obtained = 0;
 	dev->error_condition = 0;
 	dev->state = STATE_IDLE;
-	d86f_handler[drive].writeback(drive);
+	d86f_writeback_track(drive);
 	fdc_sector_finishread(d86f_fdc);
     }
 }
@@ -2745,8 +2911,8 @@ d86f_prepare_sector(int drive, int side, int prev_pos, uint8_t *id_buf, uint8_t
     for (i = 0; i < data_len; i++) {
 	d86f_write_direct_common(drive, side, data_buf[i], 0, pos);
 	pos = (pos + 1) % raw_size;
-	d86f_calccrc(dev, data_buf[i]);
     }
+    fdd_calccrc_block(data_buf, data_len, &(dev->calc_crc));
     if (bad_crc)
 	dev->calc_crc.word ^= 0xffff;
     for (i = 1; i >= 0; i--) {
@@ -2945,6 +3111,7 @@ d86f_zero_track(int drive)
 		memset(dev->track_surface_data[side], 0, 106096);
 	memset(dev->track_encoded_data[side], 0, 106096);
     }
+    d86f_word_flush(dev);
 }
 
 
@@ -2973,6 +3140,11 @@ d86f_seek(int drive, int track)
 
     dev->cur_track = track;
 
+    if (fdd_doublestep_40(drive) && d86f_cache_restore(drive)) {
+	dev->state = STATE_IDLE;
+	return;
+    }
+
     if (! fdd_doublestep_40(drive)) {
 	for (side = 0; side < sides; side++) {
 		for (thin_track = 0; thin_track < 2; thin_track++)
@@ -2983,8 +3155,10 @@ d86f_seek(int drive, int track)
     } else {
 	for (side = 0; side < sides; side++)
 		d86f_read_track(drive, track, 0, side, dev->track_encoded_data[side], dev->track_surface_data[side]);
+	d86f_cache_store(drive);
     }
 
+    d86f_word_flush(dev);
     dev->state = STATE_IDLE;
 }
 
@@ -3031,6 +3205,168 @@ d86f_set_cur_track(int drive, int track)
 }
 
 
+static track_cache_t *
+d86f_cache_find(d86f_t *dev, int track)
+{
+    int i;
+
+    for (i = 0; i < D86F_CACHE_TRACKS; i++) {
+	if (dev->cache[i].data[0] && (dev->cache[i].track == track))
+		return &dev->cache[i];
+    }
+
+    return NULL;
+}
+
+
+static void
+d86f_cache_free(track_cache_t *c)
+{
+    int side;
+
+    for (side = 0; side < 2; side++) {
+	free(c->data[side]);
+	free(c->ids[side]);
+	c->data[side] = NULL;
+	c->ids[side] = NULL;
+    }
+}
+
+
+/* Forget the current track, it is about to differ from what was cached. */
+static void
+d86f_cache_drop(d86f_t *dev)
+{
+    track_cache_t *c = d86f_cache_find(dev, dev->cur_track);
+
+    if (c)
+	d86f_cache_free(c);
+}
+
+
+/* Whatever changed the current track is about to reach the image. */
+static void
+d86f_writeback_track(int drive)
+{
+    d86f_cache_drop(d86f[drive]);
+    d86f_handler[drive].writeback(drive);
+}
+
+
+void
+d86f_cache_flush(int drive)
+{
+    d86f_t *dev = d86f[drive];
+    int i;
+
+    if (dev == NULL) return;
+
+    for (i = 0; i < D86F_CACHE_TRACKS; i++)
+	d86f_cache_free(&dev->cache[i]);
+}
+
+
+/* Keep the track just built for the current cylinder. */
+void
+d86f_cache_store(int drive)
+{
+    d86f_t *dev = d86f[drive];
+    track_cache_t *c;
+    sector_t *s;
+    int i, side, n;
+
+    /* A write inhibited build left nothing worth keeping. */
+    if (fdc_get_diswr(d86f_fdc) || d86f_has_surface_desc(drive))
+	return;
+
+    c = d86f_cache_find(dev, dev->cur_track);
+    if (c == NULL) {
+	c = &dev->cache[0];
+	for (i = 0; i < D86F_CACHE_TRACKS; i++) {
+		if (dev->cache[i].data[0] == NULL) {
+			c = &dev->cache[i];
+			break;
+		}
+		if (dev->cache[i].used < c->used)
+			c = &dev->cache[i];
+	}
+    }
+    d86f_cache_free(c);
+
+    c->track = dev->cur_track;
+    c->turbo = fdd_get_turbo(drive);
+    c->used = ++dev->cache_clock;
+    c->last_sector = dev->last_sector;
+
+    for (side = 0; side < d86f_get_sides(drive); side++) {
+	c->words[side] = (d86f_handler[drive].get_raw_size(drive, side) + 15) >> 4;
+	if (c->words[side] > 53048)
+		c->words[side] = 53048;
+	c->data[side] = (uint16_t *) malloc(c->words[side] << 1);
+	memcpy(c->data[side], dev->track_encoded_data[side], c->words[side] << 1);
+	c->index_hole_pos[side] = dev->index_hole_pos[side];
+	c->last_word[side] = dev->last_word[side];
+	c->preceding_bit[side] = dev->preceding_bit[side];
+
+	n = 0;
+	for (s = dev->last_side_sector[side]; s; s = s->prev)
+		n++;
+	c->sectors[side] = n;
+	c->ids[side] = (uint8_t *) malloc((n << 2) + 1);
+	for (s = dev->last_side_sector[side]; s; s = s->prev) {
+		n--;
+		c->ids[side][(n << 2) + 0] = s->c;
+		c->ids[side][(n << 2) + 1] = s->h;
+		c->ids[side][(n << 2) + 2] = s->r;
+		c->ids[side][(n << 2) + 3] = s->n;
+	}
+    }
+}
+
+
+/*
+ * Put back the current cylinder from the cache. Returns 0 if it is not
+ * there, the caller then builds the track and calls d86f_cache_store().
+ */
+int
+d86f_cache_restore(int drive)
+{
+    d86f_t *dev = d86f[drive];
+    track_cache_t *c = d86f_cache_find(dev, dev->cur_track);
+    sector_t *s;
+    int i, side;
+
+    if ((c == NULL) || (c->turbo != fdd_get_turbo(drive)))
+	return 0;
+
+    c->used = ++dev->cache_clock;
+    dev->last_sector = c->last_sector;
+
+    for (side = 0; side < d86f_get_sides(drive); side++) {
+	if (c->data[side] == NULL)
+		return 0;
+	memcpy(dev->track_encoded_data[side], c->data[side], c->words[side] << 1);
+	dev->index_hole_pos[side] = c->index_hole_pos[side];
+	dev->last_word[side] = c->last_word[side];
+	dev->preceding_bit[side] = c->preceding_bit[side];
+
+	d86f_destroy_linked_lists(drive, side);
+	for (i = 0; i < c->sectors[side]; i++) {
+		s = (sector_t *) malloc(sizeof(sector_t));
+		s->c = c->ids[side][(i << 2) + 0];
+		s->h = c->ids[side][(i << 2) + 1];
+		s->r = c->ids[side][(i << 2) + 2];
+		s->n = c->ids[side][(i << 2) + 3];
+		s->prev = dev->last_side_sector[side];
+		dev->last_side_sector[side] = s;
+	}
+    }
+    d86f_word_flush(dev);
+
+    return 1;
+}
+
+
 void
 d86f_write_tracks(int drive, FILE **f, uint32_t *track_table)
 {
@@ -3345,6 +3681,7 @@ d86f_common_format(int drive, int side, int rate, uint8_t fill, int proxy)
 
 		/* Zero the data buffer. */
 		memset(dev->track_encoded_data[side], 0, array_size << 1);
+		d86f_word_flush(dev);
 
 		d86f_add_track(drive, dev->cur_track, side);
 		if (! fdd_doublestep_40(drive))
@@ -3465,6 +3802,7 @@ d86f_export(int drive, char *fn)
 
     return 1;
 }
+#endif
 
 
 void
@@ -3489,7 +3827,6 @@ d86f_load(int drive, char *fn)
 	dev->f = plat_fopen(fn, "rb");
 	if (! dev->f) {
 		memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-		free(dev);
 		return;
 	}
 	writeprot[drive] = 1;
@@ -3511,7 +3848,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 
@@ -3519,8 +3855,8 @@ d86f_load(int drive, char *fn)
 	/* File is not of the valid format, abort. */
 	d86f_log("86F: Unrecognized magic bytes: %08X\n", magic);
 	fclose(dev->f);
+	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 
@@ -3537,7 +3873,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     } else {
 	d86f_log("86F: Recognized file version: %i.%02i\n", dev->version >> 8, dev->version & 0xff);
@@ -3565,7 +3900,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 
@@ -3588,7 +3922,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 #endif
@@ -3605,7 +3938,6 @@ d86f_load(int drive, char *fn)
 	if (! dev->f) {
 		d86f_log("86F: Unable to create temporary decompressed file\n");
 		memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-		free(dev);
 		return;
 	}
 
@@ -3634,7 +3966,6 @@ d86f_load(int drive, char *fn)
 		d86f_log("86F: Error decompressing file\n");
 		plat_remove(temp_file_name);
 		memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-		free(dev);
 		return;
 	}
 
@@ -3652,7 +3983,6 @@ d86f_load(int drive, char *fn)
 		plat_remove(temp_file_name);
 #endif
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 
@@ -3666,7 +3996,6 @@ d86f_load(int drive, char *fn)
 		plat_remove(temp_file_name);
 #endif
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
 	return;
     }
 
@@ -3689,6 +4018,7 @@ d86f_load(int drive, char *fn)
 
     /* OK, set the drive data, other code needs it. */
     d86f[drive] = dev;
+    d86f_word_flush(dev);
 
     fseek(dev->f, 8, SEEK_SET);
 
@@ -3700,8 +4030,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
-	d86f[drive] = NULL;
 	return;
     }
 
@@ -3711,8 +4039,6 @@ d86f_load(int drive, char *fn)
 	fclose(dev->f);
 	dev->f = NULL;
 	memset(floppyfns[drive], 0, sizeof(floppyfns[drive]));
-	free(dev);
-	d86f[drive] = NULL;
 	return;
     }
 
@@ -3777,7 +4103,6 @@ d86f_load(int drive, char *fn)
 	d86f_has_surface_desc(drive) ? "" : " not");
 #endif
 }
-#endif
 
 
 void
@@ -3786,6 +4111,8 @@ d86f_init(void)
     int i;
 
     setup_crc(0x1021);
+    check_crc(0x1021);
+    setup_codec_tables();
 
     for (i = 0; i < FDD_NUM; i++)
 	d86f[i] = NULL;
@@ -3798,19 +4125,22 @@ d86f_set_fdc(void *fdc)
     d86f_fdc = (fdc_t *) fdc;
 }
 
-#if 0
 void
 d86f_close(int drive)
 {
     int i, j;
 
+#ifdef D86F_COMPRESS
     char temp_file_name[2048];
+#endif
     d86f_t *dev = d86f[drive];
 
     /* Make sure the drive is alive. */
     if (dev == NULL) return;
 
+#ifdef D86F_COMPRESS
     memcpy(temp_file_name, drive ? nvr_path("TEMP$$$1.$$$") : nvr_path("TEMP$$$0.$$$"), 26);
+#endif
 
     if (d86f_has_surface_desc(drive)) {
 	for (i = 0; i < 2; i++) {
@@ -3839,7 +4169,6 @@ d86f_close(int drive)
 	plat_remove(temp_file_name);
 #endif
 }
-#endif
 
 
 /* When an FDD is mounted, set up the D86F data structures. */
@@ -3852,6 +4181,7 @@ d86f_setup(int drive)
     dev = (d86f_t *)malloc(sizeof(d86f_t));
     memset(dev, 0x00, sizeof(d86f_t));
     dev->state = STATE_IDLE;
+    d86f_word_flush(dev);
 
     dev->last_side_sector[0] = NULL;
     dev->last_side_sector[1] = NULL;
@@ -3891,6 +4221,7 @@ d86f_destroy(int drive)
 
     d86f_destroy_linked_lists(drive, 0);
     d86f_destroy_linked_lists(drive, 1);
+    d86f_cache_flush(drive);
 
     free(d86f[drive]);
     d86f[drive] = NULL;
@@ -68,6 +68,9 @@ extern void	d86f_initialize_last_sector_id(int drive, int c, int h,
 					       int r, int n);
 extern void	d86f_initialize_linked_lists(int drive);
 extern void	d86f_destroy_linked_lists(int drive, int side);
+extern int	d86f_cache_restore(int drive);
+extern void	d86f_cache_store(int drive);
+extern void	d86f_cache_flush(int drive);
 
 #define length_gap0	80
 #define length_gap1	50
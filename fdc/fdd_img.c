@@ -45,23 +45,32 @@
 /* Revision: 2019-01-26 Michal Tomek z180emu */
 
 #include <stdarg.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <wchar.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #define HAVE_STDARG_H
 #include "86box.h"
 //#include "../config.h"
 //#include "../plat.h"
 #include "fdd.h"
 #include "fdd_img.h"
+#include "fdd_86f.h"
+#include "../hostio/hostio.h"
 #include "fdc.h"
 
 
 typedef struct {
     FILE	*f;
-    uint8_t	track_data[2][50000];
+    uint8_t	track_buf[2][50000];
+    uint8_t	*track_data[2];	/* the current track, in track_buf or the mapping */
+    uint8_t	*map;		/* the whole file, for plain raw images */
+    size_t	map_size;
     int		sectors, tracks, sides;
     uint8_t	sector_size;
     int		xdf_type;  /* 0 = not XDF, 1-5 = one of the five XDF types */
@@ -82,6 +91,9 @@ typedef struct {
     uint8_t	disk_at_once;
     uint8_t	interleave;
     uint8_t	skew;
+    int		drive;
+    int		io_left;	/* sides of the track still being read */
+    struct hostio_req io[2];
 } img_t;
 
 
@@ -407,17 +419,71 @@ interleave(int sector, int skew, int track_spt)
 }
 
 
+static void
+img_sync(img_t *dev, size_t pos, size_t len)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    len += pos % page;
+    pos -= pos % page;
+    if (msync(dev->map + pos, len, MS_ASYNC) == -1)
+	img_log("msync: %s\n", strerror(errno));
+}
+
+
+/*
+ * Raw images are mapped whole, write protected ones privately, so
+ * seeking just points the track at the right spot in the file.
+ */
+static void
+img_map(img_t *dev)
+{
+    struct stat st;
+    void *map;
+
+    if ((fstat(fileno(dev->f), &st) == -1) || (st.st_size == 0))
+	return;
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+	       writeprot[dev->drive] ? MAP_PRIVATE : MAP_SHARED, fileno(dev->f), 0);
+    if (map == MAP_FAILED) {
+	img_log("mmap: %s\n", strerror(errno));
+	return;
+    }
+
+    dev->map = (uint8_t *) map;
+    dev->map_size = st.st_size;
+}
+
+
 static void
 write_back(int drive)
 {
     img_t *dev = img[drive];
     int ssize = 128 << ((int) dev->sector_size);
     int side;
+    off_t pos;
 
     if (dev->f == NULL) return;
 
     if (dev->disk_at_once) return;
-		
+
+    /* Mapped sides are written already, just push them out; a side past
+       the end of the mapping is written from its buffer. */
+    if (dev->map) {
+	fflush(dev->f);
+	for (side = 0; side < dev->sides; side++) {
+		if (dev->track_data[side] != dev->track_buf[side]) {
+			img_sync(dev, dev->track_data[side] - dev->map, dev->sectors * ssize);
+			continue;
+		}
+		pos = dev->base + (dev->track * dev->sectors * ssize * dev->sides) + (side * dev->sectors * ssize);
+		if (pwrite(fileno(dev->f), dev->track_buf[side], dev->sectors * ssize, pos) != dev->sectors * ssize)
+			img_log("pwrite: %s\n", strerror(errno));
+	}
+	return;
+    }
+
     fseek(dev->f, dev->base + (dev->track * dev->sectors * ssize * dev->sides), SEEK_SET);
     for (side = 0; side < dev->sides; side++)
 	fwrite(dev->track_data[side], dev->sectors * ssize, 1, dev->f);
@@ -483,42 +549,21 @@ format_conditions(int drive)
 }
 
 
+/* Turn the sector data of the current track into the 86F track. */
 static void
-img_seek(int drive, int track)
+img_build_track(int drive)
 {
     img_t *dev = img[drive];
     int side;
     int current_xdft = dev->xdf_type - 1;
-    int read_bytes = 0;
+    int track = dev->track;
     uint8_t id[4] = { 0, 0, 0, 0 };
     int is_t0, sector, current_pos, img_pos, sr, sside, total, array_sector, buf_side, buf_pos;
     int ssize = 128 << ((int) dev->sector_size);
-    uint32_t cur_pos = 0;
-
-    if (dev->f == NULL) return;
-
-    if (!dev->track_width && fdd_doublestep_40(drive))
-	track /= 2;
-
-    dev->track = track;
-    d86f_set_cur_track(drive, track);
+    int cached;
 
     is_t0 = (track == 0) ? 1 : 0;
 
-    if (! dev->disk_at_once)
-	fseek(dev->f, dev->base + (track * dev->sectors * ssize * dev->sides), SEEK_SET);
-
-    for (side = 0; side < dev->sides; side++) {
-	if (dev->disk_at_once) {
-		cur_pos = (track * dev->sectors * ssize * dev->sides) + (side * dev->sectors * ssize);
-		memcpy(dev->track_data[side], dev->disk_data + cur_pos, dev->sectors * ssize);
-	} else {
-		read_bytes = fread(dev->track_data[side], 1, dev->sectors * ssize, dev->f);
-		if (read_bytes < (dev->sectors * ssize))
-			memset(dev->track_data[side] + read_bytes, 0xf6, (dev->sectors * ssize) - read_bytes);
-	}
-    }
-
     d86f_reset_index_hole_pos(drive, 0);
     d86f_reset_index_hole_pos(drive, 1);
 
@@ -531,8 +576,11 @@ img_seek(int drive, int track)
     }
 
     if (!dev->xdf_type || dev->is_cqm) {
+	/* The sector positions are still needed when the track is cached. */
+	cached = d86f_cache_restore(drive);
 	for (side = 0; side < dev->sides; side++) {
-		current_pos = d86f_prepare_pretrack(drive, side, 0);
+		/* current_pos is only used when the track is built */
+		current_pos = cached ? 0 : d86f_prepare_pretrack(drive, side, 0);
 
 		for (sector = 0; sector < dev->sectors; sector++) {
 			if (dev->is_cqm) {
@@ -556,12 +604,16 @@ img_seek(int drive, int track)
 			id[3] = dev->sector_size;
 			dev->sector_pos_side[side][sr] = side;
 			dev->sector_pos[side][sr] = (sr - 1) * ssize;
+			if (cached)
+				continue;
 			current_pos = d86f_prepare_sector(drive, side, current_pos, id, &dev->track_data[side][(sr - 1) * ssize], ssize, dev->gap2_size, dev->gap3_size, 0, 0);
 
 			if (sector == 0)
 				d86f_initialize_last_sector_id(drive, id[0], id[1], id[2], id[3]);
 		}
 	}
+	if (! cached)
+		d86f_cache_store(drive);
     } else {
 	total = dev->sectors;
 	img_pos = 0;
@@ -616,6 +668,96 @@ img_seek(int drive, int track)
 }
 
 
+static void
+img_read_done(struct hostio_req *io)
+{
+    img_t *dev = (img_t *) io->ctx;
+    ssize_t got = (io->result < 0) ? 0 : io->result;
+
+    if (got < io->len)
+	memset((uint8_t *) io->buf + got, 0xf6, io->len - got);
+
+    if (--dev->io_left == 0) {
+	img_build_track(dev->drive);
+	fdd_set_busy(dev->drive, 0);
+    }
+}
+
+
+/*
+ * The track is read through hostio. While that is under way the drive
+ * does not rotate, so the FDC sees no index pulses or sectors until the
+ * data is there.
+ */
+static void
+img_seek(int drive, int track)
+{
+    img_t *dev = img[drive];
+    int side;
+    int ssize = 128 << ((int) dev->sector_size);
+    uint32_t cur_pos = 0;
+    ssize_t len;
+
+    if (dev->f == NULL) return;
+
+    if (!dev->track_width && fdd_doublestep_40(drive))
+	track /= 2;
+
+    /* Finish loading the previous track before reusing the buffers. */
+    hostio_wait(&dev->io[0]);
+    hostio_wait(&dev->io[1]);
+
+    dev->track = track;
+    d86f_set_cur_track(drive, track);
+    dev->track_data[0] = dev->track_buf[0];
+    dev->track_data[1] = dev->track_buf[1];
+
+    if (dev->map) {
+	for (side = 0; side < dev->sides; side++) {
+		cur_pos = dev->base + (track * dev->sectors * ssize * dev->sides) + (side * dev->sectors * ssize);
+		if ((cur_pos + dev->sectors * ssize) <= dev->map_size) {
+			dev->track_data[side] = dev->map + cur_pos;
+			continue;
+		}
+
+		/* Past the end of the mapping, the file may have grown since. */
+		fflush(dev->f);
+		len = pread(fileno(dev->f), dev->track_buf[side], dev->sectors * ssize, cur_pos);
+		if (len < 0)
+			len = 0;
+		memset(dev->track_buf[side] + len, 0xf6, dev->sectors * ssize - len);
+	}
+	img_build_track(drive);
+	return;
+    }
+
+    if (dev->disk_at_once) {
+	for (side = 0; side < dev->sides; side++) {
+		cur_pos = (track * dev->sectors * ssize * dev->sides) + (side * dev->sectors * ssize);
+		memcpy(dev->track_data[side], dev->disk_data + cur_pos, dev->sectors * ssize);
+	}
+	img_build_track(drive);
+	return;
+    }
+
+    /* Writes go through the stdio buffer, reads do not. */
+    fflush(dev->f);
+
+    dev->io_left = dev->sides;
+    fdd_set_busy(drive, 1);
+    for (side = 0; side < dev->sides; side++) {
+	dev->io[side].op = HOSTIO_READ;
+	dev->io[side].fd = fileno(dev->f);
+	dev->io[side].offset = dev->base + (track * dev->sectors * ssize * dev->sides) + (side * dev->sectors * ssize);
+	dev->io[side].buf = dev->track_data[side];
+	dev->io[side].len = dev->sectors * ssize;
+	dev->io[side].done = img_read_done;
+	dev->io[side].ctx = dev;
+	hostio_submit(&dev->io[side]);
+    }
+}
+
+
 void
 img_init(void)
 {
@@ -657,6 +799,7 @@ img_load(int drive, char *fn)
     /* Allocate a drive block. */
     dev = (img_t *)malloc(sizeof(img_t));
     memset(dev, 0x00, sizeof(img_t));
+    dev->drive = drive;
 
     dev->f = plat_fopen(fn, "rb+");
     if (dev->f == NULL) {
@@ -1194,6 +1337,10 @@ jump_if_fdf:
 
     /* Set up the drive unit. */
     img[drive] = dev;
+    dev->track_data[0] = dev->track_buf[0];
+    dev->track_data[1] = dev->track_buf[1];
+    if (! dev->disk_at_once)
+	img_map(dev);
 
     /* Attach this format to the D86F engine. */
     d86f_handler[drive].disk_flags = disk_flags;
@@ -1224,8 +1371,16 @@ img_close(int drive)
 
     if (dev == NULL) return;
 
+    hostio_wait(&dev->io[0]);
+    hostio_wait(&dev->io[1]);
+
     d86f_unregister(drive);
 
+    if (dev->map != NULL) {
+	msync(dev->map, dev->map_size, MS_SYNC);
+	munmap(dev->map, dev->map_size);
+    }
+
     if (dev->f != NULL) {
 	fclose(dev->f);
 	dev->f = NULL;
@@ -1240,6 +1395,31 @@ img_close(int drive)
 }
 
 
+/*
+ * Keep further writes in memory, for a forked copy of the machine that
+ * must not change the image under the others. Only for mapped images.
+ */
+int
+img_private(int drive)
+{
+    img_t *dev = img[drive];
+
+    if ((dev == NULL) || (dev->map == NULL))
+	return -1;
+
+    hostio_wait(&dev->io[0]);
+    hostio_wait(&dev->io[1]);
+
+    /* the same place, so the track pointers stay good */
+    if (mmap(dev->map, dev->map_size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_FIXED, fileno(dev->f), 0) == MAP_FAILED) {
+	img_log("mmap: %s\n", strerror(errno));
+	return -1;
+    }
+    return 0;
+}
+
+
 void
 img_set_fdc(void *fdc)
 {
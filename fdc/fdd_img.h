@@ -47,6 +47,7 @@
 extern void	img_init(void);
 extern void	img_load(int drive, char *fn);
 extern void	img_close(int drive);
+extern int	img_private(int drive);
 
 
 #endif	/*EMU_FLOPPY_IMG_H*/
@@ -39,6 +39,10 @@ extern void	fdc37c663_init(void);
 fdc37c66x_t *fdc37c665_init(devcb_write_line fdc_int_state_cb, devcb_write_line fdc_dma_req_cb,
 	devcb_write_line serial1_int_state_cb, rx_callback_t serial1_rx_cb, tx_callback_t serial1_tx_cb,
 	devcb_write_line serial2_int_state_cb, rx_callback_t serial2_rx_cb, tx_callback_t serial2_tx_cb);
+/* the FDC, the drives and both serial ports, only when not busy */
+int fdc37c66x_busy(fdc37c66x_t *dev);
+void fdc37c66x_snapshot_save(fdc37c66x_t *dev, snapshot_t *s);
+int fdc37c66x_snapshot_load(fdc37c66x_t *dev, snapshot_t *s);
 extern void	fdc37c669_init(void);
 extern void	fdc37c932fr_init(void);
 extern void	fdc37c935_init(void);
@@ -466,3 +466,58 @@ fdc37c66x_t *fdc37c665_init(devcb_write_line fdc_int_state_cb, devcb_write_line
 
 	return &fdc37c66x;
 }
+
+/* The configuration registers and the addresses they select */
+struct fdc37c66x_snapshot {
+	uint8_t lock[2];
+	int curreg;
+	uint8_t regs[16];
+	int com3_addr, com4_addr;
+	int serial_base_address[2];
+};
+
+int fdc37c66x_busy(fdc37c66x_t *dev)
+{
+	if (!fdc_busy(dev->fdc))
+		return 0;
+	sio_log("FDC busy, no snapshot\n");
+	return 1;
+}
+
+void fdc37c66x_snapshot_save(fdc37c66x_t *dev, snapshot_t *s)
+{
+	struct fdc37c66x_snapshot snap;
+
+	fdc_snapshot_save(dev->fdc, s);
+	memset(&snap, 0, sizeof(snap));
+	memcpy(snap.lock, fdc37c66x_lock, sizeof(snap.lock));
+	snap.curreg = fdc37c66x_curreg;
+	memcpy(snap.regs, fdc37c66x_regs, sizeof(snap.regs));
+	snap.com3_addr = com3_addr;
+	snap.com4_addr = com4_addr;
+	memcpy(snap.serial_base_address, serial_base_address, sizeof(snap.serial_base_address));
+	snapshot_put(s, "fdc37c66x", &snap, sizeof(snap));
+	fdd_snapshot_save(s);
+	ins8250_snapshot_save(dev->serial1, "serial1", s);
+	ins8250_snapshot_save(dev->serial2, "serial2", s);
+}
+
+int fdc37c66x_snapshot_load(fdc37c66x_t *dev, snapshot_t *s)
+{
+	struct fdc37c66x_snapshot snap;
+
+	/* first the drives, the one part that can fail on a good snapshot */
+	if (fdd_snapshot_load(s) == -1 || snapshot_get(s, "fdc37c66x", &snap, sizeof(snap)) == -1)
+		return -1;
+	memcpy(fdc37c66x_lock, snap.lock, sizeof(snap.lock));
+	fdc37c66x_curreg = snap.curreg;
+	memcpy(fdc37c66x_regs, snap.regs, sizeof(snap.regs));
+	com3_addr = snap.com3_addr;
+	com4_addr = snap.com4_addr;
+	memcpy(serial_base_address, snap.serial_base_address, sizeof(snap.serial_base_address));
+	if (fdc_snapshot_load(dev->fdc, s) == -1 ||
+	    ins8250_snapshot_load(dev->serial1, "serial1", s) == -1 ||
+	    ins8250_snapshot_load(dev->serial2, "serial2", s) == -1)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * hostio.c - background workers for disk image I/O
+ *
+ * Devices hand their image reads and writes to a small pool of threads
+ * and keep reporting busy to the guest until the completion runs. That
+ * happens in hostio_poll(), on the emulation thread, at a slice boundary,
+ * so device state is never touched from a worker. A slow host read
+ * then stalls only the device, not the CPU and the serial ports.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "hostio.h"
+
+#define MAXTHREADS 8
+
+static pthread_t threads[MAXTHREADS];
+static int nthreads = 0;
+static int stopping = 0;
+/* what hostio_init() was asked for, by which process, for hostio_restart() */
+static int wanted = 0;
+static pid_t owner = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+/* FIFOs: submitted requests, and finished ones waiting for completion */
+static struct hostio_req *todo_head = NULL, *todo_tail = NULL;
+static struct hostio_req *done_head = NULL, *done_tail = NULL;
+static int inflight = 0;
+
+void (*hostio_read_hook)(const void *buf, size_t len) = NULL;
+
+/* Overlays: blocks written go to the overlay file at the same offset,
+ * a bitmap tells which blocks are there. */
+#define MAXOVERLAYS 8
+#define OVERLAY_BLOCK 512
+
+static struct hostio_overlay {
+	int fd;			/* the image, read only from now on */
+	int ofd;		/* the overlay file */
+	off_t size;
+	uint8_t *written;	/* one bit per block */
+} overlays[MAXOVERLAYS];
+static int noverlays = 0;
+
+/* pread/pwrite may come back short, e.g. on network file systems */
+static ssize_t hostio_rw(enum hostio_op op, int fd, char *buf, size_t len, off_t offset)
+{
+	size_t got = 0;
+	ssize_t n = 0;
+
+	while (got < len) {
+		if (op == HOSTIO_READ)
+			n = pread(fd, buf + got, len - got, offset + got);
+		else
+			n = pwrite(fd, buf + got, len - got, offset + got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	return n == -1 ? -1 : got;
+}
+
+static struct hostio_overlay *hostio_find_overlay(int fd)
+{
+	int i;
+
+	for (i = 0; i < noverlays; i++)
+		if (overlays[i].fd == fd)
+			return &overlays[i];
+	return NULL;
+}
+
+/* block by block, each from wherever its latest version is */
+static ssize_t hostio_rw_overlay(struct hostio_overlay *o, enum hostio_op op, char *buf, size_t len, off_t offset)
+{
+	char block[OVERLAY_BLOCK];
+	size_t done = 0, part;
+	off_t b, start;
+	ssize_t n;
+
+	while (done < len) {
+		b = (offset + done) / OVERLAY_BLOCK;
+		start = b * OVERLAY_BLOCK;
+		part = start + OVERLAY_BLOCK - (offset + done);
+		if (part > len - done)
+			part = len - done;
+		/* the image does not grow behind an overlay */
+		if (offset + done >= o->size)
+			break;
+		if (o->written[b >> 3] & (1 << (b & 7))) {
+			n = hostio_rw(op, o->ofd, buf + done, part, offset + done);
+		} else if (op == HOSTIO_READ) {
+			n = hostio_rw(op, o->fd, buf + done, part, offset + done);
+		} else {
+			/* first write to the block: start from the image */
+			if (part < OVERLAY_BLOCK) {
+				memset(block, 0, sizeof(block));
+				if (hostio_rw(HOSTIO_READ, o->fd, block, OVERLAY_BLOCK, start) == -1)
+					return -1;
+			}
+			memcpy(block + (offset + done - start), buf + done, part);
+			if (hostio_rw(HOSTIO_WRITE, o->ofd, block, OVERLAY_BLOCK, start) != OVERLAY_BLOCK)
+				return -1;
+			o->written[b >> 3] |= 1 << (b & 7);
+			n = part;
+		}
+		if (n == -1)
+			return -1;
+		done += n;
+		if (n < part)
+			break;
+	}
+	return done;
+}
+
+static void hostio_transfer(struct hostio_req *req)
+{
+	struct hostio_overlay *o = noverlays ? hostio_find_overlay(req->fd) : NULL;
+	ssize_t n;
+
+	if (o)
+		n = hostio_rw_overlay(o, req->op, req->buf, req->len, req->offset);
+	else
+		n = hostio_rw(req->op, req->fd, req->buf, req->len, req->offset);
+	if (n == -1) {
+		req->result = -1;
+		req->err = errno;
+	} else {
+		req->result = n;
+		req->err = 0;
+	}
+}
+
+static void hostio_complete(struct hostio_req *req)
+{
+	if (hostio_read_hook && req->op == HOSTIO_READ && req->result != -1)
+		hostio_read_hook(req->buf, req->result);
+	if (req->done)
+		req->done(req);
+}
+
+static void *hostio_worker(void *arg)
+{
+	struct hostio_req *req;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!todo_head && !stopping)
+			pthread_cond_wait(&queued, &lock);
+		if (!todo_head)
+			break;
+		req = todo_head;
+		todo_head = req->next;
+		if (!todo_head)
+			todo_tail = NULL;
+		pthread_mutex_unlock(&lock);
+
+		hostio_transfer(req);
+
+		pthread_mutex_lock(&lock);
+		req->state = HOSTIO_DONE;
+		req->next = NULL;
+		if (done_tail)
+			done_tail->next = req;
+		else
+			done_head = req;
+		done_tail = req;
+		pthread_cond_broadcast(&finished);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int hostio_init(int n)
+{
+	if (n > MAXTHREADS)
+		n = MAXTHREADS;
+	wanted = n;
+	owner = getpid();
+	stopping = 0;
+	for (nthreads = 0; nthreads < n; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, hostio_worker, NULL)) {
+			perror("hostio");
+			break;
+		}
+	}
+	/* no threads at all is fine, we just stay synchronous */
+	return nthreads;
+}
+
+int hostio_async()
+{
+	return nthreads > 0;
+}
+
+void hostio_submit(struct hostio_req *req)
+{
+	req->next = NULL;
+	if (!nthreads) {
+		hostio_transfer(req);
+		hostio_complete(req);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	req->state = HOSTIO_QUEUED;
+	if (todo_tail)
+		todo_tail->next = req;
+	else
+		todo_head = req;
+	todo_tail = req;
+	inflight++;
+	pthread_cond_signal(&queued);
+	pthread_mutex_unlock(&lock);
+}
+
+void hostio_poll()
+{
+	struct hostio_req *list, *req;
+
+	if (!nthreads)
+		return;
+	pthread_mutex_lock(&lock);
+	list = done_head;
+	done_head = done_tail = NULL;
+	pthread_mutex_unlock(&lock);
+
+	/* completions may submit again, so unlink before running them */
+	while (list) {
+		req = list;
+		list = req->next;
+		pthread_mutex_lock(&lock);
+		inflight--;
+		req->state = HOSTIO_IDLE;
+		pthread_mutex_unlock(&lock);
+		hostio_complete(req);
+	}
+}
+
+int hostio_pending(struct hostio_req *req)
+{
+	int pending;
+
+	if (!nthreads)
+		return req->state != HOSTIO_IDLE;
+	pthread_mutex_lock(&lock);
+	pending = req->state != HOSTIO_IDLE;
+	pthread_mutex_unlock(&lock);
+	return pending;
+}
+
+void hostio_wait(struct hostio_req *req)
+{
+	while (hostio_pending(req)) {
+		pthread_mutex_lock(&lock);
+		while (req->state == HOSTIO_QUEUED)
+			pthread_cond_wait(&finished, &lock);
+		pthread_mutex_unlock(&lock);
+		hostio_poll();
+	}
+}
+
+void hostio_shutdown()
+{
+	int i;
+
+	if (!nthreads)
+		return;
+	pthread_mutex_lock(&lock);
+	while (inflight) {
+		while (!done_head)
+			pthread_cond_wait(&finished, &lock);
+		pthread_mutex_unlock(&lock);
+		hostio_poll();
+		pthread_mutex_lock(&lock);
+	}
+	stopping = 1;
+	pthread_cond_broadcast(&queued);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	nthreads = 0;
+}
+
+int hostio_restart()
+{
+	/* not in a fork, e.g. a clone, that one stays synchronous */
+	if (nthreads || !wanted || getpid() != owner)
+		return nthreads;
+	return hostio_init(wanted);
+}
+
+int hostio_overlay(int fd, const char *image, const char *file)
+{
+	struct hostio_overlay *o;
+	struct stat st;
+	int nfd = -1, ofd;
+
+	if (noverlays == MAXOVERLAYS || hostio_find_overlay(fd) || fstat(fd, &st) == -1)
+		return -1;
+	/* a file description of our own, with its own offset */
+	if (image && (nfd = open(image, O_RDONLY)) == -1)
+		return -1;
+	if ((ofd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+		if (nfd != -1)
+			close(nfd);
+		return -1;
+	}
+	if (nfd != -1) {
+		lseek(nfd, lseek(fd, 0, SEEK_CUR), SEEK_SET);
+		dup2(nfd, fd);
+		close(nfd);
+	}
+
+	o = &overlays[noverlays++];
+	o->fd = fd;
+	o->ofd = ofd;
+	o->size = st.st_size;
+	o->written = calloc(st.st_size / OVERLAY_BLOCK / 8 + 1, 1);
+	return 0;
+}
+
+void hostio_overlay_drop(int fd)
+{
+	struct hostio_overlay *o = hostio_find_overlay(fd);
+
+	if (!o)
+		return;
+	close(o->ofd);
+	free(o->written);
+	*o = overlays[--noverlays];
+}
@@ -0,0 +1,81 @@
+/*
+ * hostio.h - background workers for disk image I/O
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef HOSTIO_H
+#define HOSTIO_H
+
+#include <sys/types.h>
+
+enum hostio_op {
+	HOSTIO_READ,
+	HOSTIO_WRITE
+};
+
+enum hostio_state {
+	HOSTIO_IDLE = 0,	/* free for the next request */
+	HOSTIO_QUEUED,		/* submitted, a worker has it or will get it */
+	HOSTIO_DONE		/* transferred, completion not run yet */
+};
+
+/* A request is owned by the device that submits it, usually embedded in
+ * its state. Only one request per struct may be in flight. */
+struct hostio_req {
+	enum hostio_op op;
+	int fd;
+	off_t offset;
+	void *buf;
+	size_t len;
+	ssize_t result;		/* bytes transferred, -1 on error */
+	int err;		/* errno if result is -1 */
+	enum hostio_state state;	/* under the queue lock, see hostio_pending() */
+	void (*done)(struct hostio_req *req);	/* run on the emulation thread */
+	void *ctx;
+	struct hostio_req *next;
+};
+
+/* start nthreads workers. With 0 (the default if never called) requests
+ * are carried out and completed inside hostio_submit() */
+extern int hostio_init(int nthreads);
+/* 1 if requests complete later, from hostio_poll() */
+extern int hostio_async();
+extern void hostio_submit(struct hostio_req *req);
+/* 1 while req is queued or its completion has not run yet */
+extern int hostio_pending(struct hostio_req *req);
+/* run the completions of finished requests, call at slice boundaries */
+extern void hostio_poll();
+/* block until req is through and its completion has run */
+extern void hostio_wait(struct hostio_req *req);
+/* finish all outstanding requests and stop the workers */
+extern void hostio_shutdown();
+/* start the workers again after hostio_shutdown(), as many as hostio_init()
+ * was given. Not in a forked process, it stays synchronous. */
+extern int hostio_restart();
+/* From now on requests on fd write to file instead, and read back what
+ * was written there; the image behind fd stays as it is. With image, the
+ * file fd was opened from, fd is opened again, for a file offset of its
+ * own, apart from other processes that share it after a fork. Only for
+ * requests that go through hostio, -1 on error. */
+extern int hostio_overlay(int fd, const char *image, const char *file);
+/* fd is closed: forget its overlay, if it has one */
+extern void hostio_overlay_drop(int fd);
+/* if set, called with what each read brought in, before its completion */
+extern void (*hostio_read_hook)(const void *buf, size_t len);
+
+#endif /* HOSTIO_H */
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 
 #include "ide.h"
@@ -81,6 +82,8 @@ const uint8_t ide_magic[8] = {
   '1','D','E','D','1','5','C','0'
 };
 
+void (*ide_command_hook)(uint8_t command) = NULL;
+
 static char *charmap(uint8_t v)
 {
   static char cbuf[3];
@@ -212,20 +215,23 @@ static void edd_setup(struct ide_taskfile *tf)
   ready(tf);
 }
 
-void ide_reset(struct ide_controller *c)
+static void ide_drive_ready(struct ide_drive *d)
 {
-  if (c->drive[0].present) {
-    edd_setup(&c->drive[0].taskfile);
+  /* Let a sector transfer in flight land before the state is reset */
+  hostio_wait(&d->io);
+  if (d->present) {
+    edd_setup(&d->taskfile);
     /* A drive could clear busy then set DRDY up to 2 minutes later if its
        mindnumbingly slow to start up ! We don't emulate any of that */
-    c->drive[0].taskfile.status = ST_DRDY;
-    c->drive[0].eightbit = 0;
-  }
-  if (c->drive[1].present) {
-    edd_setup(&c->drive[1].taskfile);
-    c->drive[1].taskfile.status = ST_DRDY;
-    c->drive[1].eightbit = 0;
+    d->taskfile.status = ST_DRDY;
+    d->eightbit = 0;
   }
+}
+
+void ide_reset(struct ide_controller *c)
+{
+  ide_drive_ready(&c->drive[0]);
+  ide_drive_ready(&c->drive[1]);
   c->selected = 0;
 }
 
@@ -239,6 +245,18 @@ void ide_reset_begin(struct ide_controller *c)
   ide_reset(c);
 }
 
+/*
+ *	A drive was swapped: it comes up as after power on, the other drive
+ *	and the controller are left alone
+ */
+void ide_reset_drive(struct ide_controller *c, int drive)
+{
+  struct ide_drive *d = &c->drive[drive];
+  ide_drive_ready(d);
+  d->state = IDE_IDLE;
+  d->failed = 0;
+}
+
 static void ide_srst_begin(struct ide_controller *c)
 {
   ide_reset(c);
@@ -289,6 +307,8 @@ static void cmd_initparam_complete(struct ide_taskfile *tf)
   completed(tf);
 }
 
+static void ide_read_sector(struct ide_drive *d);
+
 static void cmd_readsectors_complete(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
@@ -314,6 +334,7 @@ static void cmd_readsectors_complete(struct ide_taskfile *tf)
   }
   /* do the xfer */
   data_in_state(tf);
+  ide_read_sector(d);
 }
 
 static void cmd_verifysectors_complete(struct ide_taskfile *tf)
@@ -435,47 +456,101 @@ static void ide_set_error(struct ide_drive *d)
   completed(&d->taskfile);
 }
 
-static int ide_read_sector(struct ide_drive *d)
+/*
+ *	Sector transfers go through hostio. The drive shows BSY without DRQ
+ *	until the host side is done, which with worker threads is at the
+ *	next slice boundary, otherwise right away.
+ */
+static void ide_read_done(struct hostio_req *io)
 {
-  int len;
+  struct ide_drive *d = io->ctx;
 
+  d->taskfile.status &= ~ST_BSY;
   d->dptr = d->data;
-  if ((len = read(d->fd, d->data, 512)) != 512) {
-    perror("ide_read_sector");
-    d->taskfile.status |= ST_ERR;
-    ide_xlate_errno(&d->taskfile, len);
-    return -1;
+  if (io->result != 512) {
+    errno = io->err;
+    if (io->result == -1)
+      perror("ide_read_sector");
+    ide_xlate_errno(&d->taskfile, io->result);
+    ide_set_error(d);
+    return;
   }
 //  hexdump(d->data);
   d->offset += 512;
-  return 0;
+  d->taskfile.status |= ST_DRQ;
 }
 
-static int ide_write_sector(struct ide_drive *d)
+static void ide_read_sector(struct ide_drive *d)
 {
-  int len;
+  struct hostio_req *io = &d->io;
+
+  io->op = HOSTIO_READ;
+  io->fd = d->fd;
+  io->offset = lseek(d->fd, 512, SEEK_CUR) - 512;
+  io->buf = d->data;
+  io->len = 512;
+  io->done = ide_read_done;
+  io->ctx = d;
+  d->taskfile.status &= ~ST_DRQ;
+  d->taskfile.status |= ST_BSY;
+  hostio_submit(io);
+}
+
+static void ide_write_done(struct hostio_req *io)
+{
+  struct ide_drive *d = io->ctx;
 
+  d->taskfile.status &= ~ST_BSY;
   d->dptr = d->data;
-  if ((len = write(d->fd, d->data, 512)) != 512) {
-    d->taskfile.status |= ST_ERR;
-    ide_xlate_errno(&d->taskfile, len);
-    return -1;
+  if (io->result != 512) {
+    errno = io->err;
+    ide_xlate_errno(&d->taskfile, io->result);
+    ide_set_error(d);
+    return;
   }
 //  hexdump(d->data);
   d->offset += 512;
-  return 0;
+  d->length--;
+  d->intrq = 1;
+  if (d->length == 0) {
+    d->state = IDE_IDLE;
+    completed(&d->taskfile);
+  } else
+    d->taskfile.status |= ST_DRQ;
+}
+
+static void ide_write_sector(struct ide_drive *d)
+{
+  struct hostio_req *io = &d->io;
+
+  io->op = HOSTIO_WRITE;
+  io->fd = d->fd;
+  io->offset = lseek(d->fd, 512, SEEK_CUR) - 512;
+  io->buf = d->data;
+  io->len = 512;
+  io->done = ide_write_done;
+  io->ctx = d;
+  d->taskfile.status &= ~ST_DRQ;
+  d->taskfile.status |= ST_BSY;
+  hostio_submit(io);
+}
+
+/* The host has taken the whole buffer, go on with the next sector */
+static void ide_data_in_sector(struct ide_drive *d)
+{
+  d->length--;
+  d->intrq = 1;		/* we don't yet emulate multimode */
+  if (d->length == 0) {
+    d->state = IDE_IDLE;
+    completed(&d->taskfile);
+  } else
+    ide_read_sector(d);
 }
 
 static uint16_t ide_data_in(struct ide_drive *d, int len)
 {
   uint16_t v;
-  if (d->state == IDE_DATA_IN) {
-    if (d->dptr == d->data + 512) {
-      if (ide_read_sector(d) < 0) {
-        ide_set_error(d);	/* Set the LBA or CHS etc */
-        return 0xFFFF;		/* and error bits set by read_sector */
-      }
-    }
+  if (d->state == IDE_DATA_IN && !(d->taskfile.status & ST_BSY)) {
     v = *d->dptr;
     if (!d->eightbit) {
       if (len == 2)
@@ -484,15 +559,11 @@ static uint16_t ide_data_in(struct ide_drive *d, int len)
     } else
       d->dptr++;
     d->taskfile.data = v;
-    if (d->dptr == d->data + 512) {
-      d->length--;
-      d->intrq = 1;		/* we don't yet emulate multimode */
-      if (d->length == 0) {
-        d->state = IDE_IDLE;
-        completed(&d->taskfile);
-      }
-    }
-  } else
+    if (d->dptr == d->data + 512)
+      ide_data_in_sector(d);
+  } else if (d->state == IDE_DATA_IN)
+    ide_fault(d, "data read while busy");
+  else
     ide_fault(d, "bad data read");
 
   if (len == 1)
@@ -505,6 +576,9 @@ static void ide_data_out(struct ide_drive *d, uint16_t v, int len)
   if (d->state != IDE_DATA_OUT) {
     ide_fault(d, "bad data write");
     d->taskfile.data = v;
+  } else if (d->taskfile.status & ST_BSY) {
+    ide_fault(d, "data write while busy");
+    d->taskfile.data = v;
   } else {
     if (d->eightbit)
       v &= 0xFF;
@@ -514,18 +588,8 @@ static void ide_data_out(struct ide_drive *d, uint16_t v, int len)
       *d->dptr++ = v >> 8;
       d->taskfile.data = v >> 8;
     }
-    if (d->dptr == d->data + 512) {
-      if (ide_write_sector(d) < 0) {
-        ide_set_error(d);
-        return;	
-      }
-      d->length--;
-      d->intrq = 1;
-      if (d->length == 0) {
-        d->state = IDE_IDLE;
-        completed(&d->taskfile);
-      }
-    }
+    if (d->dptr == d->data + 512)
+      ide_write_sector(d);
   }
 }
 
@@ -535,6 +599,8 @@ static void ide_issue_command(struct ide_taskfile *t)
   t->status |= ST_BSY;
   t->error = 0;
   t->drive->state = IDE_CMD;
+  if (ide_command_hook)
+    ide_command_hook(t->command);
   
   /* We could complete with delays but don't do so yet */
   switch(t->command) {
@@ -695,6 +761,57 @@ void ide_write16(struct ide_controller *c, uint8_t r, uint16_t v)
     ide_write8(c, r, v);
 }
 
+/*
+ *	Block access to the data register for 16bit interfaces. The buffer
+ *	holds the words low byte first, as they are in the sector. Only whole
+ *	words are moved and the return is the number of bytes done, 0 when
+ *	the caller must fall back to ide_read16/ide_write16 (wrong state,
+ *	8bit mode or busy with the host side of a sector).
+ */
+int ide_read_block(struct ide_controller *c, uint8_t *buf, int len)
+{
+  struct ide_drive *d = &c->drive[c->selected];
+  int done = 0;
+  int n;
+
+  len &= ~1;
+  while (done < len && d->state == IDE_DATA_IN && !d->eightbit &&
+         !(d->taskfile.status & ST_BSY)) {
+    n = d->data + 512 - d->dptr;
+    if (n > len - done)
+      n = len - done;
+    memcpy(buf + done, d->dptr, n);
+    d->dptr += n;
+    done += n;
+    d->taskfile.data = d->dptr[-2] | (d->dptr[-1] << 8);
+    if (d->dptr == d->data + 512)
+      ide_data_in_sector(d);
+  }
+  return done;
+}
+
+int ide_write_block(struct ide_controller *c, const uint8_t *buf, int len)
+{
+  struct ide_drive *d = &c->drive[c->selected];
+  int done = 0;
+  int n;
+
+  len &= ~1;
+  while (done < len && d->state == IDE_DATA_OUT && !d->eightbit &&
+         !(d->taskfile.status & ST_BSY)) {
+    n = d->data + 512 - d->dptr;
+    if (n > len - done)
+      n = len - done;
+    memcpy(d->dptr, buf + done, n);
+    d->dptr += n;
+    done += n;
+    d->taskfile.data = d->dptr[-1];
+    if (d->dptr == d->data + 512)
+      ide_write_sector(d);
+  }
+  return done;
+}
+
 /*
  *	Allocate a new IDE controller emulation
  */
@@ -752,6 +869,8 @@ int ide_attach(struct ide_controller *c, int drive, int fd)
  */
 void ide_detach(struct ide_drive *d)
 {
+  hostio_wait(&d->io);
+  hostio_overlay_drop(d->fd);
   close(d->fd);
   d->fd = -1;
   d->present = 0;
@@ -770,6 +889,52 @@ void ide_free(struct ide_controller *c)
   free(c);
 }
 
+/*
+ *	Save state. The disk image itself is not part of it, only the
+ *	controller and what the drives are in the middle of. The data
+ *	pointers are kept as offsets into their drive.
+ */
+void ide_snapshot_save(struct ide_controller *c, snapshot_t *s)
+{
+  char name[SNAPSHOT_NAMELEN];
+  int32_t dptr[2];
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    hostio_wait(&c->drive[i].io);
+    dptr[i] = c->drive[i].dptr ? (uint8_t *)c->drive[i].dptr - (uint8_t *)&c->drive[i] : -1;
+  }
+  snapshot_put(s, c->name, c, sizeof(*c));
+  snprintf(name, sizeof(name), "%sdptr", c->name);
+  snapshot_put(s, name, dptr, sizeof(dptr));
+}
+
+int ide_snapshot_load(struct ide_controller *c, snapshot_t *s)
+{
+  struct ide_controller live = *c;
+  char name[SNAPSHOT_NAMELEN];
+  int32_t dptr[2];
+  int i;
+
+  snprintf(name, sizeof(name), "%sdptr", c->name);
+  for (i = 0; i < 2; i++)
+    hostio_wait(&c->drive[i].io);
+  if (snapshot_get(s, name, dptr, sizeof(dptr)) == -1 ||
+      snapshot_get(s, live.name, c, sizeof(*c)) == -1)
+    return -1;
+  c->name = live.name;
+  for (i = 0; i < 2; i++) {
+    struct ide_drive *d = &c->drive[i];
+    d->controller = c;
+    d->taskfile.drive = d;
+    d->present = live.drive[i].present;
+    d->fd = live.drive[i].fd;
+    d->io = live.drive[i].io;
+    d->dptr = dptr[i] >= 0 ? (uint8_t *)d + dptr[i] : NULL;
+  }
+  return 0;
+}
+
 /*
  *	Emulation interface for an 8bit controller using latches on the
  *	data register
@@ -822,15 +987,109 @@ static void make_serial(uint16_t *p)
   make_ascii(p, buf, 20);
 }
 
-int ide_make_drive(uint8_t type, int fd)
+/*
+ *	Pick a geometry for an LBA drive of the given size the way BIOSes
+ *	do: 16 heads, 63 sectors, and as many cylinders as fit (at most
+ *	16383). Small drives get fewer heads and sectors so they are not
+ *	rounded down to nothing.
+ */
+void ide_lba_geometry(uint32_t sectors, uint16_t *c, uint8_t *h, uint8_t *s)
+{
+  uint32_t cyl;
+
+  if (sectors >= 16 * 63) {
+    *h = 16;
+    *s = 63;
+  } else if (sectors >= 4 * 16) {
+    *h = 4;
+    *s = 16;
+  } else {
+    *h = 1;
+    *s = 1;
+  }
+  cyl = sectors / (*h * *s);
+  if (cyl > 16383)
+    cyl = 16383;
+  if (cyl == 0)
+    cyl = 1;
+  *c = cyl;
+}
+
+/*
+ *	Write the data area from sector 'from' up to (excluding) sector 'to'.
+ *	Without flags every sector is filled with 0xE5 so CP/M sees an empty
+ *	directory. IDE_MAKE_SPARSE just sets the file size and IDE_MAKE_PREALLOC
+ *	reserves the blocks; either way the area reads back as zeros and has
+ *	to be formatted from the guest.
+ */
+int ide_fill_drive(int fd, uint32_t from, uint32_t to, int flags)
+{
+  off_t start = 1024 + (off_t)from * 512;
+  off_t end = 1024 + (off_t)to * 512;
+  uint8_t buf[32768];
+  int r;
+
+  if (flags & IDE_MAKE_NODATA)
+    return 0;
+  if (flags & IDE_MAKE_PREALLOC) {
+    r = posix_fallocate(fd, start, end - start);
+    if (r) {
+      errno = r;
+      return -1;
+    }
+    return 0;
+  }
+  if (flags & IDE_MAKE_SPARSE)
+    return ftruncate(fd, end);
+
+  memset(buf, 0xE5, sizeof(buf));
+  if (lseek(fd, start, SEEK_SET) == -1)
+    return -1;
+  while (start < end) {
+    int len = sizeof(buf);
+    if (end - start < len)
+      len = end - start;
+    if (write(fd, buf, len) != len)
+      return -1;
+    start += len;
+  }
+  return 0;
+}
+
+static void ide_set_capacity(uint16_t *ident, uint16_t c, uint8_t h, uint8_t s, uint32_t lba)
+{
+  uint32_t sectors = c * h * s;
+
+  ident[1] = le16(c);
+  ident[3] = le16(h);
+  ident[6] = le16(s);
+  ident[54] = ident[1];
+  ident[55] = ident[3];
+  ident[56] = ident[6];
+  ident[57] = le16(sectors & 0xFFFF);
+  ident[58] = le16(sectors >> 16);
+  if (lba < sectors)
+    lba = sectors;
+  ident[60] = le16(lba & 0xFFFF);
+  ident[61] = le16(lba >> 16);
+}
+
+/*
+ *	Create a drive. For ACME_CUSTOM the geometry comes from c/h/s and
+ *	the drive is LBA capable, lba may then give a capacity beyond what
+ *	CHS can address. The other types use their fixed geometry.
+ */
+int ide_make_drive_ext(uint8_t type, uint16_t c, uint8_t h, uint8_t s,
+                       uint32_t lba, int flags, int fd)
 {
-  uint8_t s, h;
-  uint16_t c;
-  uint32_t sectors;
   uint16_t ident[256];
 
-  if (type < 1 || type > MAX_DRIVE_TYPE)
+  if (type > MAX_DRIVE_TYPE)
     return -2;
+  if (type == ACME_CUSTOM && (c == 0 || h == 0 || h > 16 || s == 0))
+    return -2;
+  if (type != ACME_CUSTOM)
+    lba = 0;
   
   memset(ident, 0, 512);
   memcpy(ident, ide_magic, 8);
@@ -845,6 +1104,12 @@ int ide_make_drive(uint8_t type, int fd)
   ident[53] = le16(1);		/* Geometry words are valid */
   
   switch(type) {
+    case ACME_CUSTOM:
+      /* Whatever the user asked for, with LBA support */
+      ident[49] = le16(1 << 9); /* LBA */
+      make_ascii(ident + 23, "A001.001", 8);
+      make_ascii(ident + 27, "ACME WILE E. CUSTOM v0.1", 40);
+      break;
     case ACME_ROADRUNNER:
       /* 504MB drive with LBA support */
       c = 1024;
@@ -881,23 +1146,62 @@ int ide_make_drive(uint8_t type, int fd)
       make_ascii(ident + 27, "ACME COYOTE v0.1", 40);
       break;
   }
-  ident[1] = le16(c);
-  ident[3] = le16(h);
-  ident[6] = le16(s);
-  ident[54] = ident[1];
-  ident[55] = ident[3];
-  ident[56] = ident[6];
-  sectors = c * h * s;
-  ident[57] = le16(sectors & 0xFFFF);
-  ident[58] = le16(sectors >> 16);
-  ident[60] = ident[57];
-  ident[61] = ident[58];
+  ide_set_capacity(ident, c, h, s, lba);
   if (write(fd, ident, 512) != 512)
     return -1;
   
-  memset(ident, 0xE5, 512);
-  while(sectors--)
-    if (write(fd, ident, 512) != 512)
-      return -1;  
-  return 0;
+  return ide_fill_drive(fd, 0, ide_drive_capacity(ident), flags);
+}
+
+int ide_make_drive(uint8_t type, int fd)
+{
+  if (type < 1)
+    return -2;
+  return ide_make_drive_ext(type, 0, 0, 0, 0, 0, fd);
+}
+
+/*
+ *	Number of sectors of a drive, from its identify block
+ */
+uint32_t ide_drive_capacity(const uint16_t *ident)
+{
+  uint32_t chs = le16(ident[1]) * le16(ident[3]) * le16(ident[6]);
+  uint32_t lba = le16(ident[60]) | (le16(ident[61]) << 16);
+
+  if ((ident[49] & le16(1 << 9)) && lba > chs)
+    return lba;
+  return chs;
+}
+
+/*
+ *	Grow an existing drive image in place to the given number of
+ *	cylinders (and for LBA drives optionally lba sectors). Heads and
+ *	sectors per track stay as they are so existing data keeps its place,
+ *	h and s are 0 or what the drive has, else -3.
+ */
+int ide_grow_drive(int fd, uint16_t c, uint8_t h, uint8_t s, uint32_t lba, int flags)
+{
+  uint8_t magic[512];
+  uint16_t ident[256];
+  uint32_t old;
+
+  if (pread(fd, magic, 512, 0) != 512 || pread(fd, ident, 512, 512) != 512)
+    return -1;
+  if (memcmp(magic, ide_magic, 8))
+    return -2;
+  old = ide_drive_capacity(ident);
+  if (c == 0)
+    c = le16(ident[1]);
+  if (!(ident[49] & le16(1 << 9)))
+    lba = 0;
+  if (c < le16(ident[1]))
+    return -2;
+  if ((h && h != le16(ident[3])) || (s && s != le16(ident[6])))
+    return -3;
+  ide_set_capacity(ident, c, le16(ident[3]), le16(ident[6]), lba);
+  if (ide_drive_capacity(ident) < old)
+    return -2;
+  if (pwrite(fd, ident, 512, 512) != 512)
+    return -1;
+  return ide_fill_drive(fd, old, ide_drive_capacity(ident), flags);
 }
@@ -1,5 +1,8 @@
 #include <stdint.h>
+#include "../hostio/hostio.h"
+#include "../snapshot/snapshot.h"
 
+#define ACME_CUSTOM		0	/* LBA capable drive, geometry given at creation */
 #define ACME_ROADRUNNER		1	/* 504MB classic IDE drive */
 #define ACME_COYOTE		2	/* 20MB early IDE drive */
 #define ACME_NEMESIS		3	/* 20MB LBA capable drive */
@@ -7,6 +10,11 @@
 
 #define MAX_DRIVE_TYPE		4
 
+/* flags for ide_make_drive_ext and ide_grow_drive */
+#define IDE_MAKE_SPARSE		1	/* data area is a hole, reads as zeros */
+#define IDE_MAKE_PREALLOC	2	/* data area is allocated, reads as zeros */
+#define IDE_MAKE_NODATA		4	/* caller writes the data area */
+
 #define		ide_data	0
 #define		ide_error_r	1
 #define		ide_feature_w	1
@@ -53,6 +61,7 @@ struct ide_drive {
   int fd;
   off_t offset;
   int length;
+  struct hostio_req io;
 };
 
 struct ide_controller {
@@ -63,12 +72,17 @@ struct ide_controller {
 };
 
 extern const uint8_t ide_magic[8];
+/* called with every command issued to a drive, for the profiler */
+extern void (*ide_command_hook)(uint8_t command);
 
 void ide_reset_begin(struct ide_controller *c);
+void ide_reset_drive(struct ide_controller *c, int drive);
 uint8_t ide_read8(struct ide_controller *c, uint8_t r);
 void ide_write8(struct ide_controller *c, uint8_t r, uint8_t v);
 uint16_t ide_read16(struct ide_controller *c, uint8_t r);
 void ide_write16(struct ide_controller *c, uint8_t r, uint16_t v);
+int ide_read_block(struct ide_controller *c, uint8_t *buf, int len);
+int ide_write_block(struct ide_controller *c, const uint8_t *buf, int len);
 uint8_t ide_read_latched(struct ide_controller *c, uint8_t r);
 void ide_write_latched(struct ide_controller *c, uint8_t r, uint8_t v);
 
@@ -76,5 +90,13 @@ struct ide_controller *ide_allocate(const char *name);
 int ide_attach(struct ide_controller *c, int drive, int fd);
 void ide_detach(struct ide_drive *d);
 void ide_free(struct ide_controller *c);
+void ide_snapshot_save(struct ide_controller *c, snapshot_t *s);
+int ide_snapshot_load(struct ide_controller *c, snapshot_t *s);
 
 int ide_make_drive(uint8_t type, int fd);
+int ide_make_drive_ext(uint8_t type, uint16_t c, uint8_t h, uint8_t s,
+                       uint32_t lba, int flags, int fd);
+int ide_grow_drive(int fd, uint16_t c, uint8_t h, uint8_t s, uint32_t lba, int flags);
+int ide_fill_drive(int fd, uint32_t from, uint32_t to, int flags);
+uint32_t ide_drive_capacity(const uint16_t *ident);
+void ide_lba_geometry(uint32_t sectors, uint16_t *c, uint8_t *h, uint8_t *s);
@@ -1,29 +1,209 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "ide.h"
 
-int main(int argc, const char *argv[])
+static const char *prg;
+
+static void usage(void)
+{
+  fprintf(stderr, "%s [-s|-p] [type] [path]\n", prg);
+  fprintf(stderr, "%s [-s|-p] -g c/h/s [-l sectors] [path]\n", prg);
+  fprintf(stderr, "%s [-s|-p] -G [-g cylinders] [-l sectors] [path]\n", prg);
+  fprintf(stderr, "%s [-s|-p] [-g c/h/s] [-l sectors] -i raw [type] [path]\n", prg);
+  fprintf(stderr, "%s -e raw [path]\n", prg);
+  fprintf(stderr, "  type         ACME drive type 1-4 of fixed size, default is a custom LBA drive\n");
+  fprintf(stderr, "  -s           sparse image, unwritten sectors read as 0 instead of E5\n");
+  fprintf(stderr, "  -p           like -s, but allocate the space on the host now\n");
+  fprintf(stderr, "  -g c/h/s     custom geometry, with -G only the cylinder count\n");
+  fprintf(stderr, "  -l sectors   LBA capacity, beyond what the geometry can address\n");
+  fprintf(stderr, "  -G           grow an existing image in place\n");
+  fprintf(stderr, "  -i raw       create the image from a raw image (.dsk, sdcard.img)\n");
+  fprintf(stderr, "  -e raw       write the data area of the image as a raw image\n");
+  exit(1);
+}
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+static int is_zero(const uint8_t *buf, int len)
+{
+  while (len--)
+    if (*buf++)
+      return 0;
+  return 1;
+}
+
+/*
+ *	Copy len bytes, leaving holes for all zero chunks if the target
+ *	already reads as zero there.
+ */
+static void copy_data(int in, off_t from, int out, off_t to, off_t len, int holes)
+{
+  uint8_t buf[65536];
+
+  while (len > 0) {
+    int n = sizeof(buf);
+    if (len < n)
+      n = len;
+    memset(buf, 0, n);
+    if (pread(in, buf, n, from) < 0)
+      fail("read");
+    if (!holes || !is_zero(buf, n))
+      if (pwrite(out, buf, n, to) != n)
+        fail("write");
+    from += n;
+    to += n;
+    len -= n;
+  }
+}
+
+int main(int argc, char *argv[])
 {
-  int t, fd;
-  if (argc != 3) {
-    fprintf(stderr, "%s [type] [path]\n", argv[0]);
-    exit(1);
-  }
-  t = atoi(argv[1]);
-  if (t < 1 || t > MAX_DRIVE_TYPE) {
-    fprintf(stderr, "%s: unknown drive type.\n", argv[0]);
-    exit(1);
-  }
-  fd = open(argv[2], O_WRONLY|O_TRUNC|O_CREAT|O_EXCL, 0666);
-  if (fd == -1) {
-    perror(argv[2]);
-    exit(1);
-  }
-  if (ide_make_drive(t, fd) < 0) {
-    perror(argv[2]);
-    exit(1);
+  int t = ACME_CUSTOM, fd, in, opt, r;
+  int flags = 0, grow = 0, tail;
+  unsigned int c = 0, h = 0, s = 0;
+  unsigned long lba = 0;
+  const char *import = NULL, *export = NULL, *path;
+  uint16_t ident[256];
+  struct stat st;
+
+  prg = argv[0];
+  while ((opt = getopt(argc, argv, "spg:l:Gi:e:")) != -1) {
+    switch (opt) {
+      case 's':
+        flags |= IDE_MAKE_SPARSE;
+        break;
+      case 'p':
+        flags |= IDE_MAKE_PREALLOC;
+        break;
+      case 'g':
+        if (sscanf(optarg, "%u/%u/%u", &c, &h, &s) < 1)
+          usage();
+        break;
+      case 'l':
+        lba = strtoul(optarg, NULL, 0);
+        break;
+      case 'G':
+        grow = 1;
+        break;
+      case 'i':
+        import = optarg;
+        break;
+      case 'e':
+        export = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind == argc - 2) {
+    t = atoi(argv[optind++]);
+    if (t < 1 || t > MAX_DRIVE_TYPE) {
+      fprintf(stderr, "%s: unknown drive type.\n", prg);
+      exit(1);
+    }
+    if (c || lba) {
+      fprintf(stderr, "%s: drive type %d has a fixed size, -g and -l are for custom drives.\n", prg, t);
+      exit(1);
+    }
+  }
+  if (optind != argc - 1)
+    usage();
+  path = argv[optind];
+
+  if (export) {
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+      fail(path);
+    if (pread(fd, ident, 512, 0) != 512 || memcmp(ident, ide_magic, 8)) {
+      fprintf(stderr, "%s: not an IDE image.\n", path);
+      exit(1);
+    }
+    if (pread(fd, ident, 512, 512) != 512)
+      fail(path);
+    in = fd;
+    fd = open(export, O_WRONLY|O_TRUNC|O_CREAT|O_EXCL, 0666);
+    if (fd == -1)
+      fail(export);
+    copy_data(in, 1024, fd, 0, (off_t)ide_drive_capacity(ident) * 512, 1);
+    if (ftruncate(fd, (off_t)ide_drive_capacity(ident) * 512) == -1)
+      fail(export);
+    return 0;
+  }
+
+  if (grow) {
+    if (c > 65535 || h > 16 || s > 255) {
+      fprintf(stderr, "%s: bad geometry.\n", prg);
+      exit(1);
+    }
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+      fail(path);
+    r = ide_grow_drive(fd, c, h, s, lba, flags);
+    if (r == -2) {
+      fprintf(stderr, "%s: not an IDE image or it would shrink.\n", path);
+      exit(1);
+    }
+    if (r == -3) {
+      fprintf(stderr, "%s: -G keeps the heads and sectors per track, only the cylinders can grow.\n", path);
+      exit(1);
+    }
+    if (r < 0)
+      fail(path);
+    return 0;
+  }
+
+  in = -1;
+  if (import) {
+    in = open(import, O_RDONLY);
+    if (in == -1 || fstat(in, &st) == -1)
+      fail(import);
+    /* no size given: just big enough for the raw image */
+    if (t == ACME_CUSTOM && c == 0 && lba == 0)
+      lba = (st.st_size + 511) / 512;
+  }
+  if (t == ACME_CUSTOM) {
+    uint16_t lc;
+    uint8_t lh, ls;
+    if (c == 0 && lba == 0)
+      usage();
+    if (c == 0) {
+      ide_lba_geometry(lba, &lc, &lh, &ls);
+      c = lc;
+      h = lh;
+      s = ls;
+    }
+    if (c > 65535 || h < 1 || h > 16 || s < 1 || s > 255) {
+      fprintf(stderr, "%s: bad geometry.\n", prg);
+      exit(1);
+    }
+  }
+
+  fd = open(path, O_RDWR|O_TRUNC|O_CREAT|O_EXCL, 0666);
+  if (fd == -1)
+    fail(path);
+  /* E5 only past the imported data, the copy writes the rest */
+  tail = in != -1 && !(flags & (IDE_MAKE_SPARSE|IDE_MAKE_PREALLOC));
+  if (ide_make_drive_ext(t, c, h, s, lba, tail ? flags | IDE_MAKE_NODATA : flags, fd) < 0)
+    fail(path);
+  if (in != -1) {
+    if (pread(fd, ident, 512, 512) != 512)
+      fail(path);
+    if ((off_t)ide_drive_capacity(ident) * 512 < st.st_size) {
+      fprintf(stderr, "%s: %s does not fit.\n", prg, import);
+      unlink(path);
+      exit(1);
+    }
+    if (tail && ide_fill_drive(fd, st.st_size / 512, ide_drive_capacity(ident), flags) < 0)
+      fail(path);
+    copy_data(in, 0, fd, 1024, st.st_size, flags & (IDE_MAKE_SPARSE|IDE_MAKE_PREALLOC));
   }
   return 0;
 }
@@ -900,3 +900,22 @@ void pc16552_device_w( struct pc16552_device *d, offs_t offset, uint8_t data )
 {
 	ins8250_device_w((offset & 8) ? d->m_chan1 : d->m_chan0, offset & 7, data);
 }
+
+void ins8250_snapshot_save(struct ins8250_device *d, const char *name, snapshot_t *s)
+{
+	snapshot_put(s, name, d, sizeof(*d));
+}
+
+int ins8250_snapshot_load(struct ins8250_device *d, const char *name, snapshot_t *s)
+{
+	struct ins8250_device live = *d;
+
+	if (snapshot_get(s, name, d, sizeof(*d)) == -1)
+		return -1;
+	d->m_tag = live.m_tag;
+	d->m_owner = live.m_owner;
+	d->tx_callback = live.tx_callback;
+	d->rx_callback = live.rx_callback;
+	d->m_out_int_cb = live.m_out_int_cb;
+	return 0;
+}
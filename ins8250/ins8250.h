@@ -19,6 +19,7 @@ extern void dbg_log(const char *fmt, ...);
 
 //#include "diserial.h"
 #include <stdint.h>
+#include "../snapshot/snapshot.h"
 typedef void device_t;
 typedef uint32_t offs_t;
 typedef uint16_t emu_timer;
@@ -231,6 +232,9 @@ void   pc16552_device_w(struct pc16552_device *d, offs_t offset, uint8_t data );
 void ins8250_device_reset(struct ins8250_device *d);
 void ins8250_device_timer(struct ins8250_device *d);
 
+void ins8250_snapshot_save(struct ins8250_device *d, const char *name, snapshot_t *s);
+int ins8250_snapshot_load(struct ins8250_device *d, const char *name, snapshot_t *s);
+
 /*DECLARE_DEVICE_TYPE(PC16552D, pc16552_device)
 DECLARE_DEVICE_TYPE(INS8250,  ins8250_device)
 DECLARE_DEVICE_TYPE(NS16450,  ns16450_device)
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/time.h>
@@ -39,25 +40,34 @@
 #define fileno _fileno
 #else
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "z180/z180.h"
 #include "ide/ide.h"
+#include "hostio/hostio.h"
+#include "media/media.h"
+#include "clone/clone.h"
+#include "record/record.h"
+#include "tools/tools.h"
+#include "profile/cpm.h"
+#include "profile/symbols.h"
 #include "ds1202_1302/ds1202_1302.h"
+#include "ds1202_1302/rtc.h"
 #define DBG_MAIN
 #include "dbg/dbg.h"
 
 int VERBOSE = 0;
 
 // so far only 512k EEPROM+512k RAM is supported
-UINT8 _ram[1048576]; // lo 512k is ROM
+UINT8 _ram[1048576] SNAPSHOT_ALIGNED; // lo 512k is ROM
 
 #define RAMARRAY _ram
 #define ROMARRAY NULL
 
 struct ide_controller *ic0;
-FILE* if00;
-int ifd00;
+int ifd00=-1; // the drive owns and closes it once attached
 struct ide_drive *id00;
 
 uint8_t idemap[16] = {ide_data,ide_error_r,ide_sec_count,ide_sec_num,ide_cyl_low,ide_cyl_hi,ide_dev_head,ide_status_r,
@@ -66,6 +76,8 @@ uint8_t idemap[16] = {ide_data,ide_error_r,ide_sec_count,ide_sec_num,ide_cyl_low
 unsigned int asci_clock = 16;
 
 rtc_ds1202_1302_t *rtc;
+/* the cycles the RTC and the clones were ticked up to */
+uint64_t ticked;
 
 UINT8 xmem_bank;
 
@@ -80,6 +92,7 @@ void ram_write(offs_t A,UINT8 V) {
 }
 
 int char_available() {
+	if (clone_active()) return clone_console_available();
 #ifdef SOCKETCONSOLE
 	  return char_available_socket_port(0);
 #else
@@ -88,8 +101,11 @@ int char_available() {
 }
 
 void asci_tx(device_t *device, int channel, UINT8 Value) {
+	if (dbg_rewinding()) return; // shown the first time round
 	if (channel==0) {
 	  //printf("TX: %c", Value);
+	  if (clone_active()) clone_console_tx(Value);
+	  else
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(0, Value);
 #else
@@ -103,14 +119,16 @@ int asci_rx(device_t *device, int channel) {
 	int ioData;
 	if (channel==0) {
 	  //ioData = 0xFF;
+	  if (record_replaying()) return record_replay_rx(0);
 	  if(char_available()) {
+	    if (clone_active()) return clone_console_rx();
 #ifdef SOCKETCONSOLE
 	  ioData = rx_socket_port(0);
 #else
 	    //printf("RX\n");
         ioData = getch();
 #endif
-		return ioData;
+		return record_rx(0, ioData);
 	  }
 	}
 	return -1;
@@ -215,24 +233,51 @@ int boot1dma (const char *romfile) {
 }
 
 void io_device_update() {
+    // run completions of disk image I/O done in the background
+    hostio_poll();
+    // eject and insert disk images on SIGUSR1, on replay when the recording did
+    record_poll();
+    tools_poll();
+    if (!record_replaying()) media_poll();
 #ifdef SOCKETCONSOLE
-    // check socket open and optionally reopen it
+    // check socket open and optionally reopen it, clones have no sockets
+    if (clone_active()) return;
     if (!is_connected_socket_port(0)) open_socket_port(0);
 #endif
 }
 
+int media_ide0(const char *path) {
+   if (ic0->drive[0].present)
+     ide_detach(&ic0->drive[0]);
+   ifd00=-1;
+   if (path) {
+     if ((ifd00=open(path,O_RDWR)) == -1) return -1;
+     if (ide_attach(ic0,0,ifd00) == -1) {
+       close(ifd00);
+       ifd00=-1;
+     } else if (clone_self() != -1 && hostio_overlay(ifd00,NULL,clone_file("cf0")) == -1) {
+       // a clone must not write to the image the others have
+       ide_detach(&ic0->drive[0]);
+       ifd00=-1;
+     }
+   }
+   ide_reset_drive(ic0,0);
+   return (!path || ifd00 != -1) ? 0 : -1;
+}
+
 void CloseIDE() {
    ide_free(ic0);
 }
 
 void InitIDE() {
    ic0=ide_allocate("IDE0");
-   if (if00=fopen("cf00.dsk","r+b")) {
-     ifd00=fileno(if00);
-     ide_attach(ic0,0,ifd00);
+   if ((ifd00=open("cf00.dsk",O_RDWR)) != -1 && ide_attach(ic0,0,ifd00) == -1) {
+     close(ifd00);
+     ifd00=-1;
    }
    ide_reset_begin(ic0);
    atexit(CloseIDE);
+   media_register("cf0",media_ide0,ic0->drive[0].present?"cf00.dsk":NULL);
 }
 
 struct address_space ram = {ram_read,ram_write,ram_read};
@@ -244,12 +289,89 @@ void destroy_rtc()
 	ds1202_1302_destroy(rtc,1);
 }
 
+struct board_state {
+	UINT8 xmem_bank, rtc_latch;
+	unsigned int asci_clock;
+};
+
+snapshot_t *machine_snapshot() {
+	struct board_state b = {xmem_bank,rtc_latch,asci_clock};
+	snapshot_t *s = snapshot_create("markiv");
+	snapshot_put(s,"board",&b,sizeof(b));
+	snapshot_put_pages(s,"ram",_ram,sizeof(_ram));
+	z180_snapshot_save(cpu,s);
+	ide_snapshot_save(ic0,s);
+	ds1202_1302_write_snapshot(rtc,s);
+	return s;
+}
+
+int machine_save(const char *file) {
+	snapshot_t *s = machine_snapshot();
+	return s ? snapshot_write(s,file) : -1;
+}
+
+void machine_clone(int n) {
+	if (ic0->drive[0].present && hostio_overlay(ic0->drive[0].fd,media_path("cf0"),clone_file("cf0")) == -1) {
+		perror(clone_file("cf0"));
+		exit(2);
+	}
+	ds1202_1302_private(rtc);
+	tools_clone();
+}
+
+int machine_restore(snapshot_t *s) {
+	struct board_state b;
+	snapshot_t *ref = machine_snapshot();
+	int r = snapshot_match(s,ref);
+	snapshot_close(ref);
+	// all parts are checked first, so that a bad snapshot is not loaded half
+	if (r == -1) {
+		printf("snapshot: %s\r\n",snapshot_error(s));
+		return -1;
+	}
+	if (snapshot_get(s,"board",&b,sizeof(b)) != -1 &&
+		snapshot_map(s,"ram",_ram,sizeof(_ram)) != -1 &&
+		z180_snapshot_load(cpu,s) != -1 &&
+		ide_snapshot_load(ic0,s) != -1 &&
+		ds1202_1302_read_snapshot(rtc,s) != -1) {
+		xmem_bank = b.xmem_bank;
+		rtc_latch = b.rtc_latch;
+		asci_clock = b.asci_clock;
+		ticked = z180_get_cycles(cpu);
+		return 0;
+	}
+	return -1;
+}
+
+int machine_load(const char *file) {
+	int r;
+	snapshot_t *s = snapshot_open(file,"markiv");
+	if (!s) return -1;
+	r = machine_restore(s);
+	snapshot_close(s);
+	return r;
+}
+
 void help(const char *prg) {
-	printf("%s [-h|-?] [-v] [-d] [-r romfile]", prg);
+	printf("%s [-h|-?] [-v] [-d] [-a] [-c count] [-e marker] [-l logfile] [-m ctlfile] [-n nvfile] [-p logfile] [-r romfile] [-s snapfile] [-t epoch] [-w marker] [-x count] [-y mapfile] [tool options]", prg);
 	printf("  -h|-?      display this help\n");
 	printf("  -v         start emulator in verbose mode\n");
 	printf("  -d         start emulator in debugger mode\n");
+	printf("  -a         do disk image I/O in background threads\n");
+	printf("  -c count   boot once, then run count clones of the machine (see clone/clone.c)\n");
+	printf("  -e marker  a clone exits when its console shows marker, or after #cycles,\n");
+	printf("             needed with -c\n");
+	printf("  -l logfile record the inputs of this run to logfile (see record/record.c)\n");
+	printf("  -m ctlfile swap disk images by commands in ctlfile on SIGUSR1\n");
+	printf("  -n nvfile  start the RTC NVRAM from a copy of nvfile, changes are not kept\n");
+	printf("  -p logfile replay the inputs recorded in logfile, from the same start\n");
 	printf("  -r romfile start emulator with another rom file\n");
+	printf("  -s snapfile start emulator from a saved machine state\n");
+	printf("  -t epoch   run the RTC on emulated time from epoch (seconds since 1970)\n");
+	printf("  -w marker  start the clones when the console shows marker, or after #cycles\n");
+	printf("  -x count   keep the last count instructions run for H in the debugger, default 4096\n");
+	printf("  -y mapfile name the code in the profile with the symbols of mapfile\n");
+	tools_help();
 }
 
 int main(int argc, char** argv)
@@ -258,8 +380,18 @@ int main(int argc, char** argv)
 
 	int opt;
 	int debugger = 0;
+	int asyncio = 0;
+	int rtcsource = RTC_TIME_CACHED;
+	time_t epoch = 0;
+	const char *nvtemplate = NULL;
 	const char *romfile = "markivrom.bin";
-	while ((opt = getopt(argc, argv, "h?vdr:")) != -1) {
+	const char *snapfile = NULL;
+	int clones = 0;
+	const char *startmarker = NULL, *endmarker = NULL;
+	int recmode = RECORD_OFF;
+	const char *recfile = NULL;
+	int history = 4096;
+	while ((opt = getopt(argc, argv, tools_options("h?vdac:e:l:m:n:p:r:s:t:w:x:y:"))) != -1) {
 		switch (opt) {
 			case 'h': case '?':
 				help(argv[0]);
@@ -270,19 +402,66 @@ int main(int argc, char** argv)
 			case 'd':
 				debugger = 1;
 				break;
+			case 'a':
+				asyncio = 1;
+				break;
+			case 'c':
+				clones = atoi(optarg);
+				break;
+			case 'e':
+				endmarker = optarg;
+				break;
+			case 'l':
+				recmode = RECORD_WRITE;
+				recfile = optarg;
+				break;
+			case 'm':
+				media_init(optarg);
+				break;
+			case 'n':
+				nvtemplate = optarg;
+				break;
+			case 'p':
+				recmode = RECORD_REPLAY;
+				recfile = optarg;
+				break;
 			case 'r':
 				romfile = optarg;
 				break;
+			case 's':
+				snapfile = optarg;
+				break;
+			case 't':
+				rtcsource = RTC_TIME_VIRTUAL;
+				epoch = (time_t)strtoll(optarg, NULL, 0);
+				break;
+			case 'w':
+				startmarker = optarg;
+				break;
+			case 'x':
+				history = atoi(optarg);
+				break;
+			case 'y':
+				if (symbols_load(optarg) == -1) {
+					printf("could not read %s\n", optarg);
+					exit(1);
+				}
+				break;
 			default:
+				if (tools_option(opt, optarg)) break;
 				printf("invalid option.\n");
 				help(argv[0]);
 				exit(1);
 		}
 	}
+	if (clones > 0 && clone_init(clones, startmarker, endmarker) == -1) {
+		printf("clones need an end marker, see -e\n");
+		exit(1);
+	}
 
 #ifdef SOCKETCONSOLE
 	init_TCPIP();
-	init_socket_port(0); // ASCI Console
+	if (!clone_active()) init_socket_port(0); // ASCI Console
 	atexit(shutdown_socket_ports);
 #endif
 	io_device_update(); // wait for serial socket connections
@@ -293,15 +472,38 @@ int main(int argc, char** argv)
 
 	if (boot1dma(romfile) == -1) exit(1);
 
+	if (asyncio && !recfile) hostio_init(2); // background I/O would finish at host speed
+	atexit(hostio_shutdown);
+
 	InitIDE();
 
-	rtc = ds1202_1302_init("RTC",1302);
+	rtc_set_time_source(rtcsource, epoch, 18432000);
+	rtc = ds1202_1302_init_mapped("RTC",1302,"markiv-rtc.bin",nvtemplate);
+	if (!rtc) {
+		printf("could not start the NVRAM from %s: %s\n", nvtemplate,
+			errno == EINVAL ? "not an NVRAM image" : strerror(errno));
+		exit(1);
+	}
 	ds1202_1302_reset(rtc);
 	atexit(destroy_rtc);
 
 	cpu = cpu_create_z180("Z180",Z180_TYPE_Z180,18432000,&ram,NULL,&iospace,irq0ackcallback,NULL/*daisychain*/,
 		asci_rx,asci_tx,NULL,NULL,NULL,NULL);
+	if (history > 0 && z180_history_size(cpu, history) == -1) {
+		printf("no memory for a history of %d instructions\n", history);
+		exit(1);
+	}
 	cpu_reset_z180(cpu);
+	if (snapfile && machine_load(snapfile) == -1) {
+		printf("could not restore %s\n", snapfile);
+		exit(1);
+	}
+	if (recfile && record_init(recmode, recfile, "markiv", cpu) == -1) {
+		printf("could not %s %s\n", recmode == RECORD_WRITE ? "record to" : "replay", recfile);
+		exit(1);
+	}
+	tools_open(cpu, "markiv");
+	ide_command_hook = cpm_ide_command;
 
 	struct timeval t0;
 	struct timeval t1;
@@ -310,9 +512,15 @@ int main(int argc, char** argv)
 
 	if (dbg_init(debugger, RAMARRAY, ROMARRAY) == -1) exit(1);
 
+	ticked = z180_get_cycles(cpu);
 	while(dbg_running()) {
 		cpu_execute_z180(cpu,10000);
+		/* slices run over and get cut short, tick what really ran */
+		uint64_t ran = z180_get_cycles(cpu) - ticked;
+		ticked += ran;
+		rtc_time_tick(ran);
 		io_device_update();
+		clone_tick(ran);
 	}
 
 	gettimeofday(&t1, 0);
@@ -0,0 +1,163 @@
+/*
+ * media.c - change disk images while the emulator runs
+ *
+ * Floppies, CF cards and SD cards can be ejected, inserted and swapped
+ * without restarting the emulator, and so without rebooting the guest.
+ * Commands come from the debugger, or from a control file that is read
+ * when the emulator gets SIGUSR1. That way a batch job can put one disk
+ * after the other into a machine that is booted only once:
+ *
+ *   echo "fd0 next.img" > media.ctl ; kill -USR1 <pid>
+ *
+ * The file is removed when its commands have run, so the job can wait
+ * for it to go away before it goes on.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+
+#include "media.h"
+
+#define MAXUNITS 8
+#define MAXPATH 256
+
+static struct media_unit {
+	char name[16];
+	media_change_fn change;
+	char path[MAXPATH];	/* empty if there is no medium */
+} units[MAXUNITS];
+static int nunits = 0;
+
+static const char *ctl = NULL;
+static volatile sig_atomic_t requested = 0;
+
+void (*media_hook)(const char *unit, const char *path) = NULL;
+
+/* the terminal may be in raw mode, so end lines with CR LF */
+static void media_msg(const char *what, const char *unit, const char *path)
+{
+	printf("media: %s %s%s%s\r\n", unit, what, path ? " " : "", path ? path : "");
+	fflush(stdout);
+}
+
+void media_register(const char *unit, media_change_fn change, const char *path)
+{
+	struct media_unit *u;
+
+	if (nunits == MAXUNITS)
+		return;
+	u = &units[nunits++];
+	strncpy(u->name, unit, sizeof(u->name) - 1);
+	u->change = change;
+	if (path)
+		strncpy(u->path, path, MAXPATH - 1);
+}
+
+const char *media_path(const char *unit)
+{
+	int i;
+
+	for (i = 0; i < nunits; i++)
+		if (!strcmp(units[i].name, unit))
+			return units[i].path[0] ? units[i].path : NULL;
+	return NULL;
+}
+
+int media_command(const char *line)
+{
+	char name[16], path[MAXPATH];
+	int i, n;
+
+	while (isspace((unsigned char)*line))
+		line++;
+	if (!*line) {
+		for (i = 0; i < nunits; i++)
+			media_msg(units[i].path[0] ? "has" : "is empty", units[i].name,
+			    units[i].path[0] ? units[i].path : NULL);
+		return 0;
+	}
+
+	for (n = 0; *line && !isspace((unsigned char)*line); line++)
+		if (n < sizeof(name) - 1)
+			name[n++] = *line;
+	name[n] = 0;
+	while (isspace((unsigned char)*line))
+		line++;
+	strncpy(path, line, MAXPATH - 1);
+	path[MAXPATH - 1] = 0;
+	for (n = strlen(path); n > 0 && isspace((unsigned char)path[n - 1]); n--)
+		path[n - 1] = 0;
+
+	for (i = 0; i < nunits; i++)
+		if (!strcmp(units[i].name, name))
+			break;
+	if (i == nunits) {
+		media_msg("no such unit", name, NULL);
+		return 0;
+	}
+
+	if (media_hook)
+		media_hook(name, path);
+	/* the board ejects first in any case */
+	units[i].path[0] = 0;
+	if (units[i].change(path[0] ? path : NULL) == -1) {
+		media_msg(path[0] ? "could not load" : "could not eject", name, path);
+		return -1;
+	}
+	if (path[0]) {
+		strcpy(units[i].path, path);
+		media_msg("now has", name, path);
+	} else
+		media_msg("ejected", name, NULL);
+	return 1;
+}
+
+static void media_signal(int sig)
+{
+	requested = 1;
+}
+
+void media_init(const char *ctlfile)
+{
+	ctl = ctlfile;
+#ifdef SIGUSR1
+	signal(SIGUSR1, media_signal);
+#endif
+}
+
+void media_poll()
+{
+	char line[MAXPATH + 32];
+	FILE *f;
+
+	if (!requested)
+		return;
+	requested = 0;
+	if (!ctl || !(f = fopen(ctl, "r"))) {
+		media_msg("control file not found", ctl ? ctl : "", NULL);
+		return;
+	}
+	while (fgets(line, sizeof(line), f))
+		if (line[0] != '#' && line[strspn(line, " \t\r\n")])
+			media_command(line);
+	fclose(f);
+	remove(ctl);
+}
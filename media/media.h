@@ -0,0 +1,43 @@
+/*
+ * media.h - change disk images while the emulator runs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef MEDIA_H
+#define MEDIA_H
+
+/* Put the image at path into the unit, or just eject with path NULL.
+ * Returns 0 on success, -1 if the unit is left empty. */
+typedef int (*media_change_fn)(const char *path);
+
+/* The board tells which units it has, and what is in them at start. */
+extern void media_register(const char *unit, media_change_fn change, const char *path);
+/* what is in the unit now, NULL if it is empty */
+extern const char *media_path(const char *unit);
+/* "unit [path]": eject, then insert path if given. "" lists the units.
+ * Returns 1 if the unit was changed, 0 if nothing was (a listing, or no
+ * such unit), -1 if it was ejected but the image could not be loaded. */
+extern int media_command(const char *line);
+/* read commands from ctlfile whenever SIGUSR1 comes in */
+extern void media_init(const char *ctlfile);
+/* run the commands of a pending SIGUSR1, call at slice boundaries */
+extern void media_poll();
+/* if set, called with every swap before it is done, path "" to eject */
+extern void (*media_hook)(const char *unit, const char *path);
+
+#endif /* MEDIA_H */
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <getopt.h>
@@ -40,11 +41,21 @@ int enable_aux = 1;
 #define fileno _fileno
 #else
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "z180/z180.h"
 #include "ide/ide.h"
+#include "hostio/hostio.h"
+#include "media/media.h"
+#include "clone/clone.h"
+#include "record/record.h"
+#include "tools/tools.h"
+#include "profile/cpm.h"
+#include "profile/symbols.h"
 #include "ds1202_1302/ds1202_1302.h"
+#include "ds1202_1302/rtc.h"
 #include "fdc/fdd.h"
 #include "fdc/fdc.h"
 #include "fdc/sio.h"
@@ -54,15 +65,14 @@ int enable_aux = 1;
 
 int VERBOSE = 0;
 
-UINT8 _ram[1048576];
-UINT8 _rom[32768];
+UINT8 _ram[1048576] SNAPSHOT_ALIGNED;
+UINT8 _rom[32768] SNAPSHOT_ALIGNED;
 
 #define RAMARRAY _ram
 #define ROMARRAY _rom
 
 struct ide_controller *ic0;
-FILE* if00;
-int ifd00;
+int ifd00=-1; // the drive owns and closes it once attached
 struct ide_drive *id00;
 
 uint8_t idemap[16] = {0,0,0,0,0,0,ide_altst_r,0,
@@ -77,6 +87,8 @@ unsigned int escc_clock = ESCC_DIVISOR;
 unsigned int ins8250_clock = INS8250_DIVISOR;
 
 rtc_ds1202_1302_t *rtc;
+/* the cycles the RTC and the clones were ticked up to */
+uint64_t ticked;
 
 #define BOOT_FDD 1 // drive 0,1 swapped
 
@@ -97,6 +109,7 @@ UINT8 rom_read(offs_t A) {
 }
 
 int console_char_available() {
+	if (clone_active()) return clone_console_available();
 #ifdef SOCKETCONSOLE
 	  return char_available_socket_port(0);
 #else
@@ -105,8 +118,11 @@ int console_char_available() {
 }
 
 void escc_tx(device_t *device, int channel, UINT8 Value) {
+	if (dbg_rewinding()) return; // shown the first time round
 	if (channel==0) {
 	  //printf("TX: %c", Value);
+	  if (clone_active()) clone_console_tx(Value);
+	  else
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(0, Value);
 #else
@@ -120,14 +136,16 @@ int escc_rx(device_t *device, int channel) {
 	int ioData;
 	if (channel==0) {
 	  //ioData = 0xFF;
+	  if (record_replaying()) return record_replay_rx(0);
 	  if(console_char_available()) {
+	    if (clone_active()) return clone_console_rx();
 #ifdef SOCKETCONSOLE
 	    ioData = rx_socket_port(0);
 #else
 	    //printf("RX\n");
         ioData = getch();
 #endif
-		return ioData;
+		return record_rx(0, ioData);
 	  }
 	}
 	return -1;
@@ -146,6 +164,7 @@ int aux_char_available() {
 }
 
 void aux_tx(device_t *device, int channel, UINT8 Value) {
+	if (dbg_rewinding()) return;
 	if (channel==0) {
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(1, Value);
@@ -156,11 +175,12 @@ void aux_tx(device_t *device, int channel, UINT8 Value) {
 int aux_rx(device_t *device, int channel) {
 	int ioData;
 	if (channel==0) {
+	  if (record_replaying()) return record_replay_rx(1);
 	  if(aux_char_available()) {
 #ifdef SOCKETCONSOLE
 	    ioData = rx_socket_port(1);
 #endif
-		return ioData;
+		return record_rx(1, ioData);
 	  }
 	}
 	return -1;
@@ -271,6 +291,31 @@ void io_write (offs_t Port,UINT8 Value) {
 		dbg_log("IO: Bogus write %x:%x\n",Port,Value);
 }
 
+// GIDE data port as a stream for INIR/INDR/OTIR: the '646 latches hand out
+// the low byte first, which is the order of the bytes in the sector buffer,
+// so as long as no high byte is pending whole words go straight through.
+int io_read_block (offs_t Port, UINT8 *buf, int count) {
+	int n;
+
+	if ((Port & 0xff) != 0x58 || ide_lh_flop)
+		return 0;
+	n = ide_read_block(ic0, buf, count);
+	if (n)
+		dbg_log("GIDE: read block %d\n", n);
+	return n;
+}
+
+int io_write_block (offs_t Port, const UINT8 *buf, int count) {
+	int n;
+
+	if ((Port & 0xff) != 0x58 || ide_lh_flop)
+		return 0;
+	n = ide_write_block(ic0, buf, count);
+	if (n)
+		dbg_log("GIDE: write block %d\n", n);
+	return n;
+}
+
 void do_timers() {
 	//16X clock for ESCC
 	//printf("escc_clk:%d\n",escc_clock);
@@ -303,30 +348,57 @@ int boot1dma (const char *romfile) {
 }
 
 void io_device_update() {
+    // run completions of disk image I/O done in the background
+    hostio_poll();
+    // eject and insert disk images on SIGUSR1, on replay when the recording did
+    record_poll();
+    tools_poll();
+    if (!record_replaying()) media_poll();
 #ifdef SOCKETCONSOLE
-    // check socket open and optionally reopen it
+    // check socket open and optionally reopen it, clones have no sockets
+    if (clone_active()) return;
     if (!is_connected_socket_port(0)) open_socket_port(0);
 	if (enable_aux && !is_connected_socket_port(1)) open_socket_port(1);
 #endif
 }
 
+int media_ide0(const char *path) {
+   if (ic0->drive[0].present)
+     ide_detach(&ic0->drive[0]);
+   ifd00=-1;
+   if (path) {
+     if ((ifd00=open(path,O_RDWR)) == -1) return -1;
+     if (ide_attach(ic0,0,ifd00) == -1) {
+       close(ifd00);
+       ifd00=-1;
+     } else if (clone_self() != -1 && hostio_overlay(ifd00,NULL,clone_file("ide0")) == -1) {
+       // a clone must not write to the image the others have
+       ide_detach(&ic0->drive[0]);
+       ifd00=-1;
+     }
+   }
+   ide_reset_drive(ic0,0);
+   return (!path || ifd00 != -1) ? 0 : -1;
+}
+
 void CloseIDE() {
    ide_free(ic0);
 }
 
 void InitIDE() {
    ic0=ide_allocate("IDE0");
-   if (if00=fopen("ide00.dsk","r+b")) {
-     ifd00=fileno(if00);
-     ide_attach(ic0,0,ifd00);
+   if ((ifd00=open("ide00.dsk",O_RDWR)) != -1 && ide_attach(ic0,0,ifd00) == -1) {
+     close(ifd00);
+     ifd00=-1;
    }
    ide_reset_begin(ic0);
    atexit(CloseIDE);
+   media_register("ide0",media_ide0,ic0->drive[0].present?"ide00.dsk":NULL);
 }
 
 struct address_space ram = {ram_read,ram_write,ram_read};
 struct address_space rom = {rom_read,NULL,rom_read};
-struct address_space iospace = {io_read,io_write,NULL};
+struct address_space iospace = {io_read,io_write,NULL,io_read_block,io_write_block};
 
 void destroy_rtc()
 {
@@ -343,12 +415,116 @@ void fdc_dma_req(void *device, int state) {
 	z180_set_dreq0(cpu, state);
 }
 
+// turbo floppy: the whole sector through DMA channel 0 at the FDC DMA ports
+int fdc_dma_block(void *device, uint8_t *buf, int len, int to_fdc) {
+	int n = z180_dma0_block(cpu, 0xa0, 0xe0, buf, len, to_fdc);
+	if (n)
+		dbg_log("FDC DMA block %s %d\n", to_fdc ? "write" : "read", n);
+	return n;
+}
+
+int media_fd0(const char *path) {
+	fdd_close(BOOT_FDD);
+	if (!path) return 0;
+	fdd_load(BOOT_FDD,(char *)path);
+	if (clone_self() != -1) fdd_private(BOOT_FDD);
+	return floppyfns[BOOT_FDD][0] ? 0 : -1;
+}
+
+struct board_state {
+	uint8_t ide_lh_flop, ide_lo_byte, ide_hi_byte;
+	unsigned int escc_clock, ins8250_clock;
+};
+
+static snapshot_t *machine_parts() {
+	struct board_state b = {ide_lh_flop,ide_lo_byte,ide_hi_byte,escc_clock,ins8250_clock};
+	snapshot_t *s = snapshot_create("p112");
+	fdc37c66x_snapshot_save(fdc37c665,s);
+	snapshot_put(s,"board",&b,sizeof(b));
+	snapshot_put_pages(s,"ram",_ram,sizeof(_ram));
+	snapshot_put_pages(s,"rom",_rom,sizeof(_rom));
+	z180_snapshot_save(cpu,s);
+	ide_snapshot_save(ic0,s);
+	ds1202_1302_write_snapshot(rtc,s);
+	return s;
+}
+
+snapshot_t *machine_snapshot() {
+	return fdc37c66x_busy(fdc37c665) ? NULL : machine_parts();
+}
+
+int machine_save(const char *file) {
+	snapshot_t *s = machine_snapshot();
+	return s ? snapshot_write(s,file) : -1;
+}
+
+void machine_clone(int n) {
+	if (ic0->drive[0].present && hostio_overlay(ic0->drive[0].fd,media_path("ide0"),clone_file("ide0")) == -1) {
+		perror(clone_file("ide0"));
+		exit(2);
+	}
+	fdd_private(BOOT_FDD);
+	ds1202_1302_private(rtc);
+	tools_clone();
+}
+
+int machine_restore(snapshot_t *s) {
+	struct board_state b;
+	snapshot_t *ref = machine_parts();
+	int r = snapshot_match(s,ref);
+	snapshot_close(ref);
+	// all parts are checked first, so that a bad snapshot is not loaded half
+	if (r == -1) {
+		printf("snapshot: %s\r\n",snapshot_error(s));
+		return -1;
+	}
+	if (snapshot_get(s,"board",&b,sizeof(b)) != -1 &&
+		snapshot_map(s,"ram",_ram,sizeof(_ram)) != -1 &&
+		snapshot_map(s,"rom",_rom,sizeof(_rom)) != -1 &&
+		z180_snapshot_load(cpu,s) != -1 &&
+		ide_snapshot_load(ic0,s) != -1 &&
+		ds1202_1302_read_snapshot(rtc,s) != -1 &&
+		fdc37c66x_snapshot_load(fdc37c665,s) != -1) {
+		ide_lh_flop = b.ide_lh_flop;
+		ide_lo_byte = b.ide_lo_byte;
+		ide_hi_byte = b.ide_hi_byte;
+		escc_clock = b.escc_clock;
+		ins8250_clock = b.ins8250_clock;
+		ticked = z180_get_cycles(cpu);
+		return 0;
+	}
+	return -1;
+}
+
+int machine_load(const char *file) {
+	int r;
+	snapshot_t *s = snapshot_open(file,"p112");
+	if (!s) return -1;
+	r = machine_restore(s);
+	snapshot_close(s);
+	return r;
+}
+
 void help(const char *prg) {
-	printf("%s [-h|-?] [-v] [-d] [-r romfile]", prg);
+	printf("%s [-h|-?] [-v] [-d] [-a] [-c count] [-e marker] [-l logfile] [-m ctlfile] [-n nvfile] [-p logfile] [-r romfile] [-s snapfile] [-t epoch] [-w marker] [-x count] [-y mapfile] [tool options]", prg);
 	printf("  -h|-?      display this help\n");
 	printf("  -v         start emulator in verbose mode\n");
 	printf("  -d         start emulator in debugger mode\n");
+	printf("  -a         do disk image I/O in background threads\n");
+	printf("  -c count   boot once, then run count clones of the machine (see clone/clone.c)\n");
+	printf("  -e marker  a clone exits when its console shows marker, or after #cycles,\n");
+	printf("             needed with -c\n");
+	printf("  -l logfile record the inputs of this run to logfile (see record/record.c)\n");
+	printf("  -m ctlfile swap disk images by commands in ctlfile on SIGUSR1\n");
+	printf("  -n nvfile  start the RTC NVRAM from a copy of nvfile, changes are not kept\n");
+	printf("  -p logfile replay the inputs recorded in logfile, from the same start\n");
 	printf("  -r romfile start emulator with another rom file\n");
+	printf("  -s snapfile start emulator from a saved machine state\n");
+	printf("  -t epoch   run the RTC on emulated time from epoch (seconds since 1970)\n");
+	printf("  -w marker  start the clones when the console shows marker, or after #cycles\n");
+	printf("  -x count   keep the last count instructions run for H in the debugger, default 4096\n");
+	printf("  -y mapfile name the code in the profile with the symbols of mapfile\n");
+	tools_help();
 }
 
 int main(int argc, char** argv)
@@ -357,8 +533,18 @@ int main(int argc, char** argv)
 
 	int opt;
 	int debugger = 0;
+	int asyncio = 0;
+	int rtcsource = RTC_TIME_CACHED;
+	time_t epoch = 0;
+	const char *nvtemplate = NULL;
 	const char *romfile = "p112rom.bin";
-	while ((opt = getopt(argc, argv, "h?vdr:")) != -1) {
+	const char *snapfile = NULL;
+	int clones = 0;
+	const char *startmarker = NULL, *endmarker = NULL;
+	int recmode = RECORD_OFF;
+	const char *recfile = NULL;
+	int history = 4096;
+	while ((opt = getopt(argc, argv, tools_options("h?vdac:e:l:m:n:p:r:s:t:w:x:y:"))) != -1) {
 		switch (opt) {
 			case 'h': case '?':
 				help(argv[0]);
@@ -369,20 +555,69 @@ int main(int argc, char** argv)
 			case 'd':
 				debugger = 1;
 				break;
+			case 'a':
+				asyncio = 1;
+				break;
+			case 'c':
+				clones = atoi(optarg);
+				break;
+			case 'e':
+				endmarker = optarg;
+				break;
+			case 'l':
+				recmode = RECORD_WRITE;
+				recfile = optarg;
+				break;
+			case 'm':
+				media_init(optarg);
+				break;
+			case 'n':
+				nvtemplate = optarg;
+				break;
+			case 'p':
+				recmode = RECORD_REPLAY;
+				recfile = optarg;
+				break;
 			case 'r':
 				romfile = optarg;
 				break;
+			case 's':
+				snapfile = optarg;
+				break;
+			case 't':
+				rtcsource = RTC_TIME_VIRTUAL;
+				epoch = (time_t)strtoll(optarg, NULL, 0);
+				break;
+			case 'w':
+				startmarker = optarg;
+				break;
+			case 'x':
+				history = atoi(optarg);
+				break;
+			case 'y':
+				if (symbols_load(optarg) == -1) {
+					printf("could not read %s\n", optarg);
+					exit(1);
+				}
+				break;
 			default:
+				if (tools_option(opt, optarg)) break;
 				printf("invalid option.\n");
 				help(argv[0]);
 				exit(1);
 		}
 	}
+	if (clones > 0 && clone_init(clones, startmarker, endmarker) == -1) {
+		printf("clones need an end marker, see -e\n");
+		exit(1);
+	}
 
 #ifdef SOCKETCONSOLE
 	init_TCPIP();
-	init_socket_port(0); // ESCC Console
-	init_socket_port(1); // FDC AUX
+	if (!clone_active()) {
+		init_socket_port(0); // ESCC Console
+		init_socket_port(1); // FDC AUX
+	}
 	atexit(shutdown_socket_ports);
 #endif
 	io_device_update(); // wait for serial socket connections
@@ -393,21 +628,47 @@ int main(int argc, char** argv)
 
 	if (boot1dma(romfile) == -1) exit(1);
 
+	if (asyncio && !recfile) hostio_init(2); // background I/O would finish at host speed
+	atexit(hostio_shutdown);
+
 	InitIDE();
 
-	rtc = ds1202_1302_init("RTC",1302);
+	rtc_set_time_source(rtcsource, epoch, 16000000);
+	rtc = ds1202_1302_init_mapped("RTC",1302,"p112-rtc.bin",nvtemplate);
+	if (!rtc) {
+		printf("could not start the NVRAM from %s: %s\n", nvtemplate,
+			errno == EINVAL ? "not an NVRAM image" : strerror(errno));
+		exit(1);
+	}
 	ds1202_1302_reset(rtc);
 	atexit(destroy_rtc);
 
 	fdc37c665 = fdc37c665_init(fdc_int, fdc_dma_req, aux_int_state_cb, aux_rx, aux_tx, NULL,NULL,NULL);
+	fdc_set_dma_block_cb(fdc37c665->fdc, fdc_dma_block);
 	fdd_init();
 	fdd_set_type(BOOT_FDD,fdd_get_from_internal_name("35_2hd"));
 	fdd_set_turbo(BOOT_FDD,1);
 	fdd_load(BOOT_FDD,"p112-fdd1.img");
+	media_register("fd0",media_fd0,floppyfns[BOOT_FDD][0]?floppyfns[BOOT_FDD]:NULL);
 			
 	cpu = cpu_create_z180("Z182",Z180_TYPE_Z182,16000000,&ram,&rom,&iospace,irq0ackcallback,NULL/*daisychain*/,
 		NULL,NULL,escc_rx,escc_tx,parport_read,parport_write);
+	if (history > 0 && z180_history_size(cpu, history) == -1) {
+		printf("no memory for a history of %d instructions\n", history);
+		exit(1);
+	}
 	cpu_reset_z180(cpu);
+	if (snapfile && machine_load(snapfile) == -1) {
+		printf("could not restore %s\n", snapfile);
+		exit(1);
+	}
+	if (recfile && record_init(recmode, recfile, "p112", cpu) == -1) {
+		printf("could not %s %s\n", recmode == RECORD_WRITE ? "record to" : "replay", recfile);
+		exit(1);
+	}
+	tools_open(cpu, "p112");
+	ide_command_hook = cpm_ide_command;
+	fdc_command_hook = cpm_fdc_command;
 
 	struct timeval t0;
 	struct timeval t1;
@@ -416,9 +677,15 @@ int main(int argc, char** argv)
 
 	if (dbg_init(debugger, RAMARRAY, ROMARRAY) == -1) exit(1);
 
+	ticked = z180_get_cycles(cpu);
 	while(dbg_running()) {
 		cpu_execute_z180(cpu,10000);
+		/* slices run over and get cut short, tick what really ran */
+		uint64_t ran = z180_get_cycles(cpu) - ticked;
+		ticked += ran;
+		rtc_time_tick(ran);
 		io_device_update();
+		clone_tick(ran);
 	}
 	gettimeofday(&t1, 0);
 	printf("time:%g\n",(t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f);
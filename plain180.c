@@ -44,13 +44,20 @@
 
 #include "z180/z180.h"
 #include "sdcard/sdcard.h"
+#include "hostio/hostio.h"
+#include "media/media.h"
+#include "clone/clone.h"
+#include "record/record.h"
+#include "tools/tools.h"
+#include "profile/cpm.h"
+#include "profile/symbols.h"
 #define DBG_MAIN
 #include "dbg/dbg.h"
 
 int VERBOSE = 0;
 
 unsigned int ramsize = 512 * 1024; // available RAM
-UINT8 _ram[1024 * 1024]; // max 1MB of RAM
+UINT8 _ram[1024 * 1024] SNAPSHOT_ALIGNED; // max 1MB of RAM
 
 #define RAMARRAY _ram
 #define ROMARRAY NULL
@@ -58,6 +65,8 @@ UINT8 _ram[1024 * 1024]; // max 1MB of RAM
 unsigned int asci_clock = 16;
 
 struct z180_device *cpu = NULL;
+/* the cycles the RTC and the clones were ticked up to */
+uint64_t ticked;
 struct sdcard_device sdcard;
                        
 UINT8 ram_read(offs_t A) {
@@ -70,6 +79,7 @@ void ram_write(offs_t A,UINT8 V) {
 }
 
 int char_available() {
+	if (clone_active()) return clone_console_available();
 #ifdef SOCKETCONSOLE
 	  return char_available_socket_port(0);
 #else
@@ -78,8 +88,11 @@ int char_available() {
 }
 
 void asci_tx(device_t *device, int channel, UINT8 Value) {
+	if (dbg_rewinding()) return; // shown the first time round
 	if (channel==0) {
 	  //printf("TX: %c", Value);
+	  if (clone_active()) clone_console_tx(Value);
+	  else
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(0, Value);
 #else
@@ -93,14 +106,16 @@ int asci_rx(device_t *device, int channel) {
 	int ioData;
 	if (channel==0) {
 	  //ioData = 0xFF;
+	  if (record_replaying()) return record_replay_rx(0);
 	  if(char_available()) {
+	    if (clone_active()) return clone_console_rx();
 #ifdef SOCKETCONSOLE
 	  ioData = rx_socket_port(0);
 #else
 	    //printf("RX\n");
         ioData = getch();
 #endif
-		return ioData;
+		return record_rx(0, ioData);
 	  }
 	}
 	return -1;
@@ -135,6 +150,23 @@ void io_write (offs_t Port,UINT8 Value) {
   }
 }
 
+int io_read_block (offs_t Port, UINT8 *buf, int count) {
+  if ((Port & 0xff) == 0xf0)
+    return sdcard_read_block(&sdcard, 1, buf, count);
+  return 0;
+}
+
+int io_write_block (offs_t Port, const UINT8 *buf, int count) {
+  if ((Port & 0xff) == 0xf0)
+    return sdcard_write_block(&sdcard, 1, buf, count);
+  return 0;
+}
+
+// the same card is also reachable as SPI slave on the CSI/O
+UINT8 csio_xfer(device_t *device, UINT8 data) {
+  return sdcard_exchange(&sdcard, 1, data);
+}
+
 void do_timers() {
 	//16X clock for ASCI
 	//printf("asci_clk:%d\n",asci_clock);
@@ -158,22 +190,111 @@ int boot1dma (const char *romfile) {
 }
 
 void io_device_update() {
+    // run completions of disk image I/O done in the background
+    hostio_poll();
+    // eject and insert disk images on SIGUSR1, on replay when the recording did
+    record_poll();
+    tools_poll();
+    if (!record_replaying()) media_poll();
 #ifdef SOCKETCONSOLE
-    // check socket open and optionally reopen it
+    // check socket open and optionally reopen it, clones have no sockets
+    if (clone_active()) return;
     if (!is_connected_socket_port(0)) open_socket_port(0);
 #endif
 }
 
+int media_sd0(const char *path) {
+	sdcard_close(&sdcard);
+	if (path && sdcard_init(&sdcard, (char *)path) == -1) return -1;
+	// a clone must not write to the image the others have
+	if (path && clone_self() != -1 && hostio_overlay(sdcard.fd,NULL,clone_file("sd0")) == -1) {
+		sdcard_close(&sdcard);
+		return -1;
+	}
+	return 0;
+}
+
+struct board_state {
+	unsigned int ramsize;
+	unsigned int asci_clock;
+};
+
+snapshot_t *machine_snapshot() {
+	struct board_state b = {ramsize,asci_clock};
+	snapshot_t *s = snapshot_create("plain180");
+	snapshot_put(s,"board",&b,sizeof(b));
+	snapshot_put_pages(s,"ram",_ram,sizeof(_ram));
+	z180_snapshot_save(cpu,s);
+	sdcard_snapshot_save(&sdcard,s);
+	return s;
+}
+
+int machine_save(const char *file) {
+	snapshot_t *s = machine_snapshot();
+	return s ? snapshot_write(s,file) : -1;
+}
+
+void machine_clone(int n) {
+	if (sdcard.fd != -1 && hostio_overlay(sdcard.fd,media_path("sd0"),clone_file("sd0")) == -1) {
+		perror(clone_file("sd0"));
+		exit(2);
+	}
+	tools_clone();
+}
+
+int machine_restore(snapshot_t *s) {
+	struct board_state b;
+	snapshot_t *ref = machine_snapshot();
+	int r = snapshot_match(s,ref);
+	snapshot_close(ref);
+	// all parts are checked first, so that a bad snapshot is not loaded half
+	if (r == -1) {
+		printf("snapshot: %s\r\n",snapshot_error(s));
+		return -1;
+	}
+	if (snapshot_get(s,"board",&b,sizeof(b)) != -1 &&
+		snapshot_map(s,"ram",_ram,sizeof(_ram)) != -1 &&
+		z180_snapshot_load(cpu,s) != -1 &&
+		sdcard_snapshot_load(&sdcard,s) != -1) {
+		ramsize = b.ramsize;
+		asci_clock = b.asci_clock;
+		ticked = z180_get_cycles(cpu);
+		return 0;
+	}
+	return -1;
+}
+
+int machine_load(const char *file) {
+	int r;
+	snapshot_t *s = snapshot_open(file,"plain180");
+	if (!s) return -1;
+	r = machine_restore(s);
+	snapshot_close(s);
+	return r;
+}
+
 struct address_space ram = {ram_read,ram_write,ram_read};
 //struct address_space rom = {rom_read,NULL,rom_read};
-struct address_space iospace = {io_read,io_write,NULL};
+struct address_space iospace = {io_read,io_write,NULL,io_read_block,io_write_block};
 
 void help(const char *prg) {
-	printf("%s [-h|-?] [-v] [-d] [-r romfile]", prg);
+	printf("%s [-h|-?] [-v] [-d] [-a] [-c count] [-e marker] [-l logfile] [-m ctlfile] [-p logfile] [-r romfile] [-s snapfile] [-w marker] [-x count] [-y mapfile] [tool options]", prg);
 	printf("  -h|-?      display this help\n");
 	printf("  -v         start emulator in verbose mode\n");
 	printf("  -d         start emulator in debugger mode\n");
+	printf("  -a         do disk image I/O in background threads\n");
+	printf("  -c count   boot once, then run count clones of the machine (see clone/clone.c)\n");
+	printf("  -e marker  a clone exits when its console shows marker, or after #cycles,\n");
+	printf("             needed with -c\n");
+	printf("  -l logfile record the inputs of this run to logfile (see record/record.c)\n");
+	printf("  -m ctlfile swap disk images by commands in ctlfile on SIGUSR1\n");
+	printf("  -p logfile replay the inputs recorded in logfile, from the same start\n");
 	printf("  -r romfile start emulator with another rom file\n");
+	printf("  -s snapfile start emulator from a saved machine state\n");
+	printf("  -w marker  start the clones when the console shows marker, or after #cycles\n");
+	printf("  -x count   keep the last count instructions run for H in the debugger, default 4096\n");
+	printf("  -y mapfile name the code in the profile with the symbols of mapfile\n");
+	tools_help();
 }
 
 int main(int argc, char** argv)
@@ -182,8 +303,15 @@ int main(int argc, char** argv)
 
 	int opt;
 	int debugger = 0;
+	int asyncio = 0;
 	const char *romfile = "plain180rom.bin";
-	while ((opt = getopt(argc, argv, "h?vdr:")) != -1) {
+	const char *snapfile = NULL;
+	int clones = 0;
+	const char *startmarker = NULL, *endmarker = NULL;
+	int recmode = RECORD_OFF;
+	const char *recfile = NULL;
+	int history = 4096;
+	while ((opt = getopt(argc, argv, tools_options("h?vdac:e:l:m:p:r:s:w:x:y:"))) != -1) {
 		switch (opt) {
 			case 'h': case '?':
 				help(argv[0]);
@@ -194,19 +322,59 @@ int main(int argc, char** argv)
 			case 'd':
 				debugger = 1;
 				break;
+			case 'a':
+				asyncio = 1;
+				break;
+			case 'c':
+				clones = atoi(optarg);
+				break;
+			case 'e':
+				endmarker = optarg;
+				break;
+			case 'l':
+				recmode = RECORD_WRITE;
+				recfile = optarg;
+				break;
+			case 'm':
+				media_init(optarg);
+				break;
+			case 'p':
+				recmode = RECORD_REPLAY;
+				recfile = optarg;
+				break;
 			case 'r':
 				romfile = optarg;
 				break;
+			case 's':
+				snapfile = optarg;
+				break;
+			case 'w':
+				startmarker = optarg;
+				break;
+			case 'x':
+				history = atoi(optarg);
+				break;
+			case 'y':
+				if (symbols_load(optarg) == -1) {
+					printf("could not read %s\n", optarg);
+					exit(1);
+				}
+				break;
 			default:
+				if (tools_option(opt, optarg)) break;
 				printf("invalid option.\n");
 				help(argv[0]);
 				exit(1);
 		}
 	}
+	if (clones > 0 && clone_init(clones, startmarker, endmarker) == -1) {
+		printf("clones need an end marker, see -e\n");
+		exit(1);
+	}
 
 #ifdef SOCKETCONSOLE
 	init_TCPIP();
-	init_socket_port(0); // ASCI Console
+	if (!clone_active()) init_socket_port(0); // ASCI Console
 	atexit(shutdown_socket_ports);
 #endif
 	io_device_update(); // wait for serial socket connections
@@ -217,13 +385,32 @@ int main(int argc, char** argv)
 
 	if (boot1dma(romfile) == -1) exit(1);
 
+	if (asyncio && !recfile) hostio_init(2); // background I/O would finish at host speed
+	atexit(hostio_shutdown);
+
 	cpu = cpu_create_z180("Z180",Z180_TYPE_Z180,18432000,&ram,NULL,&iospace,irq0ackcallback,NULL/*daisychain*/,
 		asci_rx,asci_tx,NULL,NULL,NULL,NULL);
+	z180_set_csio_callback(cpu, csio_xfer);
+	if (history > 0 && z180_history_size(cpu, history) == -1) {
+		printf("no memory for a history of %d instructions\n", history);
+		exit(1);
+	}
 	
 	if (sdcard_init(&sdcard, "sdcard.img") == -1) {
 		printf("sdcard image sdcard.img not found, no disk available.\n");
 	}
+	media_register("sd0",media_sd0,sdcard.fd!=-1?"sdcard.img":NULL);
 	cpu_reset_z180(cpu);
+	if (snapfile && machine_load(snapfile) == -1) {
+		printf("could not restore %s\n", snapfile);
+		exit(1);
+	}
+	if (recfile && record_init(recmode, recfile, "plain180", cpu) == -1) {
+		printf("could not %s %s\n", recmode == RECORD_WRITE ? "record to" : "replay", recfile);
+		exit(1);
+	}
+	tools_open(cpu, "plain180");
+	sdcard_command_hook = cpm_sd_command;
 	//printf("2\n");fflush(stdout);
 
 	struct timeval t0;
@@ -233,9 +420,14 @@ int main(int argc, char** argv)
 
 	if (dbg_init(debugger, RAMARRAY, ROMARRAY) == -1) exit(1);
 
+	ticked = z180_get_cycles(cpu);
 	while(dbg_running()) {
 		cpu_execute_z180(cpu,10000);
+		/* slices run over and get cut short, tick what really ran */
+		uint64_t ran = z180_get_cycles(cpu) - ticked;
+		ticked += ran;
 		io_device_update();
+		clone_tick(ran);
 	}
 	gettimeofday(&t1, 0);
 	//printf("instrs:%llu, time:%g\n",instrcnt, (t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f);
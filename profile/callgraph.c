@@ -0,0 +1,387 @@
+/*
+ * callgraph.c - cycles per call stack, for flame graphs
+ *
+ * The calls are followed through the instructions that came into the
+ * cpu's history ring during a slice, once it is over. CALL and RST push a frame on a shadow
+ * stack, RET, RETI and RETN pop it, and so does the first instruction of
+ * an interrupt, NMI or TRAP, which the history marks. Whether a
+ * conditional one was taken shows in the stack pointer after it. Every
+ * instruction's cycles go to the stack it ran in. The stacks are kept as
+ * a tree of nodes, one per function per caller stack.
+ *
+ * Code does not always return the way it called. A RET is matched to the
+ * frame whose stack pointer it leaves behind, so frames skipped, by code
+ * that drops its return address, are popped with it. A RET that matches
+ * none, close below the top frame, is a computed jump (push hl; ret) and
+ * leaves the stack alone. Any other one means the stack was switched, as
+ * the MP/M dispatcher does to change tasks, and the shadow stack starts
+ * again from the top.
+ *
+ * Functions are named by the physical address they start at, so banked
+ * code is told apart, or by a symbol (see symbols.c). The folded stacks
+ * ("caller;callee cycles") go to flamegraph.pl and the tools that take
+ * its input.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "symbols.h"
+
+#define MAXDEPTH 256
+#define MAXNODES (1 << 20)
+#define HASHSIZE (1 << 16)	/* a power of 2 */
+/* a RET that matches no frame, this close below the top one, is a jump */
+#define LOCALSPAN 0x100
+#define NAMELEN 48
+
+struct node {
+	uint64_t cycles;	/* run in it, not in its callees */
+	offs_t func;		/* physical address */
+	UINT16 pc;
+	UINT8 irq;
+	int parent;
+	int next;		/* in its hash chain */
+};
+
+struct frame {
+	int node;
+	UINT16 sp;		/* before the call, and after the return */
+	UINT16 ret;		/* the return address */
+	UINT8 irq;		/* an interrupt, its return address is not known */
+};
+
+static device_t *cpu = NULL;
+static char *folded = NULL;
+static struct node *nodes = NULL;
+static int nnodes = 0, maxnodes = 0;
+static int hash[HASHSIZE];
+static struct frame stack[MAXDEPTH];
+static int depth = 0, current = 0;
+static UINT32 seq;
+static struct z180_history last;
+static int have_last = 0;
+static uint64_t cycles = 0, resyncs = 0, lostnodes = 0, gaps = 0;
+
+/* the node of func called from parent, made if new */
+static int callgraph_node(int parent, offs_t func, UINT16 pc, int irq)
+{
+	UINT32 h = (func * 31 + parent * 7 + irq) & (HASHSIZE - 1);
+	struct node *n;
+	int i;
+
+	for (i = hash[h]; i != -1; i = nodes[i].next)
+		if (nodes[i].parent == parent && nodes[i].func == func && nodes[i].irq == irq)
+			return i;
+	if (nnodes == maxnodes) {
+		if (maxnodes == MAXNODES) {
+			lostnodes++;
+			return parent;
+		}
+		maxnodes = maxnodes ? maxnodes * 2 : 4096;
+		if (!(n = realloc(nodes, maxnodes * sizeof(*n)))) {
+			maxnodes = nnodes;
+			lostnodes++;
+			return parent;
+		}
+		nodes = n;
+	}
+	n = &nodes[nnodes];
+	n->cycles = 0;
+	n->func = func;
+	n->pc = pc;
+	n->irq = irq;
+	n->parent = parent;
+	n->next = hash[h];
+	hash[h] = nnodes;
+	return nnodes++;
+}
+
+static void callgraph_push(int node, UINT16 sp, UINT16 ret, int irq)
+{
+	if (depth == MAXDEPTH) {
+		/* runaway, likely calls that never return: start again */
+		depth = 0;
+		resyncs++;
+	}
+	stack[depth].node = node;
+	stack[depth].sp = sp;
+	stack[depth].ret = ret;
+	stack[depth].irq = irq;
+	depth++;
+	current = node;
+}
+
+/* a return to pc (-1 if not known), leaving the stack pointer at sp */
+static void callgraph_return(int pc, UINT16 sp)
+{
+	int i;
+
+	for (i = depth - 1; i >= 0; i--)
+		if (stack[i].sp == sp && (stack[i].irq || pc == -1 || stack[i].ret == pc)) {
+			depth = i;
+			current = depth ? stack[depth - 1].node : 0;
+			return;
+		}
+	if (!depth)
+		return;
+	if (sp != stack[depth - 1].sp && (UINT16)(stack[depth - 1].sp - sp) <= LOCALSPAN)
+		return;
+	/* the stack was switched */
+	depth = 0;
+	current = 0;
+	resyncs++;
+}
+
+static int callgraph_iscall(const UINT8 *op)
+{
+	return op[0] == 0xcd || (op[0] & 0xc7) == 0xc4 || (op[0] & 0xc7) == 0xc7;
+}
+
+static int callgraph_isret(const UINT8 *op)
+{
+	return op[0] == 0xc9 || (op[0] & 0xc7) == 0xc0 ||
+	    (op[0] == 0xed && (op[1] == 0x4d || op[1] == 0x45));
+}
+
+/* a ran, b after it */
+static void callgraph_count(const struct z180_history *a, const struct z180_history *b)
+{
+	/* the stack pointer a left, before an interrupt pushed on it */
+	UINT16 sp = b->irq ? b->sp + 2 : b->sp, target;
+	offs_t func;
+
+	if (b->cycle >= a->cycle) {
+		nodes[current].cycles += b->cycle - a->cycle;
+		cycles += b->cycle - a->cycle;
+	}
+	if (callgraph_iscall(a->op) && sp == (UINT16)(a->sp - 2)) {
+		target = (a->op[0] & 0xc7) == 0xc7 ? a->op[0] & 0x38 : a->op[1] | a->op[2] << 8;
+		/* interrupted before the callee ran: guess its mapping */
+		func = b->irq ? (b->addr - b->pc + target) & 0xfffff : b->addr;
+		callgraph_push(callgraph_node(current, func, target, 0), a->sp, a->pc + a->len, 0);
+	} else if (callgraph_isret(a->op) && sp == (UINT16)(a->sp + 2))
+		callgraph_return(b->irq ? -1 : b->pc, sp);
+	if (b->irq)
+		callgraph_push(callgraph_node(current, b->addr, b->pc, 1), sp, 0, 1);
+}
+
+void callgraph_clear()
+{
+	int i;
+
+	for (i = 0; i < HASHSIZE; i++)
+		hash[i] = -1;
+	nnodes = 0;
+	depth = 0;
+	cycles = resyncs = lostnodes = gaps = 0;
+	have_last = 0;
+	/* the top, where what runs outside of any known call goes */
+	current = callgraph_node(-1, 0, 0, 0);
+	if (cpu)
+		seq = z180_history_seq(cpu);
+}
+
+int callgraph_open(device_t *device, const char *file)
+{
+	callgraph_close();
+	if (z180_history_reserve(device) == -1)
+		return -1;
+	free(folded);
+	folded = NULL;
+	if (file && !(folded = strdup(file)))
+		return -1;
+	callgraph_clear();
+	if (nnodes == 0)
+		return -1;
+	cpu = device;
+	seq = z180_history_seq(cpu);
+	return 0;
+}
+
+int callgraph_active()
+{
+	return cpu != NULL;
+}
+
+void callgraph_poll()
+{
+	struct z180_history h;
+	int r;
+
+	if (!cpu)
+		return;
+	while ((r = z180_history_next(cpu, &seq, &h))) {
+		if (r == -1) {
+			/* the stack is not known any more */
+			have_last = 0;
+			depth = 0;
+			current = 0;
+			gaps++;
+			continue;
+		}
+		if (have_last)
+			callgraph_count(&last, &h);
+		last = h;
+		have_last = 1;
+	}
+}
+
+void callgraph_close()
+{
+	FILE *f;
+
+	if (!cpu)
+		return;
+	callgraph_poll();
+	if (folded) {
+		if ((f = fopen(folded, "w"))) {
+			callgraph_folded(f);
+			fclose(f);
+		} else
+			perror(folded);
+	}
+	cpu = NULL;
+}
+
+int callgraph_clone(const char *file)
+{
+	if (!cpu)
+		return 0;
+	callgraph_clear();
+	if (folded) {
+		free(folded);
+		if (!(folded = strdup(file)))
+			return -1;
+	}
+	return 0;
+}
+
+static const char *callgraph_name(int node, char *buf)
+{
+	struct node *n = &nodes[node];
+	char *p = buf;
+
+	if (node == 0)
+		return "[top]";
+	if (n->irq) {
+		strcpy(buf, "int:");
+		p += 4;
+	}
+	if (!symbols_name(n->func, n->pc, p, NAMELEN - 4))
+		sprintf(p, "$%05x", n->func);
+	return buf;
+}
+
+void callgraph_folded(FILE *f)
+{
+	int path[MAXDEPTH + 1], len, i, n;
+	char name[NAMELEN];
+
+	callgraph_poll();
+	for (i = 0; i < nnodes; i++) {
+		if (!nodes[i].cycles)
+			continue;
+		for (len = 0, n = i; n > 0 && len < MAXDEPTH; n = nodes[n].parent)
+			path[len++] = n;
+		if (!len)
+			path[len++] = 0;
+		while (len--)
+			fprintf(f, "%s%c", callgraph_name(path[len], name), len ? ';' : ' ');
+		fprintf(f, "%llu\n", (unsigned long long)nodes[i].cycles);
+	}
+}
+
+struct function {
+	offs_t func;
+	int node;		/* one that is it, for the name */
+	uint64_t self, total;
+};
+
+static int callgraph_cmpfunction(const void *a, const void *b)
+{
+	uint64_t ta = ((const struct function *)a)->total, tb = ((const struct function *)b)->total;
+
+	return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+void callgraph_report(FILE *f, int n, const char *nl)
+{
+	struct function *funcs;
+	int *index, *fn, size = 1, nfuncs = 0, len, i, j, k, node;
+	char name[NAMELEN];
+	UINT32 h;
+
+	callgraph_poll();
+	fprintf(f, "callgraph: %llu cycles, %d stacks%s%s%s", (unsigned long long)cycles, nnodes,
+	    resyncs ? ", stack switched" : "", gaps ? ", with gaps" : "", nl);
+	if (lostnodes)
+		fprintf(f, "(%llu calls not followed, too many stacks)%s", (unsigned long long)lostnodes, nl);
+	while (size < 2 * nnodes)
+		size <<= 1;
+	funcs = malloc(nnodes * sizeof(*funcs));
+	index = malloc(size * sizeof(*index));
+	fn = malloc(nnodes * sizeof(*fn));
+	if (!funcs || !index || !fn) {
+		free(funcs);
+		free(index);
+		free(fn);
+		return;
+	}
+	/* a function per address called, interrupts on their own */
+	for (i = 0; i < size; i++)
+		index[i] = -1;
+	for (i = 0; i < nnodes; i++) {
+		for (h = (nodes[i].func * 2 + nodes[i].irq) & (size - 1); index[h] != -1; h = (h + 1) & (size - 1))
+			if (funcs[index[h]].func == nodes[i].func && nodes[funcs[index[h]].node].irq == nodes[i].irq &&
+			    (i == 0) == (funcs[index[h]].node == 0))
+				break;
+		if (index[h] == -1) {
+			funcs[nfuncs].func = nodes[i].func;
+			funcs[nfuncs].node = i;
+			funcs[nfuncs].self = funcs[nfuncs].total = 0;
+			index[h] = nfuncs++;
+		}
+		fn[i] = index[h];
+	}
+	/* cycles in a stack count for every function in it, once */
+	for (i = 0; i < nnodes; i++) {
+		if (!nodes[i].cycles)
+			continue;
+		funcs[fn[i]].self += nodes[i].cycles;
+		for (len = 0, node = i; node != -1; node = nodes[node].parent, len++) {
+			for (j = 0, k = i; j < len && fn[k] != fn[node]; j++)
+				k = nodes[k].parent;
+			if (j == len)
+				funcs[fn[node]].total += nodes[i].cycles;
+		}
+	}
+	qsort(funcs, nfuncs, sizeof(*funcs), callgraph_cmpfunction);
+	fprintf(f, "%s   inclusive      %%   exclusive      %%  function%s", nl, nl);
+	for (i = 0; i < n && i < nfuncs; i++)
+		fprintf(f, "%12llu %6.2f %11llu %6.2f  %s%s",
+		    (unsigned long long)funcs[i].total, cycles ? 100.0 * funcs[i].total / cycles : 0.0,
+		    (unsigned long long)funcs[i].self, cycles ? 100.0 * funcs[i].self / cycles : 0.0,
+		    callgraph_name(funcs[i].node, name), nl);
+	free(funcs);
+	free(index);
+	free(fn);
+}
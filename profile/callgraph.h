@@ -0,0 +1,47 @@
+/*
+ * callgraph.h - cycles per call stack, for flame graphs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../z180/z180.h"
+
+/* Start following the calls of the cpu, from zero. With a file the
+ * folded stacks go there at callgraph_close(). -1 on error. */
+extern int callgraph_open(device_t *cpu, const char *file);
+extern int callgraph_active();
+/* count from zero again */
+extern void callgraph_clear();
+/* call at slice boundaries: follows what ran in the slice */
+extern void callgraph_poll();
+/* stop, and write the folded stacks if there is a file for them */
+extern void callgraph_close();
+/* in a clone: count from zero, for folded stacks in file */
+extern int callgraph_clone(const char *file);
+/* a line "caller;...;callee cycles" per stack that ran */
+extern void callgraph_folded(FILE *f);
+/* the n functions with the most cycles in them and their callees,
+ * lines ending in nl */
+extern void callgraph_report(FILE *f, int n, const char *nl);
+
+#endif /* CALLGRAPH_H */
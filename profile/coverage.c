@@ -0,0 +1,227 @@
+/*
+ * coverage.c - which code ran, and which way its branches went
+ *
+ * Read from the instructions a slice left in the cpu's history ring, and
+ * kept as bitmaps over the 1MB physical address space: a bit
+ * for every address an instruction started at, and two for every
+ * conditional JR, DJNZ, JP, CALL and RET, for whether it was seen to
+ * branch and to go on. An instruction that an interrupt came after does
+ * not tell where it went, and is only noted as run.
+ *
+ * The file (see coverage.h) has the pages that ran code, with their
+ * memory as it was when it was written, so that covlist can list them
+ * without the ROM or the disks. Coverages of several runs can be merged
+ * by covlist.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coverage.h"
+
+#define PAGES 256
+#define BITMAP (0x100000 >> 3)
+
+static device_t *cpu = NULL;
+static char *file_name = NULL;
+static char machine_name[COVERAGE_NAMELEN];
+static UINT8 run[BITMAP], taken[BITMAP], nottaken[BITMAP];
+static UINT8 paged[PAGES];		/* the page ran code */
+static UINT16 pagepc[PAGES];
+static UINT32 seq;
+static struct z180_history last;
+static int have_last = 0;
+static uint64_t gaps = 0;
+
+/* JR cc, DJNZ, JP cc, CALL cc, RET cc */
+static int coverage_iscond(const UINT8 *op)
+{
+	return (op[0] & 0xe7) == 0x20 || op[0] == 0x10 ||
+	    (op[0] & 0xc7) == 0xc2 || (op[0] & 0xc7) == 0xc4 || (op[0] & 0xc7) == 0xc0;
+}
+
+static void coverage_run(const struct z180_history *h)
+{
+	offs_t addr = h->addr & 0xfffff;
+
+	run[addr >> 3] |= 1 << (addr & 7);
+	paged[addr >> 12] = 1;
+	pagepc[addr >> 12] = h->pc - (addr & (COVERAGE_PAGE - 1));
+}
+
+/* a ran, b after it */
+static void coverage_count(const struct z180_history *a, const struct z180_history *b)
+{
+	offs_t addr = a->addr & 0xfffff;
+
+	if (b->irq || !coverage_iscond(a->op))
+		return;
+	if (b->pc != (UINT16)(a->pc + a->len))
+		taken[addr >> 3] |= 1 << (addr & 7);
+	else
+		nottaken[addr >> 3] |= 1 << (addr & 7);
+}
+
+void coverage_clear()
+{
+	memset(run, 0, sizeof(run));
+	memset(taken, 0, sizeof(taken));
+	memset(nottaken, 0, sizeof(nottaken));
+	memset(paged, 0, sizeof(paged));
+	gaps = 0;
+	have_last = 0;
+	if (cpu)
+		seq = z180_history_seq(cpu);
+}
+
+int coverage_open(device_t *device, const char *machine, const char *file)
+{
+	coverage_close();
+	if (z180_history_reserve(device) == -1)
+		return -1;
+	free(file_name);
+	file_name = NULL;
+	if (file && !(file_name = strdup(file)))
+		return -1;
+	memset(machine_name, 0, sizeof(machine_name));
+	strncpy(machine_name, machine, COVERAGE_NAMELEN - 1);
+	cpu = device;
+	coverage_clear();
+	return 0;
+}
+
+int coverage_active()
+{
+	return cpu != NULL;
+}
+
+void coverage_poll()
+{
+	struct z180_history h;
+	int r;
+
+	if (!cpu)
+		return;
+	while ((r = z180_history_next(cpu, &seq, &h))) {
+		if (r == -1) {
+			have_last = 0;
+			gaps++;
+			continue;
+		}
+		coverage_run(&h);
+		if (have_last)
+			coverage_count(&last, &h);
+		last = h;
+		have_last = 1;
+	}
+}
+
+int coverage_write(const char *file)
+{
+	struct coverage_header header;
+	struct coverage_page *page;
+	offs_t base;
+	int i, j, r = 0;
+	FILE *f;
+
+	coverage_poll();
+	if (!(page = malloc(sizeof(*page))))
+		return -1;
+	if (!(f = fopen(file, "wb"))) {
+		free(page);
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COVERAGE_MAGIC, sizeof(header.magic));
+	header.version = COVERAGE_VERSION;
+	memcpy(header.machine, machine_name, sizeof(header.machine));
+	for (i = 0; i < PAGES; i++)
+		header.pages += paged[i];
+	if (fwrite(&header, sizeof(header), 1, f) != 1)
+		r = -1;
+	for (i = 0; i < PAGES && r == 0; i++) {
+		if (!paged[i])
+			continue;
+		memset(page, 0, sizeof(*page));
+		base = (offs_t)i << 12;
+		page->page = i;
+		page->pc = pagepc[i];
+		for (j = 0; j < COVERAGE_PAGE; j++)
+			page->code[j] = z180_peek_physical(cpu, base + j);
+		memcpy(page->run, run + (base >> 3), sizeof(page->run));
+		memcpy(page->taken, taken + (base >> 3), sizeof(page->taken));
+		memcpy(page->nottaken, nottaken + (base >> 3), sizeof(page->nottaken));
+		if (fwrite(page, sizeof(*page), 1, f) != 1)
+			r = -1;
+	}
+	if (fclose(f) != 0)
+		r = -1;
+	free(page);
+	return r;
+}
+
+void coverage_close()
+{
+	if (!cpu)
+		return;
+	if (file_name && coverage_write(file_name) == -1)
+		perror(file_name);
+	cpu = NULL;
+}
+
+int coverage_clone(const char *file)
+{
+	if (!cpu)
+		return 0;
+	coverage_clear();
+	if (file_name) {
+		free(file_name);
+		if (!(file_name = strdup(file)))
+			return -1;
+	}
+	return 0;
+}
+
+static int coverage_bits(const UINT8 *map, int n)
+{
+	int i, bits = 0;
+
+	for (i = 0; i < n; i++)
+		bits += __builtin_popcount(map[i]);
+	return bits;
+}
+
+void coverage_report(FILE *f, const char *nl)
+{
+	int i, both = 0, one = 0, pages = 0;
+	UINT8 t, n;
+
+	coverage_poll();
+	for (i = 0; i < PAGES; i++)
+		pages += paged[i];
+	for (i = 0; i < BITMAP; i++) {
+		t = taken[i];
+		n = nottaken[i];
+		both += __builtin_popcount(t & n);
+		one += __builtin_popcount(t ^ n);
+	}
+	fprintf(f, "coverage: %d instructions run in %d pages, branches %d both ways, %d one way%s%s",
+	    coverage_bits(run, BITMAP), pages, both, one, gaps ? ", with gaps" : "", nl);
+}
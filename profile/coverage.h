@@ -0,0 +1,71 @@
+/*
+ * coverage.h - which code ran, and which way its branches went
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../z180/z180.h"
+
+#define COVERAGE_MAGIC "Z180COV"
+#define COVERAGE_VERSION 1
+#define COVERAGE_NAMELEN 16
+#define COVERAGE_PAGE 4096
+
+/* A coverage file is the header, then a record for every 4K page of the
+ * physical address space that ran code. Bitmaps have bit n & 7 of byte
+ * n >> 3 for the address n in the page. */
+struct coverage_header {
+	char magic[8];
+	uint32_t version;
+	char machine[COVERAGE_NAMELEN];
+	uint32_t pages;
+};
+
+struct coverage_page {
+	uint32_t page;				/* physical address >> 12 */
+	uint16_t pc;				/* logical address it ran at last */
+	uint16_t reserved;
+	uint8_t code[COVERAGE_PAGE];		/* the memory, at the end */
+	uint8_t run[COVERAGE_PAGE / 8];		/* an instruction started here */
+	uint8_t taken[COVERAGE_PAGE / 8];	/* a conditional one branched */
+	uint8_t nottaken[COVERAGE_PAGE / 8];	/* and did not */
+};
+
+/* Start noting what the cpu runs, from nothing. With a file the coverage
+ * is written there at coverage_close(). -1 on error. */
+extern int coverage_open(device_t *cpu, const char *machine, const char *file);
+extern int coverage_active();
+/* from nothing again */
+extern void coverage_clear();
+/* call at slice boundaries: notes what ran in the slice */
+extern void coverage_poll();
+/* write the coverage so far to file, -1 on error */
+extern int coverage_write(const char *file);
+/* stop, and write the coverage if there is a file for it */
+extern void coverage_close();
+/* in a clone: from nothing, for a coverage in file */
+extern int coverage_clone(const char *file);
+/* instructions and branches covered, lines ending in nl */
+extern void coverage_report(FILE *f, const char *nl);
+
+#endif /* COVERAGE_H */
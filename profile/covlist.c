@@ -0,0 +1,227 @@
+/*
+ * covlist.c - list the code in coverage files written by the emulator
+ * (see coverage.c), marking what ran and which way its branches went
+ *
+ * The files given are merged, so that the coverage of several runs, say
+ * of every boot test, can be listed as one. Every page that ran code is
+ * disassembled at the logical address it ran at; where code did not run
+ * the listing follows on from the last instruction, and is taken up
+ * again at the next one that ran. Runs of 00 or FF bytes that did not
+ * run are shown as ds.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coverage.h"
+#include "symbols.h"
+#include "../z180/z80common.h"
+
+#define PAGES 256
+/* the shortest run of fill bytes shown as ds */
+#define MINFILL 16
+
+static const char *prg;
+static struct coverage_page *pages[PAGES];
+static char machine[COVERAGE_NAMELEN];
+
+static void usage(void)
+{
+	fprintf(stderr, "%s [-y mapfile] [-s] covfile...\n", prg);
+	fprintf(stderr, "  -y mapfile   label the code with the symbols of mapfile\n");
+	fprintf(stderr, "  -s           only the summary\n");
+	exit(1);
+}
+
+static void fail(const char *file, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", prg, file, what);
+	exit(1);
+}
+
+#define ISSET(map, n) ((map)[(n) >> 3] & 1 << ((n) & 7))
+
+/* add the coverage in file to what was read before */
+static void load(const char *file)
+{
+	struct coverage_header header;
+	struct coverage_page page, *p;
+	unsigned i, j;
+	FILE *f;
+
+	if (!(f = fopen(file, "rb"))) {
+		perror(file);
+		exit(1);
+	}
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, COVERAGE_MAGIC, sizeof(header.magic)))
+		fail(file, "not a coverage");
+	if (header.version != COVERAGE_VERSION)
+		fail(file, "coverage of another version");
+	header.machine[COVERAGE_NAMELEN - 1] = 0;
+	if (!machine[0])
+		strcpy(machine, header.machine);
+	else if (header.machine[0] && strcmp(machine, header.machine))
+		fprintf(stderr, "%s: %s: of %s, not %s\n", prg, file, header.machine, machine);
+	for (i = 0; i < header.pages; i++) {
+		if (fread(&page, sizeof(page), 1, f) != 1)
+			fail(file, "coverage is cut short");
+		if (page.page >= PAGES)
+			fail(file, "page out of range");
+		if (!(p = pages[page.page])) {
+			if (!(p = pages[page.page] = malloc(sizeof(*p))))
+				fail(file, "out of memory");
+			*p = page;
+			continue;
+		}
+		if (memcmp(p->code, page.code, sizeof(page.code)))
+			fprintf(stderr, "%s: %s: page $%05x holds other code, listing the first\n",
+			    prg, file, page.page << 12);
+		for (j = 0; j < sizeof(page.run); j++) {
+			p->run[j] |= page.run[j];
+			p->taken[j] |= page.taken[j];
+			p->nottaken[j] |= page.nottaken[j];
+		}
+	}
+	fclose(f);
+}
+
+/* fill bytes from pos that did not run, 0 if fewer than MINFILL */
+static int fill(const struct coverage_page *p, int pos)
+{
+	int n;
+
+	if (p->code[pos] != 0x00 && p->code[pos] != 0xff)
+		return 0;
+	for (n = 0; pos + n < COVERAGE_PAGE; n++)
+		if (p->code[pos + n] != p->code[pos] || ISSET(p->run, pos + n))
+			break;
+	return n < MINFILL ? 0 : n;
+}
+
+/* the bytes of the instruction at pos, zeroes past the end of the page */
+static void fetch(const struct coverage_page *p, int pos, UINT8 *op)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		op[i] = pos + i < COVERAGE_PAGE ? p->code[pos + i] : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int listing = 1, opt, i, j, pos, len, n;
+	unsigned long run = 0, notrun = 0, both = 0, one = 0, never = 0, prun, pnotrun;
+	struct coverage_page *p;
+	offs_t addr;
+	UINT16 pc;
+	UINT8 op[4];
+	char ibuf[32], obuf[9], name[64];
+	const char *branch;
+
+	prg = argv[0];
+	while ((opt = getopt(argc, argv, "y:s")) != -1) {
+		switch (opt) {
+			case 'y':
+				if (symbols_load(optarg) == -1) {
+					perror(optarg);
+					exit(1);
+				}
+				break;
+			case 's':
+				listing = 0;
+				break;
+			default:
+				usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+	for (i = optind; i < argc; i++)
+		load(argv[i]);
+
+	for (i = 0; i < PAGES; i++) {
+		if (!(p = pages[i]))
+			continue;
+		prun = pnotrun = 0;
+		if (listing)
+			printf("; page $%05x at $%04x\n", i << 12, p->pc);
+		for (pos = 0; pos < COVERAGE_PAGE; pos += len) {
+			addr = ((offs_t)i << 12) + pos;
+			pc = p->pc + pos;
+			if ((n = fill(p, pos))) {
+				if (listing)
+					printf("  -    $%05x %04x: %-8s %-5s %d,$%02X\n", addr, pc, "", "ds", n, p->code[pos]);
+				len = n;
+				continue;
+			}
+			fetch(p, pos, op);
+			len = cpu_disassemble_z180(NULL, ibuf, pc, op, op, 0) & DASMFLAG_LENGTHMASK;
+			/* not across an instruction that ran */
+			for (n = 1; n < len && pos + n < COVERAGE_PAGE; n++)
+				if (ISSET(p->run, pos + n))
+					break;
+			if (n < len) {
+				len = n;
+				n = sprintf(ibuf, "%-5s $%02X", "db", op[0]);
+				for (j = 1; j < len; j++)
+					n += sprintf(ibuf + n, ",$%02X", op[j]);
+			}
+			branch = "  ";
+			if (ISSET(p->run, pos)) {
+				run++;
+				prun++;
+				if (ISSET(p->taken, pos) && ISSET(p->nottaken, pos)) {
+					branch = "TN";
+					both++;
+				} else if (ISSET(p->taken, pos)) {
+					branch = "T ";
+					one++;
+				} else if (ISSET(p->nottaken, pos)) {
+					branch = " N";
+					one++;
+				} else if ((op[0] & 0xe7) == 0x20 || op[0] == 0x10 || (op[0] & 0xc7) == 0xc2 ||
+				    (op[0] & 0xc7) == 0xc4 || (op[0] & 0xc7) == 0xc0) {
+					/* ran, but only ever before an interrupt */
+					never++;
+				}
+			} else {
+				notrun++;
+				pnotrun++;
+			}
+			if (!listing)
+				continue;
+			if (symbols_name(addr, pc, name, sizeof(name)) && !strchr(name, '+'))
+				printf("%s:\n", name);
+			obuf[0] = 0;
+			for (n = 0; n < len; n++)
+				sprintf(obuf + 2 * n, "%02X", op[n]);
+			printf("  %c %s $%05x %04x: %-8s %s\n", ISSET(p->run, pos) ? '*' : '-', branch,
+			    addr, pc, obuf, ibuf);
+		}
+		if (listing)
+			printf("; %lu of %lu instructions run\n\n", prun, prun + pnotrun);
+	}
+	printf("%s%s%lu instructions run, %lu not run (%.1f%%); conditional branches %lu both ways, %lu one way, %lu unknown\n",
+	    machine, machine[0] ? ": " : "", run, notrun, run + notrun ? 100.0 * run / (run + notrun) : 0.0,
+	    both, one, never);
+	return 0;
+}
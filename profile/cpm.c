@@ -0,0 +1,379 @@
+/*
+ * cpm.c - count and time the BDOS and BIOS calls of a CP/M guest
+ *
+ * The calls are picked out of what the cpu's history ring holds when a
+ * slice ends, so this costs nothing while it is off. A
+ * BDOS call is an instruction run at 0005h, with the function in C. A
+ * BIOS call is a JP run in the jump table, which starts 3 bytes below
+ * where the JP at 0000h goes (WBOOT). This holds for CP/M 2.2, CP/M 3,
+ * ZSDOS and the like; MP/M finds its BDOS the same way.
+ *
+ * A call returns with the RET that leaves the stack pointer above the
+ * return address it was entered with, even when the BDOS has run on a
+ * stack of its own meanwhile. Its latency is the cycles from the entry to
+ * the instruction after that RET, and goes into a histogram of powers of
+ * two per function. Calls that do not return, BDOS 0 and BOOT and WBOOT,
+ * are only counted.
+ *
+ * The disk controllers tell of every command they get, with the cycle it
+ * came at (see cpm_ide_command() and its neighbours). A command counts
+ * for every call running at the time: BIOS READ and the BDOS F_READ that
+ * called it, so it shows where the disk time of the file system goes.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpm.h"
+
+#define BDOS 0x0005
+#define BDOS_FUNCS 256
+#define BIOS_FUNCS 33
+#define BUCKETS 48		/* powers of two of cycles */
+#define MAXPENDING 16
+#define MAXEVENTS 256		/* a power of 2 */
+
+enum cpm_disk { DISK_IDE, DISK_FDC, DISK_SD, DISKS };
+
+static const char *disk_names[DISKS] = { "ide", "fdc", "sd" };
+
+static const char *bdos_names[] = {
+	"P_TERMCPM", "C_READ", "C_WRITE", "A_READ", "A_WRITE", "L_WRITE",
+	"C_RAWIO", "A_STATIN", "A_STATOUT", "C_WRITESTR", "C_READSTR",
+	"C_STAT", "S_BDOSVER", "DRV_ALLRESET", "DRV_SET", "F_OPEN",
+	"F_CLOSE", "F_SFIRST", "F_SNEXT", "F_DELETE", "F_READ", "F_WRITE",
+	"F_MAKE", "F_RENAME", "DRV_LOGINVEC", "DRV_GET", "F_DMAOFF",
+	"DRV_ALLOCVEC", "DRV_SETRO", "DRV_ROVEC", "F_ATTRIB", "DRV_DPB",
+	"F_USERNUM", "F_READRAND", "F_WRITERAND", "F_SIZE", "F_RANDREC",
+	"DRV_RESET", "DRV_ACCESS", "DRV_FREE", "F_WRITEZF", "F_TESTWRITE",
+	"F_LOCK", "F_UNLOCK", "F_MULTISEC", "F_ERRMODE", "DRV_SPACE",
+	"P_CHAIN", "DRV_FLUSH", "S_SCB", "S_BIOS"
+};
+
+static const char *bios_names[BIOS_FUNCS] = {
+	"BOOT", "WBOOT", "CONST", "CONIN", "CONOUT", "LIST", "PUNCH",
+	"READER", "HOME", "SELDSK", "SETTRK", "SETSEC", "SETDMA", "READ",
+	"WRITE", "LISTST", "SECTRN", "CONOST", "AUXIST", "AUXOST", "DEVTBL",
+	"DEVINI", "DRVTBL", "MULTIO", "FLUSH", "MOVE", "TIME", "SELMEM",
+	"SETBNK", "XMOVE", "USERF", "RESERV1", "RESERV2"
+};
+
+struct calls {
+	uint64_t count, returned;
+	uint64_t cycles, min, max;	/* of those returned */
+	uint64_t hist[BUCKETS];
+	uint64_t disk[DISKS];
+};
+
+struct pending {
+	struct calls *calls;
+	UINT16 sp;		/* on entry, the return address is on top */
+	uint64_t start;
+	uint64_t disk[DISKS];
+};
+
+static device_t *cpu = NULL;
+static char *report = NULL;
+static struct calls bdos[BDOS_FUNCS], bios[BIOS_FUNCS];
+static struct pending pending[MAXPENDING];
+static int npending = 0;
+static struct {
+	uint64_t cycle;
+	int disk;
+} events[MAXEVENTS];
+static UINT32 event_head = 0, event_tail = 0;
+static uint64_t outside[DISKS], lostevents = 0;
+static int havebios = 0;
+static UINT16 biosbase;
+static UINT32 seq;
+static struct z180_history last;
+static int have_last = 0;
+static uint64_t first = 0, cycles = 0, gaps = 0;
+
+static int cpm_isret(const UINT8 *op)
+{
+	return op[0] == 0xc9 || (op[0] & 0xc7) == 0xc0 ||
+	    (op[0] == 0xed && (op[1] == 0x4d || op[1] == 0x45));
+}
+
+/* the disk commands that came up to cycle count for the calls running */
+static void cpm_events(uint64_t cycle)
+{
+	int i, d;
+
+	while (event_tail != event_head && events[event_tail & (MAXEVENTS - 1)].cycle <= cycle) {
+		d = events[event_tail++ & (MAXEVENTS - 1)].disk;
+		if (!npending)
+			outside[d]++;
+		for (i = 0; i < npending; i++)
+			pending[i].disk[d]++;
+	}
+}
+
+static void cpm_enter(struct calls *calls, const struct z180_history *h, int returns)
+{
+	calls->count++;
+	if (!returns)
+		return;
+	if (npending == MAXPENDING) {
+		/* the oldest never returned */
+		memmove(pending, pending + 1, (MAXPENDING - 1) * sizeof(*pending));
+		npending--;
+	}
+	memset(&pending[npending], 0, sizeof(*pending));
+	pending[npending].calls = calls;
+	pending[npending].sp = h->sp;
+	pending[npending].start = h->cycle;
+	npending++;
+}
+
+static void cpm_return(struct pending *p, uint64_t cycle)
+{
+	struct calls *c = p->calls;
+	uint64_t n = cycle - p->start;
+	int bucket = 0, d;
+
+	while (bucket < BUCKETS - 1 && n >> (bucket + 1))
+		bucket++;
+	if (!c->returned || n < c->min)
+		c->min = n;
+	if (n > c->max)
+		c->max = n;
+	c->returned++;
+	c->cycles += n;
+	c->hist[bucket]++;
+	for (d = 0; d < DISKS; d++)
+		c->disk[d] += p->disk[d];
+}
+
+/* a ran, b after it */
+static void cpm_count(const struct z180_history *a, const struct z180_history *b)
+{
+	UINT16 sp = b->irq ? b->sp + 2 : b->sp;
+	int i, n;
+
+	cpm_events(b->cycle);
+	if (cpm_isret(a->op) && sp == (UINT16)(a->sp + 2))
+		for (i = npending - 1; i >= 0; i--)
+			if (pending[i].sp == a->sp) {
+				cpm_return(&pending[i], b->cycle);
+				/* and those above it, that never returned */
+				npending = i;
+				break;
+			}
+	if (b->pc == BDOS)
+		cpm_enter(&bdos[b->bc & 0xff], b, (b->bc & 0xff) != 0);
+	else if (havebios && b->op[0] == 0xc3 && (UINT16)(b->pc - biosbase) < 3 * BIOS_FUNCS &&
+	    (b->pc - biosbase) % 3 == 0) {
+		n = (b->pc - biosbase) / 3;
+		cpm_enter(&bios[n], b, n > 1);
+	}
+}
+
+static void cpm_disk(int disk)
+{
+	if (!cpu)
+		return;
+	if (event_head - event_tail == MAXEVENTS) {
+		lostevents++;
+		return;
+	}
+	events[event_head & (MAXEVENTS - 1)].cycle = z180_get_cycles(cpu);
+	events[event_head++ & (MAXEVENTS - 1)].disk = disk;
+}
+
+void cpm_ide_command(uint8_t command)
+{
+	cpm_disk(DISK_IDE);
+}
+
+void cpm_fdc_command(uint8_t command)
+{
+	cpm_disk(DISK_FDC);
+}
+
+void cpm_sd_command(uint8_t command)
+{
+	cpm_disk(DISK_SD);
+}
+
+void cpm_clear()
+{
+	memset(bdos, 0, sizeof(bdos));
+	memset(bios, 0, sizeof(bios));
+	memset(outside, 0, sizeof(outside));
+	npending = 0;
+	event_tail = event_head;
+	lostevents = gaps = cycles = 0;
+	have_last = 0;
+	if (cpu) {
+		seq = z180_history_seq(cpu);
+		first = z180_get_cycles(cpu);
+	}
+}
+
+int cpm_open(device_t *device, const char *file)
+{
+	cpm_close();
+	if (z180_history_reserve(device) == -1)
+		return -1;
+	free(report);
+	report = NULL;
+	if (file && !(report = strdup(file)))
+		return -1;
+	cpu = device;
+	cpm_clear();
+	return 0;
+}
+
+int cpm_active()
+{
+	return cpu != NULL;
+}
+
+void cpm_poll()
+{
+	struct z180_history h;
+	int r;
+
+	if (!cpu)
+		return;
+	/* page zero as it is now, the BIOS does not move while it runs */
+	havebios = z180_peek(cpu, 0) == 0xc3;
+	biosbase = (z180_peek(cpu, 1) | z180_peek(cpu, 2) << 8) - 3;
+	while ((r = z180_history_next(cpu, &seq, &h))) {
+		if (r == -1) {
+			/* what was running is not known any more */
+			have_last = 0;
+			npending = 0;
+			gaps++;
+			continue;
+		}
+		if (have_last)
+			cpm_count(&last, &h);
+		last = h;
+		have_last = 1;
+		cycles = h.cycle - first;
+	}
+}
+
+void cpm_close()
+{
+	FILE *f;
+
+	if (!cpu)
+		return;
+	cpm_poll();
+	if (report) {
+		if ((f = fopen(report, "w"))) {
+			cpm_report(f, "\n");
+			fclose(f);
+		} else
+			perror(report);
+	}
+	cpu = NULL;
+}
+
+int cpm_clone(const char *file)
+{
+	if (!cpu)
+		return 0;
+	cpm_clear();
+	if (report) {
+		free(report);
+		if (!(report = strdup(file)))
+			return -1;
+	}
+	return 0;
+}
+
+/* 1536 as 1K, 3000000 as 2M */
+static const char *cpm_size(uint64_t n, char *buf)
+{
+	const char *units = "KMGT";
+	int u = -1;
+
+	while (n >= 1024 && u < 3) {
+		n >>= 10;
+		u++;
+	}
+	if (u == -1)
+		sprintf(buf, "%llu", (unsigned long long)n);
+	else
+		sprintf(buf, "%llu%c", (unsigned long long)n, units[u]);
+	return buf;
+}
+
+static void cpm_table(FILE *f, const char *title, struct calls *calls, int n,
+    const char **names, int nnames, const char *nl)
+{
+	char name[16], lo[16], hi[16];
+	struct calls *c;
+	int i, b, d;
+
+	fprintf(f, "%s%-16s    calls returned      cycles      %%       avg       min       max", nl, title);
+	for (d = 0; d < DISKS; d++)
+		fprintf(f, " %5s", disk_names[d]);
+	fprintf(f, "%s", nl);
+	for (i = 0; i < n; i++) {
+		c = &calls[i];
+		if (!c->count)
+			continue;
+		if (i < nnames)
+			snprintf(name, sizeof(name), "%s", names[i]);
+		else
+			sprintf(name, "-");
+		fprintf(f, "%3d %-12s %8llu %8llu %11llu %6.2f %9llu %9llu %9llu", i, name,
+		    (unsigned long long)c->count, (unsigned long long)c->returned,
+		    (unsigned long long)c->cycles, cycles ? 100.0 * c->cycles / cycles : 0.0,
+		    (unsigned long long)(c->returned ? c->cycles / c->returned : 0),
+		    (unsigned long long)c->min, (unsigned long long)c->max);
+		for (d = 0; d < DISKS; d++)
+			fprintf(f, " %5llu", (unsigned long long)c->disk[d]);
+		fprintf(f, "%s", nl);
+		if (!c->returned)
+			continue;
+		fprintf(f, "                ");
+		for (b = 0; b < BUCKETS; b++)
+			if (c->hist[b])
+				fprintf(f, " %s-%s:%llu", cpm_size(1ULL << b, lo), cpm_size(2ULL << b, hi),
+				    (unsigned long long)c->hist[b]);
+		fprintf(f, "%s", nl);
+	}
+}
+
+void cpm_report(FILE *f, const char *nl)
+{
+	int d;
+
+	cpm_poll();
+	fprintf(f, "cp/m: calls in %llu cycles", (unsigned long long)cycles);
+	if (havebios)
+		fprintf(f, ", BIOS at $%04X", biosbase);
+	fprintf(f, "%s%s", gaps ? ", with gaps" : "", nl);
+	cpm_table(f, "BDOS", bdos, BDOS_FUNCS, bdos_names, sizeof(bdos_names) / sizeof(*bdos_names), nl);
+	cpm_table(f, "BIOS", bios, BIOS_FUNCS, bios_names, BIOS_FUNCS, nl);
+	fprintf(f, "%sdisk commands outside of calls:", nl);
+	for (d = 0; d < DISKS; d++)
+		fprintf(f, " %s %llu", disk_names[d], (unsigned long long)outside[d]);
+	fprintf(f, "%s", nl);
+	if (lostevents)
+		fprintf(f, "(%llu disk commands not counted)%s", (unsigned long long)lostevents, nl);
+}
@@ -0,0 +1,50 @@
+/*
+ * cpm.h - count and time the BDOS and BIOS calls of a CP/M guest
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef CPM_H
+#define CPM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../z180/z180.h"
+
+/* Start watching the calls of the cpu, from zero. With a file the report
+ * goes there at cpm_close(). -1 on error. */
+extern int cpm_open(device_t *cpu, const char *file);
+extern int cpm_active();
+/* count from zero again */
+extern void cpm_clear();
+/* call at slice boundaries: follows what ran in the slice */
+extern void cpm_poll();
+/* stop, and write the report if there is a file for it */
+extern void cpm_close();
+/* in a clone: count from zero, for a report in file */
+extern int cpm_clone(const char *file);
+/* calls, latencies and disk commands per function, lines ending in nl */
+extern void cpm_report(FILE *f, const char *nl);
+
+/* for the command hooks of the disk controllers, see ide.h, fdc.h and
+ * sdcard.h */
+extern void cpm_ide_command(uint8_t command);
+extern void cpm_fdc_command(uint8_t command);
+extern void cpm_sd_command(uint8_t command);
+
+#endif /* CPM_H */
@@ -0,0 +1,253 @@
+/*
+ * memstats.c - accesses per physical page, remaps of memory and DMA
+ *
+ * For tuning where banked systems like MP/M or UZI180 put what: the cpu
+ * counts the reads, writes and fetches of every 4K page of the physical
+ * address space and the bytes its DMA channels move (see
+ * z180_set_memstats()), and every write to CBR, BBR and CBAR, or on the
+ * Z182 to the chip select registers SCR, RAMUBR, RAMLBR and ROMBR, is
+ * counted here by the register and the pc that wrote it.
+ *
+ * The counts are written as CSV with the columns kind,register,address,
+ * count, a row for each of:
+ *   cycles,,,cycles counted in
+ *   read|write|fetch,,page,accesses	for the pages accessed
+ *   dma,channel,,bytes
+ *   remap,register,pc,writes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memstats.h"
+#include "symbols.h"
+
+#define PAGES 256
+#define MAXSITES 256
+#define REGS 7
+
+/* a pc that remaps memory */
+struct site {
+	int reg;
+	UINT16 pc;
+	uint64_t count;
+};
+
+static const struct {
+	int reg;
+	const char *name;
+} regs[REGS] = {
+	{ Z180_CBR, "CBR" }, { Z180_BBR, "BBR" }, { Z180_CBAR, "CBAR" },
+	{ Z182_SCR, "SCR" }, { Z182_RAMUBR, "RAMUBR" }, { Z182_RAMLBR, "RAMLBR" },
+	{ Z182_ROMBR, "ROMBR" }
+};
+
+static device_t *cpu = NULL;
+static char *file_name = NULL;
+static struct z180_memstats stats;
+static uint64_t start;
+static uint64_t remaps[REGS];
+static struct site sites[MAXSITES];
+static int nsites = 0;
+static uint64_t lostsites = 0;
+
+static int memstats_reg(int reg)
+{
+	int r;
+
+	for (r = 0; r < REGS; r++)
+		if (regs[r].reg == reg)
+			return r;
+	return -1;
+}
+
+static void memstats_remap(device_t *device, int reg, UINT8 value, UINT16 pc)
+{
+	int r = memstats_reg(reg), i;
+
+	if (r == -1)
+		return;
+	remaps[r]++;
+	for (i = 0; i < nsites; i++)
+		if (sites[i].reg == r && sites[i].pc == pc) {
+			sites[i].count++;
+			return;
+		}
+	if (nsites == MAXSITES) {
+		lostsites++;
+		return;
+	}
+	sites[nsites].reg = r;
+	sites[nsites].pc = pc;
+	sites[nsites].count = 1;
+	nsites++;
+}
+
+void memstats_clear()
+{
+	memset(&stats, 0, sizeof(stats));
+	memset(remaps, 0, sizeof(remaps));
+	nsites = 0;
+	lostsites = 0;
+	if (cpu)
+		start = z180_get_cycles(cpu);
+}
+
+int memstats_open(device_t *device, const char *file)
+{
+	memstats_close();
+	free(file_name);
+	file_name = NULL;
+	if (file && !(file_name = strdup(file)))
+		return -1;
+	cpu = device;
+	memstats_clear();
+	z180_set_memstats(cpu, &stats);
+	z180_set_remap_watch(cpu, memstats_remap);
+	return 0;
+}
+
+int memstats_active()
+{
+	return cpu != NULL;
+}
+
+int memstats_write(const char *file)
+{
+	static const char *kinds[3] = { "read", "write", "fetch" };
+	const uint64_t *counts[3] = { stats.read, stats.write, stats.fetch };
+	FILE *f;
+	int i, k;
+
+	if (!(f = fopen(file, "w")))
+		return -1;
+	fprintf(f, "kind,register,address,count\n");
+	fprintf(f, "cycles,,,%llu\n", (unsigned long long)(z180_get_cycles(cpu) - start));
+	for (k = 0; k < 3; k++)
+		for (i = 0; i < PAGES; i++)
+			if (counts[k][i])
+				fprintf(f, "%s,,0x%05x,%llu\n", kinds[k], i << 12, (unsigned long long)counts[k][i]);
+	for (i = 0; i < 2; i++)
+		fprintf(f, "dma,%d,,%llu\n", i, (unsigned long long)stats.dma[i]);
+	for (i = 0; i < nsites; i++)
+		fprintf(f, "remap,%s,0x%04x,%llu\n", regs[sites[i].reg].name, sites[i].pc,
+		    (unsigned long long)sites[i].count);
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+void memstats_close()
+{
+	if (!cpu)
+		return;
+	if (file_name && memstats_write(file_name) == -1)
+		perror(file_name);
+	z180_set_memstats(cpu, NULL);
+	z180_set_remap_watch(cpu, NULL);
+	cpu = NULL;
+}
+
+int memstats_clone(const char *file)
+{
+	if (!cpu)
+		return 0;
+	memstats_clear();
+	if (file_name) {
+		free(file_name);
+		if (!(file_name = strdup(file)))
+			return -1;
+	}
+	return 0;
+}
+
+static uint64_t memstats_page(int i)
+{
+	return stats.read[i] + stats.write[i] + stats.fetch[i];
+}
+
+static int memstats_bypage(const void *a, const void *b)
+{
+	uint64_t x = memstats_page(*(const int *)a), y = memstats_page(*(const int *)b);
+	return x < y ? 1 : x > y ? -1 : *(const int *)a - *(const int *)b;
+}
+
+static int memstats_bycount(const void *a, const void *b)
+{
+	const struct site *x = a, *y = b;
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : x->pc - y->pc;
+}
+
+/* bits in n, a log2 scale for the map */
+static int memstats_bits(uint64_t n)
+{
+	int b = 0;
+
+	while (n) {
+		n >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void memstats_report(FILE *f, int n, const char *nl)
+{
+	static const char shades[] = " .:-=+*#%@";
+	int order[PAGES], i, j, top;
+	uint64_t total = 0, max = 0;
+	char name[64];
+
+	for (i = 0; i < PAGES; i++) {
+		order[i] = i;
+		total += memstats_page(i);
+		if (memstats_page(i) > max)
+			max = memstats_page(i);
+	}
+	fprintf(f, "memory: %llu accesses in %llu cycles%s", (unsigned long long)total,
+	    (unsigned long long)(z180_get_cycles(cpu) - start), nl);
+	fprintf(f, "        0123456789ABCDEF  (4K pages, %s from least to most)%s", shades + 1, nl);
+	top = memstats_bits(max);
+	for (i = 0; i < PAGES; i += 16) {
+		fprintf(f, "  $%Xxxxx ", i >> 4);
+		for (j = i; j < i + 16; j++)
+			putc(memstats_page(j) ? shades[1 + (memstats_bits(memstats_page(j)) - 1) * 9 / top] : ' ', f);
+		fprintf(f, "%s", nl);
+	}
+
+	qsort(order, PAGES, sizeof(*order), memstats_bypage);
+	fprintf(f, "%s  page          reads         writes        fetches%s", nl, nl);
+	for (i = 0; i < n && i < PAGES && memstats_page(order[i]); i++)
+		fprintf(f, "  $%05X %14llu %14llu %14llu%s", order[i] << 12,
+		    (unsigned long long)stats.read[order[i]], (unsigned long long)stats.write[order[i]],
+		    (unsigned long long)stats.fetch[order[i]], nl);
+
+	fprintf(f, "%sremaps:", nl);
+	for (i = 0; i < REGS; i++)
+		if (i < 3 || remaps[i])
+			fprintf(f, " %s %llu", regs[i].name, (unsigned long long)remaps[i]);
+	fprintf(f, "%s", nl);
+	qsort(sites, nsites, sizeof(*sites), memstats_bycount);
+	for (i = 0; i < n && i < nsites; i++)
+		fprintf(f, "  $%04X %-24s %-6s %12llu%s", sites[i].pc,
+		    symbols_name(sites[i].pc, sites[i].pc, name, sizeof(name)) ? name : "",
+		    regs[sites[i].reg].name, (unsigned long long)sites[i].count, nl);
+	if (lostsites)
+		fprintf(f, "  (%llu remaps from more pcs)%s", (unsigned long long)lostsites, nl);
+	fprintf(f, "dma: channel 0 %llu bytes, channel 1 %llu bytes%s",
+	    (unsigned long long)stats.dma[0], (unsigned long long)stats.dma[1], nl);
+}
@@ -0,0 +1,44 @@
+/*
+ * memstats.h - accesses per physical page, remaps of memory and DMA
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <stdio.h>
+
+#include "../z180/z180.h"
+
+/* Start counting the memory accesses of the cpu, from zero. With a file
+ * the counts are written there as CSV at memstats_close(). -1 on error. */
+extern int memstats_open(device_t *cpu, const char *file);
+extern int memstats_active();
+/* count from zero again */
+extern void memstats_clear();
+/* write the counts so far to file as CSV, -1 on error */
+extern int memstats_write(const char *file);
+/* stop, and write the counts if there is a file for them */
+extern void memstats_close();
+/* in a clone: count from zero, for a CSV in file */
+extern int memstats_clone(const char *file);
+/* a map of the pages by accesses, the n hottest pages, the remaps by
+ * register and by pc and the DMA, lines ending in nl */
+extern void memstats_report(FILE *f, int n, const char *nl);
+
+#endif /* MEMSTATS_H */
@@ -0,0 +1,317 @@
+/*
+ * profile.c - count instructions and cycles per address of the code run
+ *
+ * Like the trace, the profile is taken from the cpu's history ring at the
+ * end of every slice, so the cpu loop does no more than it does for the
+ * history. Every instruction is counted, and gets the cycles up to the
+ * one after it, at its physical address: code in different banks at the
+ * same logical address is counted apart. The counters are kept per 4K
+ * page of the physical address space, for the pages that run code.
+ *
+ * A jump back, or a repeating block instruction, is counted as a loop
+ * from its target to it; the cycles of a loop are those of the addresses
+ * in it, so a call in a loop is not in them.
+ *
+ * The report lists the hottest addresses and loops, disassembled, and
+ * named from a map file if one is loaded (see symbols.c).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "symbols.h"
+
+#define PAGES 256
+#define PAGESIZE 4096
+#define MAXLOOPS 8192		/* a power of 2 */
+#define LOOPSPAN 0x1000		/* longer jumps back are not loops */
+
+struct spot {
+	uint64_t cycles;
+	uint32_t count;
+	UINT16 pc;
+	UINT8 op[4];
+	UINT8 len;
+};
+
+struct loop {
+	offs_t from, to;	/* the jump, and its target */
+	UINT16 pc;		/* of the target */
+	uint64_t count;
+	uint64_t cycles;	/* for the report */
+};
+
+static device_t *cpu = NULL;
+static char *report = NULL;
+static struct spot *pages[PAGES];
+static struct loop loops[MAXLOOPS];
+static int nloops = 0;
+static UINT32 seq;
+static struct z180_history last;
+static int have_last = 0;
+static uint64_t instructions = 0, cycles = 0, gaps = 0, lostloops = 0;
+
+static struct spot *profile_spot(offs_t addr)
+{
+	struct spot **page = &pages[(addr >> 12) & (PAGES - 1)];
+
+	if (!*page && !(*page = calloc(PAGESIZE, sizeof(struct spot))))
+		return NULL;
+	return *page + (addr & (PAGESIZE - 1));
+}
+
+/* jumps that can go back: djnz, jr, jp, and the repeating block ops */
+static int profile_isjump(const UINT8 *op)
+{
+	if (op[0] == 0x10 || op[0] == 0x18 || (op[0] & 0xe7) == 0x20 ||
+	    op[0] == 0xc3 || (op[0] & 0xc7) == 0xc2 || op[0] == 0xe9)
+		return 1;
+	if (op[0] == 0xed)
+		return (op[1] & 0xf4) == 0xb0 || (op[1] & 0xf7) == 0x93;
+	if (op[0] == 0xdd || op[0] == 0xfd)
+		return op[1] == 0xe9;
+	return 0;
+}
+
+static void profile_loop(const struct z180_history *a, const struct z180_history *b)
+{
+	UINT32 i = (a->addr * 31 + b->addr) & (MAXLOOPS - 1);
+
+	for (;;) {
+		if (loops[i].count == 0) {
+			if (nloops >= MAXLOOPS * 3 / 4) {
+				lostloops++;
+				return;
+			}
+			nloops++;
+			loops[i].from = a->addr;
+			loops[i].to = b->addr;
+			loops[i].pc = b->pc;
+			break;
+		}
+		if (loops[i].from == a->addr && loops[i].to == b->addr)
+			break;
+		i = (i + 1) & (MAXLOOPS - 1);
+	}
+	loops[i].count++;
+}
+
+/* a ran, b after it */
+static void profile_count(const struct z180_history *a, const struct z180_history *b)
+{
+	struct spot *s = profile_spot(a->addr);
+	uint64_t n = b->cycle - a->cycle;
+
+	if (!s || b->cycle < a->cycle)
+		return;
+	s->count++;
+	s->cycles += n;
+	s->pc = a->pc;
+	memcpy(s->op, a->op, sizeof(s->op));
+	s->len = a->len;
+	instructions++;
+	cycles += n;
+	if (b->addr <= a->addr && a->addr - b->addr < LOOPSPAN &&
+	    b->pc != ((a->pc + a->len) & 0xffff) && profile_isjump(a->op))
+		profile_loop(a, b);
+}
+
+void profile_clear()
+{
+	int i;
+
+	for (i = 0; i < PAGES; i++) {
+		free(pages[i]);
+		pages[i] = NULL;
+	}
+	memset(loops, 0, sizeof(loops));
+	nloops = 0;
+	instructions = cycles = gaps = lostloops = 0;
+	have_last = 0;
+	if (cpu)
+		seq = z180_history_seq(cpu);
+}
+
+int profile_open(device_t *device, const char *file)
+{
+	profile_close();
+	if (z180_history_reserve(device) == -1)
+		return -1;
+	free(report);
+	report = NULL;
+	if (file && !(report = strdup(file)))
+		return -1;
+	profile_clear();
+	cpu = device;
+	seq = z180_history_seq(cpu);
+	return 0;
+}
+
+int profile_active()
+{
+	return cpu != NULL;
+}
+
+void profile_poll()
+{
+	struct z180_history h;
+	int r;
+
+	if (!cpu)
+		return;
+	while ((r = z180_history_next(cpu, &seq, &h))) {
+		if (r == -1) {
+			have_last = 0;
+			gaps++;
+			continue;
+		}
+		if (have_last)
+			profile_count(&last, &h);
+		last = h;
+		have_last = 1;
+	}
+}
+
+void profile_close()
+{
+	FILE *f;
+
+	if (!cpu)
+		return;
+	profile_poll();
+	if (report) {
+		if ((f = fopen(report, "w"))) {
+			profile_report(f, 50, "\n");
+			fclose(f);
+		} else
+			perror(report);
+	}
+	cpu = NULL;
+}
+
+int profile_clone(const char *file)
+{
+	if (!cpu)
+		return 0;
+	profile_clear();
+	if (report) {
+		free(report);
+		if (!(report = strdup(file)))
+			return -1;
+	}
+	return 0;
+}
+
+static int profile_cmpspot(const void *a, const void *b)
+{
+	uint64_t ca = (*(struct spot * const *)a)->cycles, cb = (*(struct spot * const *)b)->cycles;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static int profile_cmploop(const void *a, const void *b)
+{
+	uint64_t ca = (*(struct loop * const *)a)->cycles, cb = (*(struct loop * const *)b)->cycles;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static const char *profile_name(offs_t addr, UINT16 pc)
+{
+	static char name[64];
+
+	return symbols_name(addr, pc, name, sizeof(name)) ? name : "";
+}
+
+static double profile_percent(uint64_t n)
+{
+	return cycles ? 100.0 * n / cycles : 0.0;
+}
+
+void profile_report(FILE *f, int n, const char *nl)
+{
+	struct spot **spots, *s;
+	struct loop **hot;
+	char ibuf[32];
+	offs_t addr, a;
+	int nspots = 0, nhot = 0, i, j;
+
+	profile_poll();
+	fprintf(f, "profile: %llu instructions, %llu cycles%s%s",
+	    (unsigned long long)instructions, (unsigned long long)cycles,
+	    gaps ? ", with gaps" : "", nl);
+	for (i = 0; i < PAGES; i++)
+		if (pages[i])
+			for (j = 0; j < PAGESIZE; j++)
+				nspots += pages[i][j].count != 0;
+	spots = malloc((nspots + 1) * sizeof(*spots));
+	hot = malloc((nloops + 1) * sizeof(*hot));
+	if (!spots || !hot) {
+		free(spots);
+		free(hot);
+		return;
+	}
+	nspots = 0;
+	for (i = 0; i < PAGES; i++)
+		if (pages[i])
+			for (j = 0; j < PAGESIZE; j++)
+				if (pages[i][j].count)
+					spots[nspots++] = &pages[i][j];
+	qsort(spots, nspots, sizeof(*spots), profile_cmpspot);
+
+	fprintf(f, "%s      cycles      %%       count  address      code      instruction         symbol%s", nl, nl);
+	for (i = 0; i < n && i < nspots; i++) {
+		s = spots[i];
+		for (j = 0; j < PAGES; j++)
+			if (s >= pages[j] && s < pages[j] + PAGESIZE)
+				break;
+		addr = (offs_t)j << 12 | (offs_t)(s - pages[j]);
+		cpu_disassemble_z180(NULL, ibuf, s->pc, s->op, s->op, 0);
+		fprintf(f, "%12llu %6.2f %11lu  $%05x %04x  ", (unsigned long long)s->cycles,
+		    profile_percent(s->cycles), (unsigned long)s->count, addr, s->pc);
+		for (j = 0; j < 4; j++)
+			if (j < s->len)
+				fprintf(f, "%02X", s->op[j]);
+			else
+				fprintf(f, "  ");
+		fprintf(f, "  %-19s %s%s", ibuf, profile_name(addr, s->pc), nl);
+	}
+
+	for (i = 0; i < MAXLOOPS; i++)
+		if (loops[i].count) {
+			loops[i].cycles = 0;
+			for (a = loops[i].to; a <= loops[i].from; a++)
+				if ((s = pages[a >> 12] ? &pages[a >> 12][a & (PAGESIZE - 1)] : NULL))
+					loops[i].cycles += s->cycles;
+			hot[nhot++] = &loops[i];
+		}
+	qsort(hot, nhot, sizeof(*hot), profile_cmploop);
+	fprintf(f, "%s      cycles      %%  iterations  loop               symbol%s", nl, nl);
+	for (i = 0; i < n && i < nhot; i++)
+		fprintf(f, "%12llu %6.2f %11llu  $%05x-$%05x %04x  %s%s",
+		    (unsigned long long)hot[i]->cycles, profile_percent(hot[i]->cycles),
+		    (unsigned long long)hot[i]->count, hot[i]->to, hot[i]->from, hot[i]->pc,
+		    profile_name(hot[i]->to, hot[i]->pc), nl);
+	if (lostloops)
+		fprintf(f, "(%llu jumps back not counted, too many loops)%s", (unsigned long long)lostloops, nl);
+	free(spots);
+	free(hot);
+}
@@ -0,0 +1,44 @@
+/*
+ * profile.h - count instructions and cycles per address of the code run
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../z180/z180.h"
+
+/* Start counting, from zero, what the cpu runs. With a file the report
+ * goes there at profile_close(). -1 on error. */
+extern int profile_open(device_t *cpu, const char *file);
+extern int profile_active();
+/* count from zero again */
+extern void profile_clear();
+/* call at slice boundaries: counts what ran in the slice */
+extern void profile_poll();
+/* stop counting, and write the report if there is a file for it */
+extern void profile_close();
+/* in a clone: count from zero, for a report in file */
+extern int profile_clone(const char *file);
+/* the n hottest addresses and loops, lines ending in nl */
+extern void profile_report(FILE *f, int n, const char *nl);
+
+#endif /* PROFILE_H */
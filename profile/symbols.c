@@ -0,0 +1,185 @@
+/*
+ * symbols.c - names for guest addresses, from a map file
+ *
+ * The map files of the usual tools are read without being told which
+ * tool made them: a line with an address first has address and name
+ * pairs (.SYM of L80 and SLR, zmac, the SDCC .map), otherwise the first
+ * name on it gets the first number after it (name EQU 1234H, name = $1234,
+ * DEF name 0x1234 of SDCC .noi). Numbers are hex, as these tools write
+ * them, with or without 0x, $ or H.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "symbols.h"
+
+#define MAXLINE 512
+#define MAXTOKENS 32
+/* farther than this from the symbol below, an address has no name */
+#define MAXOFFSET 0x1000
+
+struct symbol {
+	offs_t value;
+	char *name;
+};
+
+static struct symbol *symbols = NULL;
+static int nsymbols = 0, maxsymbols = 0;
+/* the first physical symbol, those below are logical */
+static int nlogical = 0;
+
+static const char *keywords[] = { "DEF", "DEFINE", "GLOBAL", "PUBLIC", NULL };
+
+static int symbols_number(const char *tok, offs_t *value)
+{
+	size_t len = strlen(tok);
+	const char *p = tok;
+	char *end;
+
+	if (*p == '$')
+		p++;
+	else if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+		p += 2;
+	else if (len > 1 && (tok[len - 1] == 'H' || tok[len - 1] == 'h'))
+		len--;
+	else if (len < 4)
+		return 0;	/* BC, ADD: names */
+	if (!isxdigit((unsigned char)*p))
+		return 0;
+	*value = strtoul(p, &end, 16);
+	return end == tok + len;
+}
+
+static int symbols_isname(const char *tok)
+{
+	return isalpha((unsigned char)*tok) || strchr("_.?@", *tok);
+}
+
+static int symbols_add(const char *name, offs_t value)
+{
+	struct symbol *s;
+
+	if (nsymbols == maxsymbols) {
+		maxsymbols = maxsymbols ? maxsymbols * 2 : 256;
+		if (!(s = realloc(symbols, maxsymbols * sizeof(*s))))
+			return -1;
+		symbols = s;
+	}
+	if (!(symbols[nsymbols].name = strdup(name)))
+		return -1;
+	symbols[nsymbols++].value = value & 0xfffff;
+	return 0;
+}
+
+static int symbols_cmp(const void *a, const void *b)
+{
+	offs_t va = ((const struct symbol *)a)->value, vb = ((const struct symbol *)b)->value;
+
+	return va < vb ? -1 : va > vb;
+}
+
+int symbols_load(const char *file)
+{
+	char line[MAXLINE], *tok[MAXTOKENS], *p;
+	int ntok, i, k, n = 0;
+	offs_t value;
+	FILE *f;
+
+	if (!(f = fopen(file, "r")))
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if ((p = strchr(line, ';')))
+			*p = 0;
+		ntok = 0;
+		for (p = strtok(line, " \t\r\n:=,"); p && ntok < MAXTOKENS; p = strtok(NULL, " \t\r\n:=,"))
+			tok[ntok++] = p;
+		if (ntok < 2 || *tok[0] == '#')
+			continue;
+		if (symbols_number(tok[0], &value)) {
+			/* address name [address name ...] */
+			for (i = 0; i + 1 < ntok && symbols_number(tok[i], &value) && symbols_isname(tok[i + 1]); i += 2)
+				if (symbols_add(tok[i + 1], value) == 0)
+					n++;
+			continue;
+		}
+		/* [DEF] name ... number */
+		i = 0;
+		for (k = 0; keywords[k]; k++)
+			if (strcasecmp(tok[0], keywords[k]) == 0)
+				i = 1;
+		if (i >= ntok || !symbols_isname(tok[i]))
+			continue;
+		for (k = i + 1; k < ntok; k++)
+			if (symbols_number(tok[k], &value)) {
+				if (symbols_add(tok[i], value) == 0)
+					n++;
+				break;
+			}
+	}
+	fclose(f);
+	qsort(symbols, nsymbols, sizeof(*symbols), symbols_cmp);
+	for (nlogical = 0; nlogical < nsymbols && symbols[nlogical].value <= 0xffff; nlogical++)
+		;
+	return n;
+}
+
+int symbols_count()
+{
+	return nsymbols;
+}
+
+/* the last symbol in [lo, hi) at or below value, or -1 */
+static int symbols_below(int lo, int hi, offs_t value)
+{
+	int found = -1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (symbols[mid].value <= value) {
+			found = mid;
+			lo = mid + 1;
+		} else
+			hi = mid;
+	}
+	/* the first of those with this value */
+	while (found > 0 && symbols[found - 1].value == symbols[found].value)
+		found--;
+	return found;
+}
+
+const char *symbols_name(offs_t addr, UINT16 pc, char *buf, size_t size)
+{
+	offs_t value = addr;
+	int i = symbols_below(nlogical, nsymbols, addr);
+
+	if (i == -1 || addr - symbols[i].value >= MAXOFFSET) {
+		value = pc;
+		i = symbols_below(0, nlogical, pc);
+		if (i == -1 || pc - symbols[i].value >= MAXOFFSET)
+			return NULL;
+	}
+	if (value == symbols[i].value)
+		snprintf(buf, size, "%s", symbols[i].name);
+	else
+		snprintf(buf, size, "%s+%u", symbols[i].name, (unsigned)(value - symbols[i].value));
+	return buf;
+}
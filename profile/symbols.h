@@ -0,0 +1,39 @@
+/*
+ * symbols.h - names for guest addresses, from a map file
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+
+#include "../z180/z180.h"
+
+/* Load the symbols of a map file, adding to those loaded before. Returns
+ * the number of symbols read, or -1 if the file can not be read. */
+extern int symbols_load(const char *file);
+extern int symbols_count();
+/* The name of the code at physical address addr, logical address pc:
+ * "name" or "name+offset" of the nearest symbol below it, into buf.
+ * Symbols above $ffff are physical addresses, the others logical, and a
+ * physical one is taken first. Returns buf, or NULL if there is no
+ * symbol near. */
+extern const char *symbols_name(offs_t addr, UINT16 pc, char *buf, size_t size);
+
+#endif /* SYMBOLS_H */
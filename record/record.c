@@ -0,0 +1,543 @@
+/*
+ * record.c - record the inputs of a run, and replay them
+ *
+ * The machine itself is deterministic, what makes two runs differ is what
+ * comes from the host: bytes on the serial ports, whenever they happen to
+ * arrive, the time of day for the RTC, disk image swaps, and the images.
+ * In record mode every such input is logged with the CPU cycle it was
+ * taken at. In replay mode the serial bytes, times and swaps come from
+ * the log instead, each at exactly the cycle it was taken at before, so
+ * the run goes the same way again, bug and all.
+ *
+ * Disk image contents are not logged, only a checksum of every read, so
+ * replay must start with the images, and the NVRAM, as they were when
+ * recording started; a read that differs is reported. The same goes for
+ * the machine state: start both runs from reset, or from the same
+ * snapshot. Image I/O is done inline, worker threads would finish it at
+ * host speed.
+ *
+ * For going back in the debugger there is a second log, the journal, in
+ * a temporary file. It gets every input the guest took, from the host or
+ * from the replayed log. When the debugger restores a checkpoint, the
+ * journal is read from the position kept in the checkpoint, and inputs
+ * come from it until its end, where the run is back at the point it had
+ * got to before.
+ *
+ * A log is a stream of events: the cycles since the last event as a
+ * varint, a tag byte with the event type and port, and the data.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../hostio/hostio.h"
+#include "../media/media.h"
+#include "record.h"
+
+#define RECORD_MAGIC "Z180REC"
+#define RECORD_VERSION 1
+#define RECORD_NAMELEN 16
+#define MAXLINE 512
+
+enum record_type {
+	EV_RX = 1,	/* a serial byte */
+	EV_TIME,	/* the time of day changed, zigzag varint delta */
+	EV_DISK,	/* an image read: length varint, 32 bit checksum */
+	EV_MEDIA	/* a disk image swap: length varint, command */
+};
+
+struct record_header {
+	char magic[8];
+	uint32_t version;
+	char machine[RECORD_NAMELEN];
+	uint64_t start;		/* the cycle recording started at */
+};
+
+struct record_event {
+	uint64_t cycle;
+	int type;
+	int port;
+	uint64_t len;
+	uint32_t value;		/* the byte, or the checksum */
+	int64_t time;
+	char line[MAXLINE];
+};
+
+struct record_log {
+	FILE *f;
+	uint64_t last;		/* cycle of the last event written or read */
+	int64_t time;		/* the time of day the guest got */
+	int64_t next_time;	/* reading: the time of the events read */
+	/* reading: the next event, and where it starts */
+	struct record_event ev;
+	int have_ev;
+	long ev_offset;
+	uint64_t ev_last;
+	int64_t ev_time;
+};
+
+static int mode = RECORD_OFF;		/* of the log given by the user */
+static struct record_log user, journal;
+static int journaling = 0;
+static int rerun = 0;			/* inputs come from the journal */
+static device_t *cpu = NULL;
+static int diverged = 0;
+static int replaying_media = 0;		/* a swap from the journal, not a new one */
+
+uint64_t record_media_due = (uint64_t)-1;
+
+static void record_put_varint(struct record_log *l, uint64_t v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, l->f);
+		v >>= 7;
+	}
+	putc(v, l->f);
+}
+
+static int record_get_varint(struct record_log *l, uint64_t *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		if ((c = getc(l->f)) == EOF || shift > 63)
+			return -1;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+static void record_put_event(struct record_log *l, int type, int port)
+{
+	uint64_t now = z180_get_cycles(cpu);
+
+	record_put_varint(l, now - l->last);
+	putc(type << 4 | port, l->f);
+	l->last = now;
+}
+
+static void record_put_rx(struct record_log *l, int port, int c)
+{
+	record_put_event(l, EV_RX, port);
+	putc(c, l->f);
+}
+
+static void record_put_time(struct record_log *l, int64_t t)
+{
+	int64_t d = t - l->time;
+
+	if (!d)
+		return;
+	record_put_event(l, EV_TIME, 0);
+	record_put_varint(l, (uint64_t)(d << 1) ^ (uint64_t)(d >> 63));
+	l->time = t;
+}
+
+static void record_put_disk(struct record_log *l, size_t len, uint32_t sum)
+{
+	record_put_event(l, EV_DISK, 0);
+	record_put_varint(l, len);
+	fwrite(&sum, sizeof(sum), 1, l->f);
+}
+
+static void record_put_media(struct record_log *l, const char *line, size_t len)
+{
+	record_put_event(l, EV_MEDIA, 0);
+	record_put_varint(l, len);
+	fwrite(line, 1, len, l->f);
+}
+
+static uint32_t record_checksum(const uint8_t *p, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+/* where replayed inputs come from, NULL when live */
+static struct record_log *record_source()
+{
+	if (rerun)
+		return &journal;
+	if (mode == RECORD_REPLAY)
+		return &user;
+	return NULL;
+}
+
+/* the next event to come is a swap: it is due at its cycle */
+static void record_due()
+{
+	struct record_log *l = record_source();
+
+	if (l && l->have_ev && l->ev.type == EV_MEDIA)
+		record_media_due = l->ev.cycle;
+	else
+		record_media_due = (uint64_t)-1;
+}
+
+/* the end of a log: of the user's, go live, of the journal, go on with
+   what was there before the rewind */
+static void record_end(struct record_log *l)
+{
+	l->have_ev = 0;
+	if (l == &journal) {
+		fseek(l->f, 0, SEEK_END);
+		l->time = l->next_time;
+		rerun = 0;
+		record_due();
+		return;
+	}
+	printf("\r\nreplay: end of the recording at cycle %llu, running live from here\r\n",
+	    (unsigned long long)l->last);
+	fflush(stdout);
+	mode = RECORD_OFF;
+	record_due();
+	if (!journaling)
+		hostio_read_hook = NULL;
+}
+
+static void record_diverged(const char *what)
+{
+	if (!diverged)
+		printf("\r\nreplay: %s at cycle %llu, the run differs from the recording\r\n",
+		    what, (unsigned long long)z180_get_cycles(cpu));
+	diverged = 1;
+}
+
+/* read the next event of l into its ev */
+static void record_next(struct record_log *l)
+{
+	struct record_event *ev = &l->ev;
+	uint64_t delta, t;
+	int c;
+
+	l->have_ev = 0;
+	l->ev_offset = ftell(l->f);
+	l->ev_last = l->last;
+	l->ev_time = l->next_time;
+	if (record_get_varint(l, &delta) == -1 || (c = getc(l->f)) == EOF) {
+		record_end(l);
+		return;
+	}
+	ev->cycle = l->last += delta;
+	ev->type = c >> 4;
+	ev->port = c & 0x0f;
+	switch (ev->type) {
+		case EV_RX:
+			if ((c = getc(l->f)) == EOF)
+				goto bad;
+			ev->value = c;
+			break;
+		case EV_TIME:
+			if (record_get_varint(l, &t) == -1)
+				goto bad;
+			ev->time = l->next_time += (int64_t)(t >> 1) ^ -(int64_t)(t & 1);
+			break;
+		case EV_DISK:
+			if (record_get_varint(l, &ev->len) == -1 || fread(&ev->value, sizeof(ev->value), 1, l->f) != 1)
+				goto bad;
+			break;
+		case EV_MEDIA:
+			if (record_get_varint(l, &ev->len) == -1 || ev->len >= MAXLINE ||
+			    fread(ev->line, 1, ev->len, l->f) != ev->len)
+				goto bad;
+			ev->line[ev->len] = 0;
+			break;
+		default:
+			goto bad;
+	}
+	l->have_ev = 1;
+	record_due();
+	return;
+
+bad:
+	printf("\r\nreplay: the recording is damaged\r\n");
+	record_end(l);
+}
+
+static void record_replay_media(const char *line)
+{
+	replaying_media = 1;
+	media_command(line);
+	replaying_media = 0;
+}
+
+/* run the events of l before now, which the run should have asked for but
+   did not, except for times, which are just taken. Returns 1 if the next
+   event is of type, at now. */
+static int record_sync(struct record_log *l, int type)
+{
+	uint64_t now = z180_get_cycles(cpu);
+
+	while (l->have_ev && (l->ev.cycle < now || (l->ev.cycle == now && l->ev.type == EV_TIME))) {
+		switch (l->ev.type) {
+			case EV_RX:
+				record_diverged("a serial byte was not taken");
+				break;
+			case EV_TIME:
+				l->time = l->ev.time;
+				break;
+			case EV_DISK:
+				record_diverged("an image read is missing");
+				break;
+			case EV_MEDIA:
+				record_replay_media(l->ev.line);
+				break;
+		}
+		record_next(l);
+	}
+	return l->have_ev && l->ev.cycle == now && l->ev.type == type;
+}
+
+static void record_disk(const void *buf, size_t len)
+{
+	struct record_log *l = record_source();
+	uint32_t sum = record_checksum(buf, len);
+
+	if (l) {
+		if (!record_sync(l, EV_DISK)) {
+			record_diverged("an image read was not in the recording");
+		} else {
+			if (l->ev.len != len || l->ev.value != sum)
+				record_diverged("an image read differs");
+			record_next(l);
+		}
+	} else if (mode == RECORD_WRITE)
+		record_put_disk(&user, len, sum);
+	if (journaling && !rerun)
+		record_put_disk(&journal, len, sum);
+}
+
+/* swaps replayed from the journal are in it already */
+static void record_media(const char *unit, const char *path)
+{
+	char line[MAXLINE];
+	int len;
+
+	/* a swap of its own while the journal is run again: the run goes on
+	   from here */
+	if (rerun) {
+		if (replaying_media)
+			return;
+		record_cut();
+	}
+	len = snprintf(line, sizeof(line), "%s %s", unit, path);
+	if (len >= MAXLINE)
+		return;
+	if (mode == RECORD_WRITE)
+		record_put_media(&user, line, len);
+	if (journaling)
+		record_put_media(&journal, line, len);
+}
+
+static void record_close()
+{
+	if (user.f)
+		fclose(user.f);
+	if (journal.f)
+		fclose(journal.f);
+	user.f = journal.f = NULL;
+	mode = RECORD_OFF;
+	journaling = rerun = 0;
+	record_due();
+}
+
+int record_init(int m, const char *file, const char *machine, device_t *device)
+{
+	struct record_header h;
+
+	cpu = device;
+	if (!(user.f = fopen(file, m == RECORD_WRITE ? "wb" : "rb")))
+		return -1;
+	setvbuf(user.f, NULL, _IOFBF, 65536);
+	memset(&h, 0, sizeof(h));
+	if (m == RECORD_WRITE) {
+		memcpy(h.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+		h.version = RECORD_VERSION;
+		strncpy(h.machine, machine, RECORD_NAMELEN - 1);
+		h.start = user.last = z180_get_cycles(cpu);
+		fwrite(&h, sizeof(h), 1, user.f);
+	} else {
+		if (fread(&h, sizeof(h), 1, user.f) != 1 || memcmp(h.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) ||
+		    h.version != RECORD_VERSION || strncmp(h.machine, machine, RECORD_NAMELEN - 1)) {
+			fclose(user.f);
+			user.f = NULL;
+			return -1;
+		}
+		user.last = h.start;
+		if (h.start != z180_get_cycles(cpu))
+			printf("replay: recorded from cycle %llu, the machine is at %llu\r\n",
+			    (unsigned long long)h.start, (unsigned long long)z180_get_cycles(cpu));
+	}
+	mode = m;
+	hostio_read_hook = record_disk;
+	media_hook = record_media;
+	atexit(record_close);
+	if (mode == RECORD_REPLAY)
+		record_next(&user);
+	return 0;
+}
+
+int record_journal(device_t *device)
+{
+	if (journaling)
+		return 0;
+	if (!(journal.f = tmpfile()))
+		return -1;
+	setvbuf(journal.f, NULL, _IOFBF, 65536);
+	cpu = device;
+	journal.last = z180_get_cycles(cpu);
+	journal.time = journal.next_time = user.time;
+	journaling = 1;
+	hostio_read_hook = record_disk;
+	media_hook = record_media;
+	if (!user.f)
+		atexit(record_close);
+	return 0;
+}
+
+struct record_snapshot {
+	int64_t offset;
+	uint64_t last;
+	int64_t time, next_time;
+};
+
+void record_snapshot_save(snapshot_t *s)
+{
+	struct record_snapshot snap;
+
+	memset(&snap, 0, sizeof(snap));
+	if (rerun) {
+		/* the event read ahead is still to come */
+		snap.offset = journal.ev_offset;
+		snap.last = journal.ev_last;
+		snap.next_time = journal.ev_time;
+	} else {
+		fflush(journal.f);
+		snap.offset = ftell(journal.f);
+		snap.last = journal.last;
+		snap.next_time = journal.time;
+	}
+	snap.time = journal.time;
+	snapshot_put(s, "record", &snap, sizeof(snap));
+}
+
+int record_snapshot_load(snapshot_t *s)
+{
+	struct record_snapshot snap;
+
+	if (snapshot_get(s, "record", &snap, sizeof(snap)) == -1 || !journaling)
+		return -1;
+	fflush(journal.f);
+	if (fseek(journal.f, snap.offset, SEEK_SET) == -1)
+		return -1;
+	journal.last = snap.last;
+	journal.time = snap.time;
+	journal.next_time = snap.next_time;
+	rerun = 1;
+	diverged = 0;
+	record_next(&journal);
+	return 0;
+}
+
+void record_cut()
+{
+	if (!rerun)
+		return;
+	fseek(journal.f, journal.ev_offset, SEEK_SET);
+	if (ftruncate(fileno(journal.f), journal.ev_offset) == -1)
+		perror("journal");
+	journal.last = journal.ev_last;
+	journal.have_ev = 0;
+	rerun = 0;
+	record_due();
+}
+
+int record_mode()
+{
+	return mode;
+}
+
+int record_replaying()
+{
+	return rerun || mode == RECORD_REPLAY;
+}
+
+int record_rx(int port, int c)
+{
+	if (c == -1)
+		return c;
+	if (mode == RECORD_WRITE)
+		record_put_rx(&user, port, c);
+	if (journaling)
+		record_put_rx(&journal, port, c);
+	return c;
+}
+
+int record_replay_rx(int port)
+{
+	struct record_log *l = record_source();
+	int c;
+
+	if (!record_sync(l, EV_RX) || l->ev.port != port)
+		return -1;
+	c = l->ev.value;
+	record_next(l);
+	if (l == &user && journaling)
+		record_put_rx(&journal, port, c);
+	return c;
+}
+
+time_t record_time(time_t t)
+{
+	struct record_log *l = record_source();
+
+	if (l) {
+		record_sync(l, EV_TIME);
+		t = l->time;
+	} else if (mode == RECORD_WRITE)
+		record_put_time(&user, t);
+	if (journaling && !rerun)
+		record_put_time(&journal, t);
+	return t;
+}
+
+void record_media_poll()
+{
+	struct record_log *l;
+
+	while ((l = record_source()) && record_sync(l, EV_MEDIA)) {
+		record_replay_media(l->ev.line);
+		record_next(l);
+	}
+}
+
+void record_poll()
+{
+	/* a run that crashes or is killed keeps its log up to here */
+	if (mode == RECORD_WRITE)
+		fflush(user.f);
+	record_media_poll();
+}
@@ -0,0 +1,68 @@
+/*
+ * record.h - record the inputs of a run, and replay them
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "../z180/z180.h"
+#include "../snapshot/snapshot.h"
+
+#define RECORD_OFF	0
+#define RECORD_WRITE	1
+#define RECORD_REPLAY	2
+
+/* Start recording to, or replaying from, file. The cpu gives the cycle
+ * stamps; the machine name must match on replay. -1 on error. */
+extern int record_init(int mode, const char *file, const char *machine, device_t *cpu);
+extern int record_mode();
+/* 1 while inputs come from a log, the user's or the journal */
+extern int record_replaying();
+
+/* serial input: record_rx() logs the byte c that came in on port and
+ * returns it; on replay the board asks record_replay_rx() instead of the
+ * host, which gives the byte recorded at this cycle, or -1 */
+extern int record_rx(int port, int c);
+extern int record_replay_rx(int port);
+/* the time of day the RTC gives the guest */
+extern time_t record_time(time_t t);
+/* call at slice boundaries: writes the log out, on replay runs the disk
+ * image swaps of the recording */
+extern void record_poll();
+/* Swaps made from the debugger fall inside a slice. On replay the next
+ * one is due at record_media_due, -1 if there is none; call
+ * record_media_poll() before the instruction at that cycle, where the
+ * debugger had stopped to make it. */
+extern uint64_t record_media_due;
+extern void record_media_poll();
+
+/* The journal, for going back in the debugger: from now on every input
+ * the guest takes is kept. A checkpoint keeps the journal position with
+ * record_snapshot_save(); after restoring it, record_snapshot_load() makes
+ * the inputs come from the journal again, up to where the run had got to.
+ * record_cut() drops the rest of the journal, when the run is changed. */
+extern int record_journal(device_t *cpu);
+extern void record_snapshot_save(snapshot_t *s);
+extern int record_snapshot_load(snapshot_t *s);
+extern void record_cut();
+
+#endif /* RECORD_H */
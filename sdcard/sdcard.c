@@ -25,6 +25,7 @@ typedef uint8_t UINT8;
 } while(0)
 
 int sdcard_trace = 1;
+void (*sdcard_command_hook)(UINT8 command) = NULL;
 
 char *sdcard_state_names[] = {
     [IDLE] = "IDLE",
@@ -81,6 +82,35 @@ int sdcard_init(struct sdcard_device *sd, char *filename) {
     return 1;
 }
 
+// Pull the card, sdcard_init() puts another one in
+void sdcard_close(struct sdcard_device *sd) {
+    hostio_wait(&sd->io);
+    if (sd->fd != -1) {
+        hostio_overlay_drop(sd->fd);
+        close(sd->fd);
+    }
+    sd->fd = -1;
+    sdcard_reset(sd);
+}
+
+// The card's protocol state, not its contents
+void sdcard_snapshot_save(struct sdcard_device *sd, snapshot_t *s) {
+    hostio_wait(&sd->io);
+    snapshot_put(s, "sdcard", sd, sizeof(*sd));
+}
+
+int sdcard_snapshot_load(struct sdcard_device *sd, snapshot_t *s) {
+    struct sdcard_device live;
+
+    hostio_wait(&sd->io);
+    live = *sd;
+    if (snapshot_get(s, "sdcard", sd, sizeof(*sd)) == -1)
+        return -1;
+    sd->fd = live.fd;
+    sd->io = live.io;
+    return 0;
+}
+
 void sdcard_dump(struct sdcard_device *sd) {
     printf("SD:DUMP:  s%i,t%x,r%x, ",
         sd->state,
@@ -145,6 +175,12 @@ void sdcard_resp_tx_block(struct sdcard_device *sd, UINT8 r1, int tx_len) {
     sdcard_setstate(sd, TX_BUSY);
 }
 
+void sdcard_read_done(struct hostio_req *io) {
+    if (io->result != io->len) {
+        dprint(1,"SD: read error at 0x%lx\n", (long)io->offset);
+    }
+}
+
 void sdcard_resp_rx_block(struct sdcard_device *sd) {
     sd->resp_ptr = 0;
     sd->tx_len = 0; // This overwrites the buffer, so mark it as empty
@@ -237,7 +273,12 @@ int sdcard_write(struct sdcard_device *sd, int cs, UINT8 data) {
 
     // If we got here, we have an entire command packet
 
+    // A new command may reuse the buffer, let a pending read finish first
+    hostio_wait(&sd->io);
+
     UINT8 cmd = sd->cmd[0];
+    if (sdcard_command_hook)
+        sdcard_command_hook(cmd & 0x3f);
 
     // should start with 0b01xxxxxx (x = cmd)
     // should end with   0bccccccc1 (c = crc)
@@ -334,12 +375,18 @@ int sdcard_write(struct sdcard_device *sd, int cs, UINT8 data) {
             );
             dprint(1,"SD:READ:  0x%04x\n", block);
 
-            if (lseek(sd->fd, block*0x200, SEEK_SET) != -1) {
-                read(sd->fd, &sd->resp, 0x200);
-            }
-
             // TODO: could use result of read as source of r1 status
             sdcard_resp_tx_block(sd, R1_0, 512);
+
+            // The data token is held back until the read has landed
+            sd->io.op = HOSTIO_READ;
+            sd->io.fd = sd->fd;
+            sd->io.offset = (off_t)block*0x200;
+            sd->io.buf = sd->resp;
+            sd->io.len = 0x200;
+            sd->io.done = sdcard_read_done;
+            sd->io.ctx = sd;
+            hostio_submit(&sd->io);
             break;
         }
 
@@ -456,6 +503,16 @@ int sdcard_read(struct sdcard_device *sd, int cs, UINT8 data) {
             break;
 
         case TX_BLOCK_TOKEN:
+            if (hostio_pending(&sd->io)) {
+                result = 0xff; // still reading, host polls for the token
+                break;
+            }
+            if (sd->io.result != sd->io.len) {
+                // data error token instead, out of range past the image end
+                result = sd->io.result == -1 ? 0x01 : 0x08;
+                sdcard_setstate(sd, IDLE);
+                break;
+            }
             result = 0xfe; // data token
             sdcard_setstate(sd, TX_BLOCK_BUF);
             break;
@@ -499,3 +556,48 @@ int sdcard_read(struct sdcard_device *sd, int cs, UINT8 data) {
     return result;
 }
 
+int sdcard_exchange(struct sdcard_device *sd, int cs, UINT8 data) {
+    // The state machine above is split into read and write halves, so
+    // decide from the state which one this SPI byte is: command and block
+    // bytes are writes, otherwise the host clocks out 0xff to get a reply
+    if (sd->state == RX_CMD || sd->state == RX_BLOCK || data != 0xff) {
+        return sdcard_write(sd, cs, data);
+    }
+    return sdcard_read(sd, cs, data);
+}
+
+int sdcard_read_block(struct sdcard_device *sd, int cs, UINT8 *buf, int len) {
+    if (!cs || sd->state != TX_BLOCK_BUF || sdcard_trace>1) {
+        return 0;
+    }
+
+    // Only the data part, the CRC and state change go through sdcard_read()
+    int avail = sd->tx_len - sd->resp_ptr;
+    if (len > avail) {
+        len = avail;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+    memcpy(buf, &sd->resp[sd->resp_ptr], len);
+    sd->resp_ptr += len;
+    return len;
+}
+
+int sdcard_write_block(struct sdcard_device *sd, int cs, const UINT8 *buf, int len) {
+    if (!cs || sd->state != RX_BLOCK || sdcard_trace>1) {
+        return 0;
+    }
+
+    // resp_ptr 0 is the data token, 1..512 are the data bytes
+    if (sd->resp_ptr < 1 || sd->resp_ptr > 512) {
+        return 0;
+    }
+    int avail = 513 - sd->resp_ptr;
+    if (len > avail) {
+        len = avail;
+    }
+    memcpy(&sd->resp[sd->resp_ptr-1], buf, len);
+    sd->resp_ptr += len;
+    return len;
+}
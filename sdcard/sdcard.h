@@ -7,6 +7,9 @@
 #ifndef SDCARD_H
 #define SDCARD_H
 
+#include "../hostio/hostio.h"
+#include "../snapshot/snapshot.h"
+
 // States are named from the SDcard's point of view (thus "TX" is the card
 // intends to transmit)
 //
@@ -41,13 +44,24 @@ struct sdcard_device {
     UINT8 r1; // result code to send with R1
     UINT8 cmd[8];
     UINT8 resp[512+6];
+    struct hostio_req io; // block read in flight
 };
 
 extern int sdcard_trace;
+// Called with every command the card gets, for the profiler
+extern void (*sdcard_command_hook)(UINT8 command);
 
 // TODO: technically, SPI is simultaneous readwrite
 int sdcard_read(struct sdcard_device *device, int cs, UINT8 data);
 int sdcard_write(struct sdcard_device *device, int cs, UINT8 data);
+int sdcard_exchange(struct sdcard_device *device, int cs, UINT8 data);
+// Bulk access to the data part of a block transfer, returns the number of
+// bytes moved, 0 if the card is not in the middle of a data block
+int sdcard_read_block(struct sdcard_device *device, int cs, UINT8 *buf, int len);
+int sdcard_write_block(struct sdcard_device *device, int cs, const UINT8 *buf, int len);
 int sdcard_init(struct sdcard_device *sd, char *filename);
+void sdcard_close(struct sdcard_device *sd);
+void sdcard_snapshot_save(struct sdcard_device *sd, snapshot_t *s);
+int sdcard_snapshot_load(struct sdcard_device *sd, snapshot_t *s);
 
 #endif
@@ -0,0 +1,381 @@
+/*
+ * snapshot.c - save and restore the state of a whole machine
+ *
+ * A snapshot is a header, a table of parts, and the parts. Each device
+ * puts its state as one or more named parts, usually its state struct as
+ * it is in memory, so a snapshot only loads into the build that wrote it;
+ * a part of the wrong size is refused. Memory arrays are page aligned in
+ * the file, so that restoring a booted machine maps them copy on write
+ * instead of reading a megabyte.
+ *
+ * Disk images are not part of a snapshot. The same images, in the same
+ * state, have to be in place when it is loaded.
+ *
+ * A snapshot can also be kept in memory, as a checkpoint. Its memory
+ * arrays are then kept page by page, and pages that did not change since
+ * the previous checkpoint are shared with it, so a checkpoint costs about
+ * the pages written since the last one.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "Z180SNAP"
+#define SNAPSHOT_PAGE 4096
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	char machine[SNAPSHOT_NAMELEN];
+};
+
+struct snapshot_entry {
+	char name[SNAPSHOT_NAMELEN];
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct snapshot_page {
+	int refs;		/* checkpoints that have this page */
+	uint8_t data[SNAPSHOT_PAGE];
+};
+
+struct snapshot {
+	struct snapshot_header h;
+	struct snapshot_entry *entries;
+	/* saving */
+	const void **data;
+	uint8_t *pages;		/* 1 if the part is page aligned */
+	int max;
+	/* loading */
+	int fd;
+	uint8_t *base;
+	size_t len;
+	/* kept in memory: the pages of each page aligned part */
+	struct snapshot_page ***kept;
+	char error[SNAPSHOT_NAMELEN + 32];	/* the last part not found */
+};
+
+static const uint8_t zeropage[SNAPSHOT_PAGE];
+
+snapshot_t *snapshot_create(const char *machine)
+{
+	snapshot_t *s = calloc(1, sizeof(*s));
+
+	memcpy(s->h.magic, SNAPSHOT_MAGIC, sizeof(s->h.magic));
+	s->h.version = SNAPSHOT_VERSION;
+	strncpy(s->h.machine, machine, SNAPSHOT_NAMELEN - 1);
+	s->fd = -1;
+	return s;
+}
+
+static void snapshot_add(snapshot_t *s, const char *name, const void *data, size_t size, int pages)
+{
+	struct snapshot_entry *e;
+
+	if (s->h.count == s->max) {
+		s->max = s->max ? s->max * 2 : 32;
+		s->entries = realloc(s->entries, s->max * sizeof(*s->entries));
+		s->data = realloc(s->data, s->max * sizeof(*s->data));
+		s->pages = realloc(s->pages, s->max);
+	}
+	e = &s->entries[s->h.count];
+	memset(e, 0, sizeof(*e));
+	strncpy(e->name, name, SNAPSHOT_NAMELEN - 1);
+	e->size = size;
+	s->data[s->h.count] = data;
+	s->pages[s->h.count] = pages;
+	s->h.count++;
+}
+
+void snapshot_put(snapshot_t *s, const char *name, const void *data, size_t size)
+{
+	void *copy = malloc(size ? size : 1);
+
+	memcpy(copy, data, size);
+	snapshot_add(s, name, copy, size, 0);
+}
+
+void snapshot_put_pages(snapshot_t *s, const char *name, const void *data, size_t size)
+{
+	snapshot_add(s, name, data, size, 1);
+}
+
+static void snapshot_free(snapshot_t *s)
+{
+	size_t j;
+	int i;
+
+	for (i = 0; s->data && i < s->h.count; i++)
+		if (!s->pages[i])
+			free((void *)s->data[i]);
+	for (i = 0; s->kept && i < s->h.count; i++) {
+		if (!s->kept[i])
+			continue;
+		for (j = 0; j * SNAPSHOT_PAGE < s->entries[i].size; j++)
+			if (!--s->kept[i][j]->refs)
+				free(s->kept[i][j]);
+		free(s->kept[i]);
+	}
+	free(s->kept);
+	free(s->entries);
+	free(s->data);
+	free(s->pages);
+	free(s);
+}
+
+/* writev until all is out, iov is used up on the way */
+static int snapshot_writev(int fd, struct iovec *iov, int n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		r = writev(fd, iov, n > IOV_MAX ? IOV_MAX : n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n > 0 && r >= (ssize_t)iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	return 0;
+}
+
+int snapshot_write(snapshot_t *s, const char *file)
+{
+	struct iovec *iov = malloc((2 * s->h.count + 2) * sizeof(*iov));
+	char tmp[512];
+	uint64_t off;
+	int i, n = 0, fd, r;
+
+	off = sizeof(s->h) + s->h.count * sizeof(*s->entries);
+	iov[n].iov_base = &s->h;
+	iov[n++].iov_len = sizeof(s->h);
+	iov[n].iov_base = s->entries;
+	iov[n++].iov_len = s->h.count * sizeof(*s->entries);
+	for (i = 0; i < s->h.count; i++) {
+		if (s->pages[i] && (off & (SNAPSHOT_PAGE - 1))) {
+			iov[n].iov_base = (void *)zeropage;
+			iov[n++].iov_len = SNAPSHOT_PAGE - (off & (SNAPSHOT_PAGE - 1));
+			off += SNAPSHOT_PAGE - (off & (SNAPSHOT_PAGE - 1));
+		}
+		s->entries[i].offset = off;
+		iov[n].iov_base = (void *)s->data[i];
+		iov[n++].iov_len = s->entries[i].size;
+		off += s->entries[i].size;
+	}
+
+	/* a new file, so that memory mapped from the old one stays as it is */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	r = -1;
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1) {
+		r = snapshot_writev(fd, iov, n);
+		if (close(fd) == -1)
+			r = -1;
+		if (r == 0)
+			r = rename(tmp, file);
+		if (r == -1)
+			unlink(tmp);
+	}
+	free(iov);
+	snapshot_free(s);
+	return r;
+}
+
+snapshot_t *snapshot_open(const char *file, const char *machine)
+{
+	snapshot_t *s;
+	struct stat st;
+	int i, fd;
+	void *base;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct snapshot_header) ||
+	    (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	s->fd = fd;
+	s->base = base;
+	s->len = st.st_size;
+	memcpy(&s->h, base, sizeof(s->h));
+	s->entries = (struct snapshot_entry *)(s->base + sizeof(s->h));
+	if (memcmp(s->h.magic, SNAPSHOT_MAGIC, sizeof(s->h.magic)) || s->h.version != SNAPSHOT_VERSION ||
+	    strncmp(s->h.machine, machine, SNAPSHOT_NAMELEN - 1) ||
+	    sizeof(s->h) + (uint64_t)s->h.count * sizeof(*s->entries) > s->len)
+		goto bad;
+	for (i = 0; i < s->h.count; i++)
+		if (s->entries[i].offset > s->len || s->entries[i].size > s->len - s->entries[i].offset)
+			goto bad;
+	return s;
+
+bad:
+	s->entries = NULL;
+	snapshot_close(s);
+	errno = EINVAL;
+	return NULL;
+}
+
+snapshot_t *snapshot_keep(snapshot_t *s, snapshot_t *prev)
+{
+	struct snapshot_page **pages, **old;
+	const uint8_t *src;
+	size_t j, n, len;
+	int i, k;
+
+	s->kept = calloc(s->h.count ? s->h.count : 1, sizeof(*s->kept));
+	for (i = 0; i < s->h.count; i++) {
+		if (!s->pages[i])
+			continue;
+		n = (s->entries[i].size + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+		pages = malloc((n ? n : 1) * sizeof(*pages));
+		old = NULL;
+		for (k = 0; prev && k < prev->h.count; k++)
+			if (!strcmp(prev->entries[k].name, s->entries[i].name) &&
+			    prev->entries[k].size == s->entries[i].size)
+				old = prev->kept[k];
+		for (j = 0; j < n; j++) {
+			src = (const uint8_t *)s->data[i] + j * SNAPSHOT_PAGE;
+			len = s->entries[i].size - j * SNAPSHOT_PAGE;
+			if (len > SNAPSHOT_PAGE)
+				len = SNAPSHOT_PAGE;
+			if (old && !memcmp(old[j]->data, src, len)) {
+				pages[j] = old[j];
+				pages[j]->refs++;
+				continue;
+			}
+			pages[j] = malloc(sizeof(**pages));
+			pages[j]->refs = 1;
+			memcpy(pages[j]->data, src, len);
+		}
+		s->kept[i] = pages;
+		s->data[i] = NULL;
+	}
+	return s;
+}
+
+static int snapshot_find(snapshot_t *s, const char *name, size_t size)
+{
+	int i;
+
+	for (i = 0; i < s->h.count; i++)
+		if (!strncmp(s->entries[i].name, name, SNAPSHOT_NAMELEN - 1)) {
+			if (s->entries[i].size == size)
+				return i;
+			break;
+		}
+	snprintf(s->error, sizeof(s->error), "%s %s", name, i < s->h.count ? "has the wrong size" : "is missing");
+	return -1;
+}
+
+int snapshot_match(snapshot_t *s, snapshot_t *ref)
+{
+	int i;
+
+	for (i = 0; i < ref->h.count; i++)
+		if (snapshot_find(s, ref->entries[i].name, ref->entries[i].size) == -1)
+			return -1;
+	return 0;
+}
+
+const char *snapshot_error(snapshot_t *s)
+{
+	return s->error;
+}
+
+/* part i, from the file or from memory */
+static void snapshot_copy(snapshot_t *s, int i, void *data, size_t size)
+{
+	size_t j, len;
+
+	if (!s->kept) {
+		memcpy(data, s->base + s->entries[i].offset, size);
+		return;
+	}
+	if (!s->kept[i]) {
+		memcpy(data, s->data[i], size);
+		return;
+	}
+	for (j = 0; j < size; j += len) {
+		len = size - j < SNAPSHOT_PAGE ? size - j : SNAPSHOT_PAGE;
+		memcpy((uint8_t *)data + j, s->kept[i][j / SNAPSHOT_PAGE]->data, len);
+	}
+}
+
+int snapshot_get(snapshot_t *s, const char *name, void *data, size_t size)
+{
+	int i = snapshot_find(s, name, size);
+
+	if (i == -1)
+		return -1;
+	snapshot_copy(s, i, data, size);
+	return 0;
+}
+
+int snapshot_map(snapshot_t *s, const char *name, void *data, size_t size)
+{
+	int i = snapshot_find(s, name, size);
+
+	if (i == -1)
+		return -1;
+	if (!s->kept && !((uintptr_t)data & (SNAPSHOT_PAGE - 1)) && !(s->entries[i].offset & (SNAPSHOT_PAGE - 1)) &&
+	    !(size & (SNAPSHOT_PAGE - 1)) &&
+	    mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, s->fd, s->entries[i].offset) != MAP_FAILED)
+		return 0;
+	snapshot_copy(s, i, data, size);
+	return 0;
+}
+
+void snapshot_close(snapshot_t *s)
+{
+	if (s->base)
+		munmap(s->base, s->len);
+	if (s->fd != -1)
+		close(s->fd);
+	if (s->base)
+		free(s);
+	else
+		snapshot_free(s);
+}
@@ -0,0 +1,60 @@
+/*
+ * snapshot.h - save and restore the state of a whole machine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NAMELEN 16
+
+/* memory arrays declared with this can be mapped straight from the file */
+#define SNAPSHOT_ALIGNED __attribute__((aligned(4096)))
+
+typedef struct snapshot snapshot_t;
+
+/* Saving: the devices put their parts, snapshot_write() writes them all
+ * with one writev. snapshot_put() copies data, snapshot_put_pages()
+ * keeps a reference until the write, for the big memory arrays. */
+extern snapshot_t *snapshot_create(const char *machine);
+extern void snapshot_put(snapshot_t *s, const char *name, const void *data, size_t size);
+extern void snapshot_put_pages(snapshot_t *s, const char *name, const void *data, size_t size);
+/* writes and frees s, -1 on error; snapshot_close() drops it unwritten */
+extern int snapshot_write(snapshot_t *s, const char *file);
+/* keeps s in memory instead, to be loaded from like an opened file. The
+ * page aligned parts share the pages that did not change with prev, the
+ * checkpoint before, or NULL. Returns s, drop it with snapshot_close(). */
+extern snapshot_t *snapshot_keep(snapshot_t *s, snapshot_t *prev);
+
+/* Loading: parts are looked up by name and must have the size the
+ * running build expects, else -1. snapshot_map() maps the part over data
+ * copy on write if both are page aligned, and copies it if not. */
+extern snapshot_t *snapshot_open(const char *file, const char *machine);
+extern int snapshot_get(snapshot_t *s, const char *name, void *data, size_t size);
+extern int snapshot_map(snapshot_t *s, const char *name, void *data, size_t size);
+/* 0 if s has every part that ref has, in the same size, else -1. Check
+ * this before loading anything, so that a bad snapshot is not loaded half
+ * way. After a -1 from these, snapshot_error() tells which part failed. */
+extern int snapshot_match(snapshot_t *s, snapshot_t *ref);
+extern const char *snapshot_error(snapshot_t *s);
+extern void snapshot_close(snapshot_t *s);
+
+#endif /* SNAPSHOT_H */
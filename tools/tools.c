@@ -0,0 +1,174 @@
+/*
+ * tools.c - the tools that watch a run, the same on every board
+ *
+ * A tool has an option that names its file, is started once the machine
+ * is built, is polled at the end of every slice, goes on in a file of its
+ * own in each clone, and writes its result at exit. The boards go through
+ * the table below for all of that, so a tool is added here, once.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tools.h"
+#include "../clone/clone.h"
+#include "../trace/trace.h"
+#include "../profile/profile.h"
+#include "../profile/callgraph.h"
+#include "../profile/cpm.h"
+#include "../profile/coverage.h"
+#include "../profile/memstats.h"
+
+struct tool {
+	int opt;			/* the option letter */
+	const char *help;		/* its line in the help */
+	const char *what;		/* "file: could not ..." */
+	const char *ext;		/* of the file a clone writes */
+	int (*open)(device_t *cpu, const char *machine, const char *file);
+	void (*poll)();
+	int (*clone)(const char *file);
+	void (*close)();
+	const char *file;		/* from the command line */
+};
+
+static int trace_start(device_t *cpu, const char *machine, const char *file)
+{
+	return trace_option(file, machine, cpu);
+}
+
+static int profile_start(device_t *cpu, const char *machine, const char *file)
+{
+	return profile_open(cpu, file);
+}
+
+static int callgraph_start(device_t *cpu, const char *machine, const char *file)
+{
+	return callgraph_open(cpu, file);
+}
+
+static int cpm_start(device_t *cpu, const char *machine, const char *file)
+{
+	return cpm_open(cpu, file);
+}
+
+static int coverage_start(device_t *cpu, const char *machine, const char *file)
+{
+	return coverage_open(cpu, machine, file);
+}
+
+static int memstats_start(device_t *cpu, const char *machine, const char *file)
+{
+	return memstats_open(cpu, file);
+}
+
+static struct tool tools[] = {
+	{ 'o', "  -o tracefile write a trace of the instructions run (see trace/trace.c); as\n"
+	       "             tracefile,from,to only from cycle from to to, 1000i is instruction 1000\n",
+	  "trace", "trace", trace_start, trace_poll, trace_clone, trace_close },
+	{ 'f', "  -f reportfile profile the code run, and write the hottest code to reportfile\n",
+	  "profile", "profile", profile_start, profile_poll, profile_clone, profile_close },
+	{ 'g', "  -g foldfile follow the calls, and write the cycles per call stack to foldfile\n",
+	  "follow the calls", "folded", callgraph_start, callgraph_poll, callgraph_clone, callgraph_close },
+	{ 'b', "  -b reportfile time the BDOS and BIOS calls of CP/M, write them to reportfile\n",
+	  "time the CP/M calls", "cpm", cpm_start, cpm_poll, cpm_clone, cpm_close },
+	{ 'u', "  -u covfile note the code run and the way its branches went, write it to\n"
+	       "             covfile at exit, list it with covlist\n",
+	  "note the coverage", "cov", coverage_start, coverage_poll, coverage_clone, coverage_close },
+	{ 'k', "  -k csvfile count the memory accesses per 4K page, the MMU remaps and the DMA,\n"
+	       "             write them to csvfile at exit\n",
+	  "count the memory accesses", "csv", memstats_start, NULL, memstats_clone, memstats_close },
+};
+
+#define NUMTOOLS (sizeof(tools) / sizeof(tools[0]))
+
+const char *tools_options(const char *opts)
+{
+	static char buf[128];
+	size_t i, n;
+
+	strncpy(buf, opts, sizeof(buf) - 1);
+	n = strlen(buf);
+	for (i = 0; i < NUMTOOLS && n + 2 < sizeof(buf); i++) {
+		buf[n++] = tools[i].opt;
+		buf[n++] = ':';
+	}
+	buf[n] = 0;
+	return buf;
+}
+
+int tools_option(int opt, const char *arg)
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		if (tools[i].opt == opt) {
+			tools[i].file = arg;
+			return 1;
+		}
+	return 0;
+}
+
+void tools_help()
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		printf("%s", tools[i].help);
+}
+
+static void tools_close()
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		tools[i].close();
+}
+
+void tools_open(device_t *cpu, const char *machine)
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		if (tools[i].file && tools[i].open(cpu, machine, tools[i].file) == -1) {
+			printf("%s: could not %s\n", tools[i].file, tools[i].what);
+			exit(1);
+		}
+	atexit(tools_close);
+}
+
+void tools_poll()
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		if (tools[i].poll)
+			tools[i].poll();
+}
+
+void tools_clone()
+{
+	size_t i;
+
+	for (i = 0; i < NUMTOOLS; i++)
+		if (tools[i].clone(clone_file(tools[i].ext)) == -1) {
+			perror(clone_file(tools[i].ext));
+			exit(2);
+		}
+}
@@ -0,0 +1,40 @@
+/*
+ * tools.h - the tools that watch a run, the same on every board
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include "../z180/z180.h"
+
+/* opts with the option letters of the tools added, for getopt() */
+extern const char *tools_options(const char *opts);
+/* 1 if opt is the option of a tool, which then uses arg as its file */
+extern int tools_option(int opt, const char *arg);
+/* the lines of the tools for the help */
+extern void tools_help();
+/* start the tools given on the command line, and close them all at exit;
+   prints what failed and exits */
+extern void tools_open(device_t *cpu, const char *machine);
+/* call at slice boundaries */
+extern void tools_poll();
+/* in a new clone: every tool goes on in a clone file of its own */
+extern void tools_clone();
+
+#endif /* TOOLS_H */
@@ -0,0 +1,259 @@
+/*
+ * trace.c - write the instructions run to a trace file
+ *
+ * The cpu keeps the instructions it runs in its history ring (see
+ * z180_history_size()). While tracing, what came into the ring during a
+ * slice is taken out at the end of it and packed into a binary record per
+ * instruction: the opcode bytes, the cycles since the instruction before,
+ * and of pc, MMU mapping and registers only what changed (see trace.h).
+ * The records go through a large buffer, and so the file is written in
+ * big pieces; no text is made while the machine runs. tracedump turns a
+ * trace into a listing.
+ *
+ * A sync record, with all fields, comes at the start, every SYNC_EVERY
+ * records, and after a gap: when instructions were lost, or the debugger
+ * went back and they run again.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define BUFSIZE (1 << 20)
+#define MAXRECORD 32
+#define SYNC_EVERY 65536
+
+static int fd = -1;
+static struct trace_header header;
+static device_t *cpu = NULL;
+static uint8_t *buf = NULL;
+static size_t used = 0;
+static UINT32 seq;			/* next history entry to take */
+static uint64_t from, to;		/* cycles or instructions */
+static int counting = 0;		/* instructions, not cycles */
+static uint64_t count = 0;		/* instructions seen */
+static uint64_t written = 0, gaps = 0;
+static int need_sync = 1;
+static int since_sync = 0;
+
+/* of the last record */
+static uint64_t last_cycle;
+static UINT16 last_pc, last_regs[5];
+static int last_len;
+static offs_t last_map;
+
+static void trace_flush()
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < used) {
+		if ((n = write(fd, buf + done, used - done)) <= 0) {
+			perror("trace");
+			break;
+		}
+		done += n;
+	}
+	used = 0;
+}
+
+static void trace_end()
+{
+	trace_flush();
+	close(fd);
+	fd = -1;
+	printf("\r\ntrace: %llu instructions written%s\r\n",
+	    (unsigned long long)written, gaps ? ", with gaps" : "");
+	fflush(stdout);
+}
+
+static uint8_t *trace_put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static void trace_put(const struct z180_history *h)
+{
+	UINT16 regs[5] = { h->af, h->bc, h->de, h->hl, h->sp };
+	offs_t map = (h->addr - h->pc) & 0xfffff;
+	int len = h->len ? h->len : 1;
+	int flags = 0, i;
+	uint64_t delta;
+	uint8_t *p;
+
+	if (used + MAXRECORD > BUFSIZE)
+		trace_flush();
+	p = buf + used;
+	if (need_sync || h->cycle < last_cycle || ++since_sync == SYNC_EVERY) {
+		flags = TRACE_SYNC;
+		delta = h->cycle;
+		need_sync = since_sync = 0;
+	} else {
+		if (h->pc != ((last_pc + last_len) & 0xffff))
+			flags |= TRACE_PC;
+		if (map != last_map)
+			flags |= TRACE_MAP;
+		for (i = 0; i < 5; i++)
+			if (regs[i] != last_regs[i])
+				flags |= TRACE_AF << i;
+		delta = h->cycle - last_cycle;
+	}
+	*p++ = flags;
+	if (flags != TRACE_SYNC && delta < 63) {
+		*p++ = (len - 1) << 6 | delta;
+	} else {
+		*p++ = (len - 1) << 6 | 63;
+		p = trace_put_varint(p, delta);
+	}
+	if (flags & TRACE_PC) {
+		*p++ = h->pc;
+		*p++ = h->pc >> 8;
+	}
+	if (flags & TRACE_MAP) {
+		*p++ = map;
+		*p++ = map >> 8;
+		*p++ = map >> 16;
+	}
+	for (i = 0; i < 5; i++)
+		if (flags & (TRACE_AF << i)) {
+			*p++ = regs[i];
+			*p++ = regs[i] >> 8;
+		}
+	memcpy(p, h->op, len);
+	used = p + len - buf;
+	written++;
+
+	last_cycle = h->cycle;
+	last_pc = h->pc;
+	last_len = len;
+	last_map = map;
+	memcpy(last_regs, regs, sizeof(regs));
+}
+
+int trace_open(const char *file, const char *machine, device_t *device,
+    uint64_t start, uint64_t end, int instructions)
+{
+	trace_close();
+	if (z180_history_reserve(device) == -1)
+		return -1;
+	if (!buf && !(buf = malloc(BUFSIZE)))
+		return -1;
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	strncpy(header.machine, machine, TRACE_NAMELEN - 1);
+	memcpy(buf, &header, sizeof(header));
+	used = sizeof(header);
+
+	cpu = device;
+	seq = z180_history_seq(cpu);
+	from = start;
+	to = end;
+	counting = instructions;
+	count = written = gaps = 0;
+	need_sync = 1;
+	return 0;
+}
+
+int trace_clone(const char *file)
+{
+	if (fd == -1)
+		return 0;
+	/* the parent writes out what is buffered */
+	close(fd);
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	memcpy(buf, &header, sizeof(header));
+	used = sizeof(header);
+	seq = z180_history_seq(cpu);
+	written = gaps = 0;
+	need_sync = 1;
+	return 0;
+}
+
+int trace_active()
+{
+	return fd != -1;
+}
+
+void trace_poll()
+{
+	struct z180_history h;
+	int r;
+
+	if (fd == -1)
+		return;
+	while ((r = z180_history_next(cpu, &seq, &h))) {
+		if (r == -1) {
+			need_sync = 1;
+			gaps++;
+			continue;
+		}
+		count++;
+		if ((counting ? count : h.cycle) < from)
+			continue;
+		if (to && (counting ? count : h.cycle) >= to) {
+			trace_end();
+			return;
+		}
+		trace_put(&h);
+	}
+}
+
+void trace_close()
+{
+	if (fd == -1)
+		return;
+	trace_poll();
+	if (fd != -1)
+		trace_end();
+}
+
+int trace_option(const char *spec, const char *machine, device_t *device)
+{
+	char file[256], *p;
+	uint64_t limit[2] = { 0, 0 };
+	int instructions = 0, n;
+
+	strncpy(file, spec, sizeof(file) - 1);
+	file[sizeof(file) - 1] = 0;
+	if ((p = strchr(file, ',')))
+		*p++ = 0;
+	for (n = 0; n < 2 && p && *p; n++) {
+		limit[n] = strtoull(p, &p, 0);
+		if (*p == 'i') {
+			instructions = 1;
+			p++;
+		}
+		if (*p == ',')
+			p++;
+	}
+	return trace_open(file, machine, device, limit[0], limit[1], instructions);
+}
@@ -0,0 +1,69 @@
+/*
+ * trace.h - write the instructions run to a trace file
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "../z180/z180.h"
+
+#define TRACE_MAGIC "Z180TRC"
+#define TRACE_VERSION 1
+#define TRACE_NAMELEN 16
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	char machine[TRACE_NAMELEN];
+};
+
+/* A record starts with a flags byte, the fields below that changed. The
+ * second byte has the number of opcode bytes - 1 in the upper two bits,
+ * and the cycles since the last record in the lower six, or 63 for a
+ * varint of them after it. A sync record (all flags) has all fields, and
+ * the varint is the cycle itself. Then come the fields flagged, in the
+ * order of the flags, 16 bit little endian (map is 24 bit: the physical
+ * address less the pc), then the opcode bytes. The pc is flagged when it
+ * does not follow the last instruction. */
+#define TRACE_PC	0x01
+#define TRACE_MAP	0x02
+#define TRACE_AF	0x04
+#define TRACE_BC	0x08
+#define TRACE_DE	0x10
+#define TRACE_HL	0x20
+#define TRACE_SP	0x40
+#define TRACE_SYNC	0xff
+
+/* Trace from cycle (or instruction, when counting instructions) from to
+ * to, to 0 for no end. Instructions are counted from the call. */
+extern int trace_open(const char *file, const char *machine, device_t *cpu,
+    uint64_t from, uint64_t to, int instructions);
+extern int trace_active();
+/* call at slice boundaries: writes out what ran in the slice */
+extern void trace_poll();
+extern void trace_close();
+/* in a clone: go on in file, the parent keeps the trace so far */
+extern int trace_clone(const char *file);
+/* "file[,from[,to]]", from and to in cycles, or instructions with an i
+   after them */
+extern int trace_option(const char *spec, const char *machine, device_t *cpu);
+
+#endif /* TRACE_H */
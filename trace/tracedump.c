@@ -0,0 +1,184 @@
+/*
+ * tracedump.c - list a trace written by the emulator (see trace.c)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static const char *prg;
+
+static void usage(void)
+{
+	fprintf(stderr, "%s [-c from-to] [-p from-to] [-a from-to] [-o opcode] [-n] trace\n", prg);
+	fprintf(stderr, "  -c from-to   only cycles from to to, decimal\n");
+	fprintf(stderr, "  -p from-to   only pc from to to, hex\n");
+	fprintf(stderr, "  -a from-to   only physical addresses from to to (a bank), hex\n");
+	fprintf(stderr, "  -o opcode    only instructions starting with these bytes, hex (ed b0 is edb0)\n");
+	fprintf(stderr, "  -n           no registers\n");
+	exit(1);
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "%s: %s\n", prg, what);
+	exit(1);
+}
+
+/* "from-to", or one value */
+static void range(const char *arg, int base, uint64_t *from, uint64_t *to)
+{
+	char *p;
+
+	if (*arg == '$')
+		arg++;
+	*from = *to = strtoull(arg, &p, base);
+	if (*p == '-') {
+		if (*++p == '$')
+			p++;
+		*to = strtoull(p, &p, base);
+	}
+	if (*p || *to < *from)
+		usage();
+}
+
+static int get(FILE *f)
+{
+	int c = getc(f);
+	if (c == EOF)
+		fail("trace is cut short");
+	return c;
+}
+
+static uint64_t get_varint(FILE *f)
+{
+	uint64_t v = 0;
+	int c, shift = 0;
+
+	do {
+		c = get(f);
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80 && shift < 64);
+	return v;
+}
+
+static unsigned get16(FILE *f)
+{
+	unsigned v = get(f);
+	return v | get(f) << 8;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t cfrom = 0, cto = ~0ULL, pfrom = 0, pto = 0xffff, afrom = 0, ato = 0xfffff;
+	uint8_t match[4];
+	int nmatch = 0, regs = 1, opt, flags, c, i, len;
+	struct trace_header header;
+	FILE *f;
+
+	/* the state the records change */
+	uint64_t cycle = 0;
+	unsigned pc = 0, map = 0, lastlen = 0, r[5] = { 0, 0, 0, 0, 0 };
+	uint8_t op[4];
+	char ibuf[32], obuf[9];
+
+	prg = argv[0];
+	while ((opt = getopt(argc, argv, "c:p:a:o:n")) != -1) {
+		switch (opt) {
+			case 'c':
+				range(optarg, 10, &cfrom, &cto);
+				break;
+			case 'p':
+				range(optarg, 16, &pfrom, &pto);
+				break;
+			case 'a':
+				range(optarg, 16, &afrom, &ato);
+				break;
+			case 'o':
+				for (nmatch = 0; nmatch < 4 && optarg[2 * nmatch]; nmatch++)
+					if (sscanf(optarg + 2 * nmatch, "%2hhx", &match[nmatch]) != 1)
+						usage();
+				break;
+			case 'n':
+				regs = 0;
+				break;
+			default:
+				usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	if (!(f = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)))
+		fail("not a trace");
+	if (header.version != TRACE_VERSION)
+		fail("trace of another version");
+
+	while ((flags = getc(f)) != EOF) {
+		c = get(f);
+		len = (c >> 6) + 1;
+		if (flags == TRACE_SYNC)
+			cycle = get_varint(f);
+		else
+			cycle += (c & 63) == 63 ? get_varint(f) : (c & 63);
+		if (flags & TRACE_PC)
+			pc = get16(f);
+		else
+			pc = (pc + lastlen) & 0xffff;
+		if (flags & TRACE_MAP) {
+			map = get16(f);
+			map |= get(f) << 16;
+		}
+		for (i = 0; i < 5; i++)
+			if (flags & (TRACE_AF << i))
+				r[i] = get16(f);
+		memset(op, 0, sizeof(op));
+		for (i = 0; i < len; i++)
+			op[i] = get(f);
+		lastlen = len;
+
+		if (cycle < cfrom || cycle > cto || pc < pfrom || pc > pto)
+			continue;
+		if (((pc + map) & 0xfffff) < afrom || ((pc + map) & 0xfffff) > ato)
+			continue;
+		if (nmatch && memcmp(op, match, nmatch))
+			continue;
+		cpu_disassemble_z180(NULL, ibuf, pc, op, op, 0);
+		obuf[0] = 0;
+		for (i = 0; i < len; i++)
+			sprintf(obuf + 2 * i, "%02X", op[i]);
+		printf("%12llu $%05x %04x: %-8s ", (unsigned long long)cycle, (pc + map) & 0xfffff, pc, obuf);
+		if (regs)
+			printf("%-18s AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X", ibuf, r[0], r[1], r[2], r[3], r[4]);
+		else
+			fputs(ibuf, stdout);
+		putchar('\n');
+	}
+	fclose(f);
+	return 0;
+}
@@ -120,10 +120,13 @@ struct z180_state
 	UINT8   timer_cnt;                      /* timer counter / divide by 20 */
 	UINT8   dma0_cnt;                       /* dma0 counter / divide by 20 */
 	UINT8   dma1_cnt;                       /* dma1 counter / divide by 20 */
+	int     csio_cnt;                       /* clocks left in the current CSI/O transfer */
+	UINT8   dma_channel;                    /* DMA channel + 1 while it moves data, for the watch */
 	struct z80_daisy_chain *daisy;	/* daisy chain */
 	device_irq_acknowledge_callback irq_callback;
 	struct z180_device *device;
 	struct memory_select *memory;	/* on Z180 mapped to ram, on Z182 mapped according to ROMBR,RAMLBR */
+	struct memory_select *unwatched;	/* that of the chip, under the watch and the history */
 	struct address_space *ram;		/* on all processor types */
 	struct address_space *rom;		/* only on Z182 */
 	struct address_space *iospace;  /* on all processor types */
@@ -131,6 +134,15 @@ struct z180_state
 	//UINT32  ioltemp;
 	int icount;
 	int extra_cycles;           /* extra cpu cycles */
+	uint64_t cycles;            /* run in all slices before this one */
+	struct z180_history *history;   /* ring of the last instructions run */
+	UINT32 history_mask, history_next, history_used;
+	struct memory_select *history_below;    /* under the history, see z180_memory_chain() */
+	struct z180_memstats *memstats;     /* counted into, if set */
+	struct memory_select *memstats_below;   /* under the counting */
+	struct z180_history *history_cur;   /* the instruction running */
+	UINT8 history_irq;          /* an interrupt was taken, for the next entry */
+	int slice;                  /* icount at the start of this slice */
 	UINT8 *cc[6];	/* cycle count tables */
 };
 
@@ -883,11 +895,16 @@ UINT8 *SZHVC_sub;
 
 UINT8 z180_readcontrol(struct z180_state *cpustate, offs_t port);
 void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data);
+UINT8 z180_watch_in(struct z180_state *cpustate, offs_t port);
+void z180_watch_out(struct z180_state *cpustate, offs_t port, UINT8 data);
 int z180_dma0(struct z180_state *cpustate, int max_cycles);
 int z180_dma1(struct z180_state *cpustate);
+void handle_io_timers(struct z180_state *cpustate, int cycles);
 void cpu_burn_z180(device_t *device, int cycles);
 //static void cpu_set_info_z180(device_t *device, UINT32 state, cpuinfo *info);
 int check_interrupts(struct z180_state *cpustate);
+int z180_block_in(struct z180_state *cpustate, int step, UINT8 opcode);
+int z180_block_out(struct z180_state *cpustate, int step, UINT8 opcode);
 
 #include "z180ops.h"
 #include "z180tbl.h"
@@ -1096,12 +1113,12 @@ UINT8 z180_readcontrol(struct z180_state *cpustate, offs_t port)
 
 		case Z180_CNTR:
 			data = cpustate->IO_CNTR & Z180_CNTR_RMASK;
-			data &= ~0x10; // Super Famicom Box sets the TE bit then wants it to be toggled after 8 bits transmitted
 			LOG("Z180 '%s' CNTR   rd $%02x ($%02x)\n", cpustate->device->m_tag, data, cpustate->io[port]);
 			break;
 
 		case Z180_TRDR:
 			data = cpustate->IO_TRDR & Z180_TRDR_RMASK;
+			cpustate->IO_CNTR &= ~Z180_CNTR_EF;
 			logerror("Z180 '%s' TRDR   rd $%02x ($%02x)\n", cpustate->device->m_tag, data, cpustate->io[port]);
 			break;
 
@@ -1473,6 +1490,13 @@ UINT8 z180_readcontrol(struct z180_state *cpustate, offs_t port)
 	return data;
 }
 
+/* a register that maps memory was written */
+static void z180_remapped(struct z180_state *cpustate, int reg, UINT8 data)
+{
+	if (cpustate->device->m_remap_cb)
+		cpustate->device->m_remap_cb((device_t *)cpustate->device, reg, data, cpustate->_PPC);
+}
+
 void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data)
 {
 	if(cpustate->device->m_type == Z180_TYPE_Z182 && (port & 0xff)>= Z182_REGSTART && (port & 0xff)<= Z182_REGEND) {
@@ -1504,21 +1528,25 @@ void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data)
 			case Z182_SCR:
 				LOG("Z182 '%s' SCR wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z182_SCR_WMASK);
 				cpustate->IO_SCR = (cpustate->IO_SCR & ~Z182_SCR_WMASK) | (data & Z182_SCR_WMASK);
+				z180_remapped(cpustate, Z182_SCR, data);
 				break;
 
 			case Z182_RAMUBR:
 				LOG("Z182 '%s' RAMUBR wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z182_RAMUBR_WMASK);
 				cpustate->IO_RAMUBR = (cpustate->IO_RAMUBR & ~Z182_RAMUBR_WMASK) | (data & Z182_RAMUBR_WMASK);
+				z180_remapped(cpustate, Z182_RAMUBR, data);
 				break;
 
 			case Z182_RAMLBR:
 				LOG("Z182 '%s' RAMLBR wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z182_RAMLBR_WMASK);
 				cpustate->IO_RAMLBR = (cpustate->IO_RAMLBR & ~Z182_RAMLBR_WMASK) | (data & Z182_RAMLBR_WMASK);
+				z180_remapped(cpustate, Z182_RAMLBR, data);
 				break;
 
 			case Z182_ROMBR:
 				LOG("Z182 '%s' ROMBR wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z182_ROMBR_WMASK);
 				cpustate->IO_ROMBR = (cpustate->IO_ROMBR & ~Z182_ROMBR_WMASK) | (data & Z182_ROMBR_WMASK);
+				z180_remapped(cpustate, Z182_ROMBR, data);
 				break;
 
 			case Z182_WSGCSR:
@@ -1661,11 +1689,15 @@ void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data)
 		case Z180_CNTR:
 			LOG("Z180 '%s' CNTR   wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z180_CNTR_WMASK);
 			cpustate->IO_CNTR = (cpustate->IO_CNTR & ~Z180_CNTR_WMASK) | (data & Z180_CNTR_WMASK);
+			/* TE or RE starts shifting 8 bits at the selected rate, the external clock is taken as the fastest one */
+			if ((data & (Z180_CNTR_TE | Z180_CNTR_RE)) && !cpustate->csio_cnt)
+				cpustate->csio_cnt = 8 * (20 << ((data & Z180_CNTR_SS) == Z180_CNTR_SS ? 0 : data & Z180_CNTR_SS));
 			break;
 
 		case Z180_TRDR:
 			LOG("Z180 '%s' TRDR   wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z180_TRDR_WMASK);
 			cpustate->IO_TRDR = (cpustate->IO_TRDR & ~Z180_TRDR_WMASK) | (data & Z180_TRDR_WMASK);
+			cpustate->IO_CNTR &= ~Z180_CNTR_EF;
 			break;
 
 		case Z180_TMDR0L:
@@ -1918,18 +1950,21 @@ void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data)
 			LOG("Z180 '%s' CBR    wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z180_CBR_WMASK);
 			cpustate->IO_CBR = (cpustate->IO_CBR & ~Z180_CBR_WMASK) | (data & Z180_CBR_WMASK);
 			z180_mmu(cpustate);
+			z180_remapped(cpustate, Z180_CBR, data);
 			break;
 
 		case Z180_BBR:
 			LOG("Z180 '%s' BBR    wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z180_BBR_WMASK);
 			cpustate->IO_BBR = (cpustate->IO_BBR & ~Z180_BBR_WMASK) | (data & Z180_BBR_WMASK);
 			z180_mmu(cpustate);
+			z180_remapped(cpustate, Z180_BBR, data);
 			break;
 
 		case Z180_CBAR:
 			LOG("Z180 '%s' CBAR   wr $%02x ($%02x)\n", cpustate->device->m_tag, data,  data & Z180_CBAR_WMASK);
 			cpustate->IO_CBAR = (cpustate->IO_CBAR & ~Z180_CBAR_WMASK) | (data & Z180_CBAR_WMASK);
 			z180_mmu(cpustate);
+			z180_remapped(cpustate, Z180_CBAR, data);
 			break;
 
 		case Z180_IO3B:
@@ -1970,6 +2005,78 @@ void z180_writecontrol(struct z180_state *cpustate, offs_t port, UINT8 data)
 
 }
 
+/****************************************************************************
+ * Block I/O fast path for INIR/INDR and OTIR/OTDR. If the I/O space offers
+ * block accessors, up to B bytes are moved in one go and registers, flags,
+ * R and cycles are left as the byte by byte loop would have left them.
+ * Devices see the port of the first iteration only; as B counts down the
+ * high address byte changes, which none of the boards decode.
+ * Returns 0 if the instruction has to run the normal way.
+ ****************************************************************************/
+static void z180_block_done(struct z180_state *cpustate, int step, UINT8 opcode, UINT8 io, int count)
+{
+	cpustate->_B -= count;
+	cpustate->_F = SZ[cpustate->_B];
+	if( io & SF ) cpustate->_F |= NF;
+	if( (cpustate->_C + io + step) & 0x100 ) cpustate->_F |= HF | CF;
+	if( ((step > 0 ? irep_tmp1 : drep_tmp1)[cpustate->_C & 3][io & 3] ^
+			breg_tmp2[cpustate->_B] ^
+			(cpustate->_C >> 2) ^
+			(io >> 2)) & 1 )
+		cpustate->_F |= PF;
+
+	/* the first iteration is accounted for by the caller, every other one
+	 * fetched ED xx again and took the repeat penalty */
+	cpustate->R += 2 * (count - 1);
+	cpustate->extra_cycles += (count - 1) * (cpustate->cc[Z180_TABLE_ed][opcode] + cpustate->cc[Z180_TABLE_ex][opcode]);
+	if( cpustate->_B )
+	{
+		cpustate->_PC -= 2;
+		CC(ex,opcode);
+	}
+}
+
+int z180_block_in(struct z180_state *cpustate, int step, UINT8 opcode)
+{
+	UINT8 buf[256];
+	int count, i;
+
+	if (!cpustate->iospace->read_block || IS_INTERNAL_IO(cpustate, cpustate->_BC) || cpustate->device->m_io_watch_cb)
+		return 0;
+	count = cpustate->iospace->read_block(cpustate->_BC, buf, cpustate->_B ? cpustate->_B : 256);
+	if (count <= 0)
+		return 0;
+	for (i = 0; i < count; i++)
+	{
+		WM(cpustate, cpustate->_HL, buf[i]);
+		cpustate->_HL += step;
+	}
+	z180_block_done(cpustate, step, opcode, buf[count - 1], count);
+	return 1;
+}
+
+int z180_block_out(struct z180_state *cpustate, int step, UINT8 opcode)
+{
+	UINT8 buf[256];
+	int count, i;
+
+	if (!cpustate->iospace->write_block || IS_INTERNAL_IO(cpustate, cpustate->_BC) || cpustate->device->m_io_watch_cb)
+		return 0;
+	count = cpustate->_B ? cpustate->_B : 256;
+	/* offer the bytes past the hooks, and read only the ones the device
+	 * took for real, so watchpoints and counts see what the guest did */
+	for (i = 0; i < count; i++)
+		buf[i] = cpustate->unwatched->read_raw_byte(cpustate, MMU_REMAP_ADDR(cpustate, (cpustate->_HL + i * step) & 0xffff));
+	count = cpustate->iospace->write_block(cpustate->_BC, buf, count);
+	if (count <= 0)
+		return 0;
+	for (i = 0; i < count; i++)
+		RM(cpustate, (cpustate->_HL + i * step) & 0xffff);
+	cpustate->_HL += count * step;
+	z180_block_done(cpustate, step, opcode, buf[count - 1], count);
+	return 1;
+}
+
 int z180_dma0(struct z180_state *cpustate, int max_cycles)
 {
 	if (!(cpustate->IO_DSTAT & Z180_DSTAT_DE0))
@@ -1987,8 +2094,11 @@ int z180_dma0(struct z180_state *cpustate, int max_cycles)
 	}
 
 	int count = (cpustate->IO_DMODE & Z180_DMODE_MMOD) ? bcr0 : 1;
+	int start = bcr0;
 	int cycles = 0;
 
+	cpustate->dma_channel = 1;
+
 	LOG("z180 DMA0 %d %d\n",bcr0,count);
 	while (count > 0)
 	{
@@ -2109,6 +2219,8 @@ int z180_dma0(struct z180_state *cpustate, int max_cycles)
 		if (cycles > max_cycles)
 			break;
 	}
+	if (cpustate->memstats)
+		cpustate->memstats->dma[0] += start - bcr0;
 
 	cpustate->IO_SAR0L = sar0;
 	cpustate->IO_SAR0H = sar0 >> 8;
@@ -2128,9 +2240,95 @@ int z180_dma0(struct z180_state *cpustate, int max_cycles)
 		if (cpustate->IO_DSTAT & Z180_DSTAT_DIE0 && cpustate->IFF1)
 			cpustate->int_pending[Z180_INT_DMA0] = 1;
 	}
+	cpustate->dma_channel = 0;
 	return cycles;
 }
 
+/*
+ * Channel 0 transfer of a whole buffer at once, for a device that has all
+ * of it ready (the turbo floppy). It acts as if DREQ0 were held for the
+ * whole buffer: I/O to memory when to_io is 0 and SAR0 is the port, memory
+ * to I/O when to_io is 1 and DAR0 is the port, port matched under mask.
+ * That is only what the chip does in burst mode with DREQ0 level sensed;
+ * in cycle steal mode or with DREQ0 edge sensed every byte waits for its
+ * own request, so those are left to z180_dma0(). The stolen cycles are
+ * taken off the slice and clock the timers and serial ports. Returns the
+ * bytes moved, 0 if channel 0 is not set up for this transfer.
+ */
+int z180_dma0_block(device_t *device, offs_t port, offs_t mask, UINT8 *buf, int count, int to_io)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	int mode = cpustate->IO_DMODE & (Z180_DMODE_SM | Z180_DMODE_DM);
+	int i, cycles;
+
+	if ((cpustate->IO_DSTAT & (Z180_DSTAT_DME | Z180_DSTAT_DE0)) != (Z180_DSTAT_DME | Z180_DSTAT_DE0) ||
+	    !(cpustate->IO_DMODE & Z180_DMODE_MMOD) || (cpustate->IO_DCNTL & Z180_DCNTL_DIM0))
+		return 0;
+
+	offs_t sar0 = 65536 * cpustate->IO_SAR0B + 256 * cpustate->IO_SAR0H + cpustate->IO_SAR0L;
+	offs_t dar0 = 65536 * cpustate->IO_DAR0B + 256 * cpustate->IO_DAR0H + cpustate->IO_DAR0L;
+	int bcr0 = 256 * cpustate->IO_BCR0H + cpustate->IO_BCR0L;
+
+	if (bcr0 == 0)
+	{
+		bcr0 = 0x10000;
+	}
+
+	if (to_io ? (mode != 0x30 && mode != 0x34) || ((dar0 ^ port) & mask)
+	          : (mode != 0x0c && mode != 0x1c) || ((sar0 ^ port) & mask))
+		return 0;
+
+	if (count > bcr0)
+		count = bcr0;
+	LOG("z180 DMA0 block %d %d\n",bcr0,count);
+	cpustate->dma_channel = 1;
+	for (i = 0; i < count; i++)
+	{
+		switch (mode)
+		{
+		case 0x0c:  /* I/O SAR0 fixed to memory DAR0+1 */
+			cpustate->memory->write_byte(cpustate, dar0++, buf[i]);
+			break;
+		case 0x1c:  /* I/O SAR0 fixed to memory DAR0-1 */
+			cpustate->memory->write_byte(cpustate, dar0--, buf[i]);
+			break;
+		case 0x30:  /* memory SAR0+1 to I/O DAR0 fixed */
+			buf[i] = cpustate->memory->read_byte(cpustate, sar0++);
+			break;
+		case 0x34:  /* memory SAR0-1 to I/O DAR0 fixed */
+			buf[i] = cpustate->memory->read_byte(cpustate, sar0--);
+			break;
+		}
+	}
+	cpustate->dma_channel = 0;
+	bcr0 -= count;
+	if (cpustate->memstats)
+		cpustate->memstats->dma[0] += count;
+	cycles = count * (6 + (cpustate->IO_DCNTL >> 6) * 2);
+	cpustate->icount -= cycles;
+	handle_io_timers(cpustate, cycles);
+
+	cpustate->IO_SAR0L = sar0;
+	cpustate->IO_SAR0H = sar0 >> 8;
+	cpustate->IO_SAR0B = sar0 >> 16;
+	cpustate->IO_DAR0L = dar0;
+	cpustate->IO_DAR0H = dar0 >> 8;
+	cpustate->IO_DAR0B = dar0 >> 16;
+	cpustate->IO_BCR0L = bcr0;
+	cpustate->IO_BCR0H = bcr0 >> 8;
+
+	/* DMA terminal count? */
+	if (bcr0 == 0)
+	{
+		cpustate->iol &= ~Z180_TEND0;
+		cpustate->IO_DSTAT &= ~Z180_DSTAT_DE0;
+		/* terminal count interrupt enabled? */
+		if (cpustate->IO_DSTAT & Z180_DSTAT_DIE0 && cpustate->IFF1)
+			cpustate->int_pending[Z180_INT_DMA0] = 1;
+	}
+	return count;
+}
+
 int z180_dma1(struct z180_state *cpustate)
 {
 	if (!(cpustate->IO_DSTAT & Z180_DSTAT_DE1))
@@ -2152,6 +2350,8 @@ int z180_dma1(struct z180_state *cpustate)
 	if ((cpustate->iol & Z180_DREQ1) == 0)
 		return 0;
 
+	cpustate->dma_channel = 2;
+
 	/* last transfer happening now? */
 	if (bcr1 == 1)
 	{
@@ -2174,6 +2374,8 @@ int z180_dma1(struct z180_state *cpustate)
 		break;
 	}
 	bcr1--;
+	if (cpustate->memstats)
+		cpustate->memstats->dma[1]++;
 
 	cycles += cpustate->IO_DCNTL >> 6; // memory wait states 
 
@@ -2196,6 +2398,7 @@ int z180_dma1(struct z180_state *cpustate)
 			cpustate->int_pending[Z180_INT_DMA1] = 1;
 	}
 
+	cpustate->dma_channel = 0;
 	/* six cycles per transfer (minimum) */
 	return 6 + cycles;
 }
@@ -2241,6 +2444,36 @@ int z180_get_tend1(device_t *device) {
 	return cpustate->iol & Z180_TEND1;
 }
 
+void z180_set_csio_callback(device_t *device, csio_xfer_callback_t csio_xfer_cb) {
+	struct z180_device *d = (struct z180_device *)device;
+	d->m_csio_xfer_cb = csio_xfer_cb;
+}
+
+void z180_set_io_watch(device_t *device, io_watch_callback_t io_watch_cb) {
+	struct z180_device *d = (struct z180_device *)device;
+	d->m_io_watch_cb = io_watch_cb;
+}
+
+void z180_set_remap_watch(device_t *device, remap_callback_t remap_cb) {
+	struct z180_device *d = (struct z180_device *)device;
+	d->m_remap_cb = remap_cb;
+}
+
+/* IN and OUT while I/O is watched, internal registers and iospace alike */
+UINT8 z180_watch_in(struct z180_state *cpustate, offs_t port) {
+	UINT8 data = IS_INTERNAL_IO(cpustate, port) ? z180_readcontrol(cpustate, port) : cpustate->iospace->read_byte(port);
+	cpustate->device->m_io_watch_cb((device_t *)cpustate->device, 0, port, data);
+	return data;
+}
+
+void z180_watch_out(struct z180_state *cpustate, offs_t port, UINT8 data) {
+	if (IS_INTERNAL_IO(cpustate, port))
+		z180_writecontrol(cpustate, port, data);
+	else
+		cpustate->iospace->write_byte(port, data);
+	cpustate->device->m_io_watch_cb((device_t *)cpustate->device, 1, port, data);
+}
+
 
 /*void z180_write_iolines(struct z180_state *cpustate, UINT32 data)
 {
@@ -2414,6 +2647,114 @@ struct memory_select memcs = {
 	memcs_read_raw_byte
 };
 
+/* while memory is watched, data accesses come here first; opcode and
+   operand fetches (read_raw_byte) are not watched */
+UINT8 watch_read_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	struct z180_device *d = cpustate->device;
+	UINT8 data = cpustate->unwatched->read_byte(cpustate, byteaddress);
+	if (d->m_watch_pages[byteaddress >> 12])
+		d->m_watch_cb((device_t *)d, Z180_WATCH_READ, byteaddress, data, data, cpustate->dma_channel);
+	return data;
+}
+
+void watch_write_byte(struct z180_state *cpustate, offs_t byteaddress, UINT8 data) {
+	struct z180_device *d = cpustate->device;
+	UINT8 old;
+	if (!d->m_watch_pages[byteaddress >> 12]) {
+		cpustate->unwatched->write_byte(cpustate, byteaddress, data);
+		return;
+	}
+	old = cpustate->unwatched->read_raw_byte(cpustate, byteaddress);
+	cpustate->unwatched->write_byte(cpustate, byteaddress, data);
+	d->m_watch_cb((device_t *)d, Z180_WATCH_WRITE, byteaddress, old, data, cpustate->dma_channel);
+}
+
+UINT8 watch_read_raw_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	return cpustate->unwatched->read_raw_byte(cpustate, byteaddress);
+}
+
+struct memory_select watched = {
+	watch_read_byte,
+	watch_write_byte,
+	watch_read_raw_byte
+};
+
+/* with the history on, the opcode and operand fetches of an instruction
+   are kept in its entry on the way; outside of one they go to history_none */
+static struct z180_history history_none = { 0, 0, 0, 0, 0, 0, 0, 0, { 0, 0, 0, 0 }, 4 };
+
+UINT8 history_read_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	return cpustate->history_below->read_byte(cpustate, byteaddress);
+}
+
+void history_write_byte(struct z180_state *cpustate, offs_t byteaddress, UINT8 data) {
+	cpustate->history_below->write_byte(cpustate, byteaddress, data);
+}
+
+UINT8 history_read_raw_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	UINT8 data = cpustate->history_below->read_raw_byte(cpustate, byteaddress);
+	if (cpustate->history_cur->len < 4)
+		cpustate->history_cur->op[cpustate->history_cur->len++] = data;
+	return data;
+}
+
+struct memory_select historic = {
+	history_read_byte,
+	history_write_byte,
+	history_read_raw_byte
+};
+
+/* with memory statistics on, every access is counted to its 4K page
+   before it goes on down */
+UINT8 count_read_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	cpustate->memstats->read[(byteaddress >> 12) & 0xff]++;
+	return cpustate->memstats_below->read_byte(cpustate, byteaddress);
+}
+
+void count_write_byte(struct z180_state *cpustate, offs_t byteaddress, UINT8 data) {
+	cpustate->memstats->write[(byteaddress >> 12) & 0xff]++;
+	cpustate->memstats_below->write_byte(cpustate, byteaddress, data);
+}
+
+UINT8 count_read_raw_byte(struct z180_state *cpustate, offs_t byteaddress) {
+	cpustate->memstats->fetch[(byteaddress >> 12) & 0xff]++;
+	return cpustate->memstats_below->read_raw_byte(cpustate, byteaddress);
+}
+
+struct memory_select counted = {
+	count_read_byte,
+	count_write_byte,
+	count_read_raw_byte
+};
+
+/* the memory_select of the chip, under the watch if memory is watched,
+   under the history if that is kept, under the counting if that is on */
+void z180_memory_chain(struct z180_state *cpustate) {
+	struct memory_select *m = cpustate->unwatched;
+	if (cpustate->device->m_watch_pages)
+		m = &watched;
+	cpustate->history_below = m;
+	if (cpustate->history)
+		m = &historic;
+	cpustate->memstats_below = m;
+	if (cpustate->memstats)
+		m = &counted;
+	cpustate->memory = m;
+}
+
+void z180_set_memstats(device_t *device, struct z180_memstats *stats) {
+	struct z180_state *cpustate = get_safe_token(device);
+	cpustate->memstats = stats;
+	z180_memory_chain(cpustate);
+}
+
+void z180_set_watch(device_t *device, const UINT8 *pages, watch_callback_t watch_cb) {
+	struct z180_device *d = (struct z180_device *)device;
+	d->m_watch_pages = pages;
+	d->m_watch_cb = watch_cb;
+	z180_memory_chain(get_safe_token(device));
+}
+
 void z80scc_out_int_cb(device_t *device, int state) {
 	z180_set_irq_line((struct z180_device *)((struct z80scc_device *)device)->m_owner, 0, state);
 }
@@ -2440,6 +2781,7 @@ struct z180_device *cpu_create_z180(char *tag, UINT32 type, UINT32 clock,
 		cpustate->memory = &memcs;
 	else
 		cpustate->memory = &alwaysram;
+	cpustate->unwatched = cpustate->memory;
 	cpustate->ram = ram;
 	cpustate->rom = rom;
 	cpustate->iospace = iospace;
@@ -2762,6 +3104,7 @@ void cpu_reset_z180(device_t *device)
 	cpustate->IO_RDR1    = Z180_RDR1_RESET;*/
 	cpustate->IO_CNTR    = Z180_CNTR_RESET;
 	cpustate->IO_TRDR    = Z180_TRDR_RESET;
+	cpustate->csio_cnt   = 0;
 	cpustate->IO_TMDR0L  = Z180_TMDR0L_RESET;
 	cpustate->IO_TMDR0H  = Z180_TMDR0H_RESET;
 	cpustate->IO_RLDR0L  = Z180_RLDR0L_RESET;
@@ -2895,6 +3238,34 @@ void clock_timers(struct z180_state *cpustate)
 	}
 }
 
+/****************************************************************************
+ * CSI/O: the 8 bits have been shifted, exchange the byte with the attached
+ * device. CSI/O shifts LSB first while SPI devices expect MSB first, so the
+ * byte is mirrored on the way out and on the way in.
+ ****************************************************************************/
+static UINT8 csio_mirror(UINT8 data)
+{
+	data = (data & 0xf0) >> 4 | (data & 0x0f) << 4;
+	data = (data & 0xcc) >> 2 | (data & 0x33) << 2;
+	data = (data & 0xaa) >> 1 | (data & 0x55) << 1;
+	return data;
+}
+
+void z180_csio_complete(struct z180_state *cpustate)
+{
+	/* TXS idles high while only receiving, and RXS floats high without a device */
+	UINT8 out = (cpustate->IO_CNTR & Z180_CNTR_TE) ? cpustate->IO_TRDR : 0xff;
+	UINT8 in = 0xff;
+
+	if (cpustate->device->m_csio_xfer_cb)
+		in = csio_mirror(cpustate->device->m_csio_xfer_cb(cpustate->device, csio_mirror(out)));
+	if (cpustate->IO_CNTR & Z180_CNTR_RE)
+		cpustate->IO_TRDR = in;
+	cpustate->IO_CNTR = (cpustate->IO_CNTR & ~(Z180_CNTR_TE | Z180_CNTR_RE)) | Z180_CNTR_EF;
+	cpustate->csio_cnt = 0;
+	LOG("Z180 '%s' CSI/O  tx $%02x rx $%02x\n", cpustate->device->m_tag, out, in);
+}
+
 int check_interrupts(struct z180_state *cpustate)
 {
 	int i;
@@ -2942,12 +3313,140 @@ int check_interrupts(struct z180_state *cpustate)
 
 void handle_io_timers(struct z180_state *cpustate, int cycles)
 {
+	if (cpustate->csio_cnt)
+	{
+		cpustate->csio_cnt -= cycles;
+		if (cpustate->csio_cnt <= 0)
+			z180_csio_complete(cpustate);
+	}
+
+	/* EF stays up until TRDR is accessed, so keep requesting like the PRT does */
+	if ((cpustate->IO_CNTR & (Z180_CNTR_EF | Z180_CNTR_EIE)) == (Z180_CNTR_EF | Z180_CNTR_EIE) &&
+		cpustate->IFF1 && !cpustate->after_EI)
+		cpustate->int_pending[Z180_INT_CSIO] = 1;
+
 	while (cycles-- > 0)
 	{
 		clock_timers(cpustate);
 	}
 }
 
+/****************************************************************************
+ * Execution history: note the instruction about to run
+ ****************************************************************************/
+INLINE void z180_history_add(struct z180_state *cpustate)
+{
+	struct z180_history *h = &cpustate->history[cpustate->history_next++ & cpustate->history_mask];
+
+	h->cycle = cpustate->cycles + (cpustate->slice - cpustate->icount);
+	h->addr = MMU_REMAP_ADDR(cpustate, cpustate->_PCD);
+	h->pc = cpustate->_PCD;
+	h->af = cpustate->_AF;
+	h->bc = cpustate->_BC;
+	h->de = cpustate->_DE;
+	h->hl = cpustate->_HL;
+	h->sp = cpustate->_SPD;
+	memset(h->op, 0, sizeof(h->op));
+	h->len = 0;
+	h->irq = cpustate->history_irq;
+	cpustate->history_irq = 0;
+	cpustate->history_cur = h;
+	if (cpustate->history_used <= cpustate->history_mask)
+		cpustate->history_used++;
+}
+
+int z180_history_size(device_t *device, int size)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	struct z180_history *history = NULL;
+	UINT32 n = 1;
+
+	if (size > 0)
+	{
+		while (n < (UINT32)size)
+			n <<= 1;
+		if (!(history = calloc(n, sizeof(*history))))
+			return -1;
+	}
+	free(cpustate->history);
+	cpustate->history = history;
+	cpustate->history_mask = n - 1;
+	cpustate->history_next = 0;
+	cpustate->history_used = 0;
+	cpustate->history_cur = &history_none;
+	z180_memory_chain(cpustate);
+	return 0;
+}
+
+int z180_history_get(device_t *device, int back, struct z180_history *h)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+
+	if (back < 0 || (UINT32)back >= cpustate->history_used)
+		return -1;
+	*h = cpustate->history[(cpustate->history_next - 1 - back) & cpustate->history_mask];
+	return 0;
+}
+
+void z180_history_drop(device_t *device, uint64_t cycle)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+
+	while (cpustate->history_used &&
+	       cpustate->history[(cpustate->history_next - 1) & cpustate->history_mask].cycle >= cycle)
+	{
+		cpustate->history_next--;
+		cpustate->history_used--;
+	}
+}
+
+int z180_history_capacity(device_t *device)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+
+	return cpustate->history ? cpustate->history_mask + 1 : 0;
+}
+
+/* more than the boards run in a slice */
+#define HISTORY_SLICE 16384
+
+int z180_history_reserve(device_t *device)
+{
+	if (z180_history_capacity(device) >= HISTORY_SLICE)
+		return 0;
+	return z180_history_size(device, HISTORY_SLICE);
+}
+
+UINT32 z180_history_seq(device_t *device)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+
+	return cpustate->history_next;
+}
+
+int z180_history_next(device_t *device, UINT32 *seq, struct z180_history *h)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	UINT32 behind = cpustate->history_next - *seq;
+
+	if (behind == 0)
+		return 0;
+	if ((INT32)behind < 0)
+	{
+		/* dropped, the debugger went back */
+		*seq = cpustate->history_next;
+		return -1;
+	}
+	if (behind > cpustate->history_used)
+	{
+		/* overwritten before it was read */
+		*seq = cpustate->history_next - cpustate->history_used;
+		return -1;
+	}
+	*h = cpustate->history[(*seq)++ & cpustate->history_mask];
+	return 1;
+}
+
 /****************************************************************************
  * Execute 'cycles' T-states. Return number of T-states really executed
  ****************************************************************************/
@@ -2956,6 +3455,7 @@ void cpu_execute_z180(device_t *device, int icount)
 	struct z180_state *cpustate = get_safe_token(device);
 	int curcycles;
 	cpustate->icount = icount;
+	cpustate->slice = icount;
 
 	/* check for NMIs on the way in; they can only be set externally */
 	/* via timers, and can't be dynamically enabled, so it is safe */
@@ -2975,6 +3475,7 @@ void cpu_execute_z180(device_t *device, int icount)
 		cpustate->_PCD = 0x0066;
 		cpustate->icount -= 11;
 		cpustate->nmi_pending = 0;
+		cpustate->history_irq = 1;
 		handle_io_timers(cpustate, 11);
 	}
 
@@ -3007,6 +3508,8 @@ again:
 
 				if (!cpustate->HALT)
 				{
+					if (cpustate->history)
+						z180_history_add(cpustate);
 					cpustate->R++;
 					cpustate->extra_cycles = 0;
 					curcycles = exec_op(cpustate,ROP(cpustate));
@@ -3065,6 +3568,8 @@ again:
 
 			if (!cpustate->HALT)
 			{
+				if (cpustate->history)
+					z180_history_add(cpustate);
 				cpustate->R++;
 				cpustate->extra_cycles = 0;
 				curcycles = exec_op(cpustate,ROP(cpustate));
@@ -3079,6 +3584,42 @@ again:
 	}
 
 	//cpustate->old_icount -= cpustate->icount;
+	cpustate->cycles += cpustate->slice - cpustate->icount;
+	cpustate->slice = cpustate->icount;
+}
+
+/****************************************************************************
+ * Cycles run since the CPU was created, exact also within a slice
+ ****************************************************************************/
+uint64_t z180_get_cycles(device_t *device)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	return cpustate->cycles + (cpustate->slice - cpustate->icount);
+}
+
+/****************************************************************************
+ * Read memory at a logical address, as mapped now
+ ****************************************************************************/
+UINT8 z180_peek(device_t *device, UINT16 addr)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	return cpustate->unwatched->read_raw_byte(cpustate, MMU_REMAP_ADDR(cpustate, addr));
+}
+
+UINT8 z180_peek_physical(device_t *device, offs_t addr)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	return cpustate->unwatched->read_raw_byte(cpustate, addr & 0xfffff);
+}
+
+/****************************************************************************
+ * End the slice after the instruction about to run
+ ****************************************************************************/
+void z180_end_slice(device_t *device)
+{
+	struct z180_state *cpustate = get_safe_token(device);
+	cpustate->slice -= cpustate->icount;
+	cpustate->icount = 0;
 }
 
 /****************************************************************************
@@ -3431,3 +3972,52 @@ void cpu_set_pc_z180(device_t *device, offs_t pc) {
 }*/
 
 //DEFINE_LEGACY_CPU_DEVICE(Z180, z180);
+
+/* save state: the registers and internal I/O as they are in memory, the
+   pointers of the running cpu are kept when loading */
+void z180_snapshot_save(device_t *device, snapshot_t *s)
+{
+	struct z180_device *d = (struct z180_device *)device;
+	struct z180_state state = *get_safe_token(device);
+
+	/* taken within a slice, what ran of it so far counts as done */
+	state.cycles += state.slice - state.icount;
+	state.slice = state.icount;
+	snapshot_put(s, "z180", &state, sizeof(state));
+	z180asci_snapshot_save(d->z180asci, s);
+	if (d->z80scc)
+		z80scc_snapshot_save(d->z80scc, s);
+}
+
+int z180_snapshot_load(device_t *device, snapshot_t *s)
+{
+	struct z180_device *d = (struct z180_device *)device;
+	struct z180_state *cpustate = get_safe_token(device);
+	struct z180_state live = *cpustate;
+
+	if (snapshot_get(s, "z180", cpustate, sizeof(*cpustate)) == -1)
+		return -1;
+	cpustate->daisy = live.daisy;
+	cpustate->irq_callback = live.irq_callback;
+	cpustate->device = live.device;
+	cpustate->memory = live.memory;
+	cpustate->unwatched = live.unwatched;
+	cpustate->history = live.history;
+	cpustate->history_mask = live.history_mask;
+	cpustate->history_next = live.history_next;
+	cpustate->history_used = live.history_used;
+	cpustate->history_below = live.history_below;
+	cpustate->memstats = live.memstats;
+	cpustate->memstats_below = live.memstats_below;
+	cpustate->history_cur = &history_none;
+	cpustate->dma_channel = 0;
+	cpustate->ram = live.ram;
+	cpustate->rom = live.rom;
+	cpustate->iospace = live.iospace;
+	memcpy(cpustate->cc, live.cc, sizeof(live.cc));
+	if (z180asci_snapshot_load(d->z180asci, s) == -1)
+		return -1;
+	if (d->z80scc && z80scc_snapshot_load(d->z80scc, s) == -1)
+		return -1;
+	return 0;
+}
@@ -173,6 +173,20 @@ extern void z180_writemem(device_t *device, offs_t offset, UINT8 data);
 
 typedef UINT8 (*parport_read_callback_t)(device_t *device, int port);
 typedef void (*parport_write_callback_t)(device_t *device, int port, UINT8 value);
+/* CSI/O slave: gets the byte shifted out on TXS (MSB first, as an SPI device
+ * sees it) and returns the byte it drives on RXS at the same time */
+typedef UINT8 (*csio_xfer_callback_t)(device_t *device, UINT8 data);
+/* memory watch: an access to a watched page, addr is physical. access is
+ * Z180_WATCH_READ or Z180_WATCH_WRITE, old and value are the byte before
+ * and after, dma is 0 for the cpu, or the DMA channel + 1 */
+#define Z180_WATCH_READ		1
+#define Z180_WATCH_WRITE	2
+typedef void (*watch_callback_t)(device_t *device, int access, offs_t addr, UINT8 old, UINT8 value, int dma);
+/* I/O watch: called after every IN (out 0) and OUT (out 1) */
+typedef void (*io_watch_callback_t)(device_t *device, int out, offs_t port, UINT8 value);
+/* remap watch: reg is Z180_CBR, Z180_BBR, Z180_CBAR, or on the Z182
+ * Z182_SCR, Z182_RAMUBR, Z182_RAMLBR or Z182_ROMBR, pc the OUT that wrote it */
+typedef void (*remap_callback_t)(device_t *device, int reg, UINT8 value, UINT16 pc);
 
 struct z180_device {
 	char *m_tag;
@@ -185,6 +199,11 @@ struct z180_device {
 	struct z180asci_device *z180asci;
 	parport_read_callback_t m_parport_read_cb;
 	parport_write_callback_t m_parport_write_cb;
+	csio_xfer_callback_t m_csio_xfer_cb;
+	const UINT8 *m_watch_pages;
+	watch_callback_t m_watch_cb;
+	io_watch_callback_t m_io_watch_cb;
+	remap_callback_t m_remap_cb;
 };
 
 //void cpu_get_info_z180(device_t *device, UINT32 state, cpuinfo *info);
@@ -206,6 +225,11 @@ struct z180_device *cpu_create_z180(char *tag, UINT32 type, UINT32 clock,
 	parport_read_callback_t parport_read_cb, parport_write_callback_t parport_write_cb /* only on Z182 */);
 void cpu_reset_z180(device_t *device);
 void cpu_execute_z180(device_t *device, int icount);
+uint64_t z180_get_cycles(device_t *device);
+/* read memory as the cpu sees it now, without watches or side effects */
+UINT8 z180_peek(device_t *device, UINT16 addr);
+UINT8 z180_peek_physical(device_t *device, offs_t addr);
+void z180_end_slice(device_t *device);
 int cpu_translate_z180(device_t *device, enum address_spacenum space, int intention, offs_t *address);
 
 void z180_set_irq_line(device_t *device, int irqline, int state);
@@ -214,9 +238,60 @@ void z180_set_dreq0(device_t *device, int state);
 void z180_set_dreq1(device_t *device, int state);
 int z180_get_tend0(device_t *device);
 int z180_get_tend1(device_t *device);
+int z180_dma0_block(device_t *device, offs_t port, offs_t mask, UINT8 *buf, int count, int to_io);
+void z180_set_csio_callback(device_t *device, csio_xfer_callback_t csio_xfer_cb);
+/* Data accesses of the cpu and the DMA to the 4K physical pages flagged in
+ * pages[256] go to watch_cb, other pages keep the fast path. With pages
+ * NULL memory is not watched at all. */
+void z180_set_watch(device_t *device, const UINT8 *pages, watch_callback_t watch_cb);
+/* all I/O of the cpu, to the internal registers and to iospace, goes to
+ * io_watch_cb as well; NULL turns it off */
+void z180_set_io_watch(device_t *device, io_watch_callback_t io_watch_cb);
+/* every write to the registers that map memory goes to remap_cb; NULL
+ * turns it off */
+void z180_set_remap_watch(device_t *device, remap_callback_t remap_cb);
+/* Memory statistics: while set, the reads, writes and opcode and operand
+ * fetches of the cpu and the DMA are counted per physical 4K page, and
+ * the bytes each DMA channel moves. NULL stops counting. */
+struct z180_memstats {
+	uint64_t read[256], write[256], fetch[256];
+	uint64_t dma[2];
+};
+void z180_set_memstats(device_t *device, struct z180_memstats *stats);
+
+/* Execution history: the cpu keeps the last instructions it ran in a ring,
+ * each with the registers as they were before it. */
+struct z180_history {
+	uint64_t cycle;
+	offs_t addr;                /* physical pc */
+	UINT16 pc, af, bc, de, hl, sp;
+	UINT8 op[4];
+	UINT8 len;                  /* of op fetched */
+	UINT8 irq;                  /* the first of an interrupt, NMI or TRAP */
+};
+/* keep the last size instructions, rounded up to a power of 2; 0 stops.
+   -1 if there is no memory for it */
+int z180_history_size(device_t *device, int size);
+/* the instruction back ones before the last, -1 if not kept */
+int z180_history_get(device_t *device, int back, struct z180_history *h);
+/* forget what ran from cycle on, when it is to run again */
+void z180_history_drop(device_t *device, uint64_t cycle);
+/* Reading the history as it is written, for a trace: seq starts at
+ * z180_history_seq(). z180_history_next() gives entry seq and advances it,
+ * returns 1 for an entry, 0 if there is no new one, and -1 if entries were
+ * lost, or dropped to be run again: seq is moved on, call again. */
+int z180_history_capacity(device_t *device);
+/* for the tools that read the ring after every slice: make it hold the
+   instructions of a slice at least, -1 if there is no memory for it */
+int z180_history_reserve(device_t *device);
+UINT32 z180_history_seq(device_t *device);
+int z180_history_next(device_t *device, UINT32 *seq, struct z180_history *h);
                                                  
 void cpu_set_pc_z180(device_t *device, offs_t pc);
 offs_t cpu_get_state_z180(device_t *device,int device_state_entry);
 void cpu_string_export_z180(device_t *device, int device_state_entry, char *string);
 
+void z180_snapshot_save(device_t *device, snapshot_t *s);
+int z180_snapshot_load(device_t *device, snapshot_t *s);
+
 #endif /* __Z180_H__ */
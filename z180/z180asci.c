@@ -811,3 +811,28 @@ void z180asci_channel_update_serial(struct z180asci_channel *ch)
 		LOG("   - Transmit clock: %d mode: %d rate: %d/%xh\n", ch->m_rxc, clocks, ch->m_rxc / clocks, ch->m_rxc / clocks);
 	}*/
 }
+
+static int z180asci_channel_snapshot_load(struct z180asci_channel *ch, const char *name, snapshot_t *s)
+{
+	struct z180asci_channel live = *ch;
+
+	if (snapshot_get(s, name, ch, sizeof(*ch)) == -1)
+		return -1;
+	ch->m_tag = live.m_tag;
+	ch->m_uart = live.m_uart;
+	return 0;
+}
+
+void z180asci_snapshot_save(struct z180asci_device *device, snapshot_t *s)
+{
+	snapshot_put(s, "asci0", device->m_chan0, sizeof(struct z180asci_channel));
+	snapshot_put(s, "asci1", device->m_chan1, sizeof(struct z180asci_channel));
+}
+
+int z180asci_snapshot_load(struct z180asci_device *device, snapshot_t *s)
+{
+	if (z180asci_channel_snapshot_load(device->m_chan0, "asci0", s) == -1 ||
+	    z180asci_channel_snapshot_load(device->m_chan1, "asci1", s) == -1)
+		return -1;
+	return 0;
+}
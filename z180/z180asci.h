@@ -96,5 +96,7 @@ void z180asci_device_reset(struct z180asci_device *device);
 void z180asci_channel_device_timer(struct z180asci_channel *ch /*, emu_timer *timer, device_timer_id id, int param, void *ptr*/);
 uint8_t z180asci_channel_register_read(struct z180asci_channel *ch, uint8_t reg);
 void z180asci_channel_register_write(struct z180asci_channel *ch, uint8_t reg, uint8_t data);
+void z180asci_snapshot_save(struct z180asci_device *device, snapshot_t *s);
+int z180asci_snapshot_load(struct z180asci_device *device, snapshot_t *s);
 
 #endif // __Z180ASCI_H
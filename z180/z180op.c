@@ -303,6 +303,9 @@ int take_interrupt(struct z180_state *cpustate, int irq)
 	/* Check if processor was halted */
 	LEAVE_HALT(cpustate);
 
+	/* the next history entry is the handler's */
+	cpustate->history_irq = 1;
+
 	if( irq == Z180_INT_TRAP )
 	{
 		PUSH(cpustate,  PC );
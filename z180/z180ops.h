@@ -17,20 +17,28 @@
 	}                                                           \
 }
 
+/***************************************************************
+ * Does the given I/O port address an internal register?
+ ***************************************************************/
+#define IS_INTERNAL_IO(cs,port)                                 \
+	((((port ^ (cs)->IO_IOCR) & 0xffc0) == 0)||					\
+	(cs->device->m_type == Z180_TYPE_Z182 && (port & 0xff)>= Z182_REGSTART && (port & 0xff)<= Z182_REGEND))
+
 /***************************************************************
  * Input a byte from given I/O port
  ***************************************************************/
 #define IN(cs,port)                                             \
-	((((port ^ (cs)->IO_IOCR) & 0xffc0) == 0)||					\
-	(cs->device->m_type == Z180_TYPE_Z182 && (port & 0xff)>= Z182_REGSTART && (port & 0xff)<= Z182_REGEND))?  \
-		z180_readcontrol(cs, port) : (cs)->iospace->read_byte(port)
+	((cs)->device->m_io_watch_cb ? z180_watch_in(cs, port) :    \
+	IS_INTERNAL_IO(cs,port) ?                                   \
+		z180_readcontrol(cs, port) : (cs)->iospace->read_byte(port))
 
 /***************************************************************
  * Output a byte to given I/O port
  ***************************************************************/
 #define OUT(cs,port,value)                                      \
-	if ((((port ^ (cs)->IO_IOCR) & 0xffc0) == 0)||					\
-	(cs->device->m_type == Z180_TYPE_Z182 && (port & 0xff)>= Z182_REGSTART && (port & 0xff)<= Z182_REGEND))  \
+	if ((cs)->device->m_io_watch_cb)                            \
+		z180_watch_out(cs,port,value);                          \
+	else if (IS_INTERNAL_IO(cs,port))                           \
 		z180_writecontrol(cs,port,value);                       \
 	else (cs)->iospace->write_byte(port,value)
 
@@ -174,7 +182,7 @@ INLINE UINT32 ARG16(struct z180_state *cpustate)
 	}                                                           \
 	else                                                        \
 	{                                                           \
-		cpustate->_PC += 2;                                             \
+		ARG16(cpustate); /* read, as by the chip, for the history */ \
 	}
 
 /***************************************************************
@@ -196,7 +204,7 @@ INLINE UINT32 ARG16(struct z180_state *cpustate)
 		cpustate->_PC += arg;           /* so don't do cpustate->_PC += ARG(cpustate) */  \
 		CC(ex,opcode);                                          \
 	}                                                           \
-	else cpustate->_PC++;
+	else ARG(cpustate); /* read, as by the chip, for the history */
 /***************************************************************
  * CALL
  ***************************************************************/
@@ -218,7 +226,7 @@ INLINE UINT32 ARG16(struct z180_state *cpustate)
 	}                                                           \
 	else                                                        \
 	{                                                           \
-		cpustate->_PC+=2;                                               \
+		ARG16(cpustate); /* read, as by the chip, for the history */ \
 	}
 
 /***************************************************************
@@ -819,22 +827,28 @@ INLINE UINT8 SET(UINT8 bit, UINT8 value)
  * INIR
  ***************************************************************/
 #define INIR                                                    \
-	INI;                                                        \
-	if( cpustate->_B )                                                  \
+	if( !z180_block_in(cpustate, 1, 0xb2) )                    \
 	{                                                           \
-		cpustate->_PC -= 2;                                             \
-		CC(ex,0xb2);                                            \
+		INI;                                                    \
+		if( cpustate->_B )                                              \
+		{                                                       \
+			cpustate->_PC -= 2;                                         \
+			CC(ex,0xb2);                                        \
+		}                                                       \
 	}
 
 /***************************************************************
  * OTIR
  ***************************************************************/
 #define OTIR                                                    \
-	OUTI;                                                       \
-	if( cpustate->_B )                                                  \
+	if( !z180_block_out(cpustate, 1, 0xb3) )                    \
 	{                                                           \
-		cpustate->_PC -= 2;                                             \
-		CC(ex,0xb3);                                            \
+		OUTI;                                                   \
+		if( cpustate->_B )                                              \
+		{                                                       \
+			cpustate->_PC -= 2;                                         \
+			CC(ex,0xb3);                                        \
+		}                                                       \
 	}
 
 /***************************************************************
@@ -863,22 +877,28 @@ INLINE UINT8 SET(UINT8 bit, UINT8 value)
  * INDR
  ***************************************************************/
 #define INDR                                                    \
-	IND;                                                        \
-	if( cpustate->_B )                                                  \
+	if( !z180_block_in(cpustate, -1, 0xba) )                    \
 	{                                                           \
-		cpustate->_PC -= 2;                                             \
-		CC(ex,0xba);                                            \
+		IND;                                                    \
+		if( cpustate->_B )                                              \
+		{                                                       \
+			cpustate->_PC -= 2;                                         \
+			CC(ex,0xba);                                        \
+		}                                                       \
 	}
 
 /***************************************************************
  * OTDR
  ***************************************************************/
 #define OTDR                                                    \
-	OUTD;                                                       \
-	if( cpustate->_B )                                                  \
+	if( !z180_block_out(cpustate, -1, 0xbb) )                    \
 	{                                                           \
-		cpustate->_PC -= 2;                                             \
-		CC(ex,0xbb);                                            \
+		OUTD;                                                   \
+		if( cpustate->_B )                                              \
+		{                                                       \
+			cpustate->_PC -= 2;                                         \
+			CC(ex,0xbb);                                        \
+		}                                                       \
 	}
 
 /***************************************************************
@@ -23,6 +23,7 @@ extern void dbg_log(const char *fmt, ...);
 
 #include <stdint.h>
 #include <assert.h>
+#include "../snapshot/snapshot.h"
 typedef uint8_t UINT8;
 typedef uint16_t UINT16;
 typedef uint32_t UINT32;
@@ -162,6 +163,11 @@ struct address_space
 	// accessor methods for reading raw data (opcodes)
 	UINT8 (*read_raw_byte)(offs_t byteaddress/*, offs_t directxor = 0*/);
 	//UINT16 (*read_raw_word)(offs_t byteaddress/*, offs_t directxor = 0*/);
+
+	// optional block accessors, used by the INIR/OTIR family on I/O spaces;
+	// they return the number of bytes moved, 0 means fall back to read_byte/write_byte
+	int (*read_block)(offs_t byteaddress, UINT8 *buf, int count);
+	int (*write_block)(offs_t byteaddress, const UINT8 *buf, int count);
 };
 
 #endif
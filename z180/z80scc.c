@@ -3361,3 +3361,44 @@ void z80scc_channel_check_waitrequest(struct z80scc_channel *ch)
 		//ch->m_uart->m_out_wreq_cb[ch->m_index](((ch->m_rr0 & RR0_TX_BUFFER_EMPTY) && (ch->m_wr5 & WR5_TX_ENABLE)) ? 0 : 1);
 	}
 }
+
+static int z80scc_channel_snapshot_load(struct z80scc_channel *ch, const char *name, snapshot_t *s)
+{
+	struct z80scc_channel live = *ch;
+
+	if (snapshot_get(s, name, ch, sizeof(*ch)) == -1)
+		return -1;
+	ch->m_tag = live.m_tag;
+#if Z80SCC_USE_LOCAL_BRG
+	ch->baudtimer = live.baudtimer;
+#endif
+	ch->m_uart = live.m_uart;
+	return 0;
+}
+
+void z80scc_snapshot_save(struct z80scc_device *device, snapshot_t *s)
+{
+	snapshot_put(s, "escc", device, sizeof(*device));
+	snapshot_put(s, "esccA", device->m_chanA, sizeof(struct z80scc_channel));
+	snapshot_put(s, "esccB", device->m_chanB, sizeof(struct z80scc_channel));
+}
+
+int z80scc_snapshot_load(struct z80scc_device *device, snapshot_t *s)
+{
+	struct z80scc_device live = *device;
+
+	if (snapshot_get(s, "escc", device, sizeof(*device)) == -1)
+		return -1;
+	device->m_tag = live.m_tag;
+	device->m_owner = live.m_owner;
+	device->m_chanA = live.m_chanA;
+	device->m_chanB = live.m_chanB;
+	device->tx_callback = live.tx_callback;
+	device->rx_callback = live.rx_callback;
+	device->m_out_int_cb = live.m_out_int_cb;
+	device->m_cputag = live.m_cputag;
+	if (z80scc_channel_snapshot_load(device->m_chanA, "esccA", s) == -1 ||
+	    z80scc_channel_snapshot_load(device->m_chanB, "esccB", s) == -1)
+		return -1;
+	return 0;
+}
@@ -578,5 +578,7 @@ uint8_t z80scc_channel_control_read(struct z80scc_channel *ch);
 void z80scc_channel_control_write(struct z80scc_channel *ch, uint8_t data);
 uint8_t z80scc_channel_data_read(struct z80scc_channel *ch);
 void z80scc_channel_data_write(struct z80scc_channel *ch, uint8_t data);
+void z80scc_snapshot_save(struct z80scc_device *device, snapshot_t *s);
+int z80scc_snapshot_load(struct z80scc_device *device, snapshot_t *s);
 
 #endif // __Z80SCC_H